@@ -17,7 +17,11 @@
 
 package api
 
-import "google.golang.org/protobuf/types/known/anypb"
+import (
+	"time"
+
+	"google.golang.org/protobuf/types/known/anypb"
+)
 
 // request
 type HttpDecoderFilter interface {
@@ -95,6 +99,31 @@ type FilterCallbacks interface {
 	SendLocalReply(responseCode int, bodyText string, headers map[string]string, grpcStatus int64, details string)
 	// RecoverPanic recover panic in defer
 	RecoverPanic()
+	// CacheDecision caches the verdict of the decode header phase for ttl, when the decision cache
+	// is configured, it should be invoked before Continue or SendLocalReply in the phase.
+	// The later requests with the same key headers are served by Envoy without the plugin, for the
+	// whole stream, so the verdict should only depend on the key headers.
+	CacheDecision(ttl time.Duration)
+	// AsyncStarted records the time that the goroutine of the async phase starts running, it
+	// should be invoked at the beginning of the goroutine, so the Go scheduler lag is told apart
+	// from the work time of the plugin in the stats.
+	// NP: the CPU time of the goroutine is unknown, it's not counted in the cpu_time_us stats,
+	// nor charged to the CPU budget.
+	AsyncStarted()
+	// SetSpanTag sets the tag on the span of the async phase, the span is a child of the active
+	// span of the stream, and it's finished when the phase continues.
+	SetSpanTag(key, value string)
+	// AddSpan adds a child span to the span of the async phase, i.e. for a call to a backend.
+	// NP: the tags and spans are batched, and flushed to Envoy by Continue or SendLocalReply,
+	// so they're dropped in the sync phases.
+	AddSpan(name string, start, end time.Time, tags map[string]string)
+	// Log queues the record to the logger of Envoy, it never blocks, the record is dropped when
+	// the queue is full.
+	Log(level LogType, message string)
+	// Logf formats the record only when the level is enabled.
+	Logf(level LogType, format string, args ...interface{})
+	// LogEnabled tells whether the records of the level are logged by Envoy.
+	LogEnabled(level LogType) bool
 	/*
 		AddDecodedData(buffer BufferInstance, streamingFilter bool)
 	*/
@@ -103,3 +132,25 @@ type FilterCallbacks interface {
 type FilterCallbackHandler interface {
 	FilterCallbacks
 }
+
+// The metrics of the plugin, they're the stats of Envoy, flushed to the stats sinks.
+// Updating the counters and gauges is an atomic operation in Go, without calling into Envoy.
+
+type CounterMetric interface {
+	// NP: the counter never decreases, it panics when the offset is negative.
+	Increment(offset int64)
+	Get() uint64
+}
+
+type GaugeMetric interface {
+	Increment(offset int64)
+	// NP: the gauge of Envoy is unsigned, so the value should not be negative.
+	Set(value int64)
+	Get() int64
+}
+
+type HistogramMetric interface {
+	// Record is batched, the values are passed to Envoy when there are enough of them, or
+	// every second.
+	Record(value uint64)
+}
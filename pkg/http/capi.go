@@ -67,6 +67,9 @@ type HttpCAPI interface {
 	HttpGetDynamicMetadata(r *httpRequest, filterName string) map[string]interface{}
 	HttpSetDynamicMetadata(r *httpRequest, filterName string, key string, value interface{})
 
+	HttpCacheDecision(r *httpRequest, ttlMs uint64)
+	HttpFlushSpans(r *httpRequest, batch []byte)
+
 	HttpFinalize(r *httpRequest, reason int)
 }
 
@@ -213,42 +216,47 @@ func (c *httpCApiImpl) HttpSetTrailer(r *httpRequest, key *string, value *string
 
 func (c *httpCApiImpl) HttpGetRouteName(r *httpRequest) string {
 	var value string
-	// lock the req_->strValue in the C side, which do not allow concurrency.
-	r.mutex.Lock()
-	defer r.mutex.Unlock()
-
+	// the value refers to the request arena in the C side, it's stable until the request is finalized.
 	res := C.moeHttpGetStringValue(unsafe.Pointer(r.req), ValueRouteName, unsafe.Pointer(&value))
 	handleCApiStatus(res)
-	// copy the memory from c to Go.
+	// copy the memory from c to Go, since the route name may be kept beyond the request.
 	return strings.Clone(value)
 }
 
+func (c *httpCApiImpl) HttpCacheDecision(r *httpRequest, ttlMs uint64) {
+	res := C.moeHttpCacheDecision(unsafe.Pointer(r.req), C.ulonglong(ttlMs))
+	handleCApiStatus(res)
+}
+
+func (c *httpCApiImpl) HttpFlushSpans(r *httpRequest, batch []byte) {
+	res := C.moeHttpFlushSpans(unsafe.Pointer(r.req), unsafe.Pointer(&batch))
+	handleCApiStatus(res)
+}
+
 func (c *httpCApiImpl) HttpFinalize(r *httpRequest, reason int) {
 	C.moeHttpFinalize(unsafe.Pointer(r.req), C.int(reason))
 }
 
 func (c *httpCApiImpl) HttpGetDynamicMetadata(r *httpRequest, filterName string) map[string]interface{} {
 	var buf []byte
-	r.sema.Add(1)
-
-	// lock the req_->strValue in the C side, which do not allow concurrency.
-	r.mutex.Lock()
-	defer r.mutex.Unlock()
+	key := unsafe.Pointer(&buf)
+	wait := r.addWaiter(key)
 
-	res := C.moeHttpGetDynamicMetadata(unsafe.Pointer(r.req), unsafe.Pointer(&filterName), unsafe.Pointer(&buf))
+	// buf refers to the request arena in the C side, no lock required for concurrent getters.
+	res := C.moeHttpGetDynamicMetadata(unsafe.Pointer(r.req), unsafe.Pointer(&filterName), key)
 	if res == C.CAPIYield {
 		// C post a callback to the Envoy worker thread, waiting the C callback.
-		r.sema.Wait()
+		<-wait
 	} else {
 		// already in the Envoy worker thread currently, do not need to wait the C callback.
-		r.sema.Done()
+		r.wakeWaiter(key)
 		handleCApiStatus(res)
 	}
 	// means not found
 	if len(buf) == 0 {
 		return map[string]interface{}{}
 	}
-	// copy the memory from c to Go.
+	// unmarshal copies the memory from c to Go, no need to clone buf.
 	var meta structpb.Struct
 	proto.Unmarshal(buf, &meta)
 	return meta.AsMap()
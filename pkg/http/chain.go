@@ -0,0 +1,403 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package http
+
+import (
+	"errors"
+	"runtime/debug"
+	"sync"
+
+	"google.golang.org/protobuf/encoding/protowire"
+	"google.golang.org/protobuf/proto"
+	"google.golang.org/protobuf/types/known/anypb"
+
+	"mosn.io/envoy-go-extension/pkg/api"
+)
+
+// chainTypeURL is the type url of the plugin_config that chains several plugins of the library,
+// they run sequentially in one golang filter, so Envoy crosses into Go once per phase for the
+// whole chain.
+const chainTypeURL = "type.googleapis.com/envoy.extensions.filters.http.golang.v3.Chain"
+
+var errInvalidChain = errors.New("invalid chain config")
+
+var chainPlugin = httpFilterPlugin{factory: chainFactory, parser: &chainParser{}}
+
+type chainedPlugin struct {
+	name   string
+	plugin httpFilterPlugin
+	config interface{}
+}
+
+type chainConfig struct {
+	plugins []chainedPlugin
+	fanOut  bool
+}
+
+func parsePlugin(name string, any *anypb.Any) chainedPlugin {
+	plugin := getHttpFilterPlugin(name)
+	if plugin.parser != nil {
+		return chainedPlugin{name: name, plugin: plugin, config: plugin.parser.Parse(any)}
+	}
+	return chainedPlugin{name: name, plugin: plugin, config: any}
+}
+
+// parseChainPlugin decodes the Chain.Plugin message: plugin_name = 1, plugin_config = 2.
+func parseChainPlugin(buf []byte) (chainedPlugin, error) {
+	var name string
+	var any anypb.Any
+	for len(buf) > 0 {
+		num, typ, n := protowire.ConsumeTag(buf)
+		if n < 0 {
+			return chainedPlugin{}, protowire.ParseError(n)
+		}
+		buf = buf[n:]
+		switch {
+		case num == 1 && typ == protowire.BytesType:
+			var v []byte
+			v, n = protowire.ConsumeBytes(buf)
+			name = string(v)
+		case num == 2 && typ == protowire.BytesType:
+			var v []byte
+			v, n = protowire.ConsumeBytes(buf)
+			if n >= 0 {
+				if err := proto.Unmarshal(v, &any); err != nil {
+					return chainedPlugin{}, err
+				}
+			}
+		default:
+			n = protowire.ConsumeFieldValue(num, typ, buf)
+		}
+		if n < 0 {
+			return chainedPlugin{}, protowire.ParseError(n)
+		}
+		buf = buf[n:]
+	}
+	if name == "" {
+		return chainedPlugin{}, errInvalidChain
+	}
+	return parsePlugin(name, &any), nil
+}
+
+// parseChain decodes the Chain message: repeated Plugin plugins = 1, bool fan_out = 2.
+// NP: the api protos are not generated for Go, so it's decoded from the wire format.
+func parseChain(any *anypb.Any) (*chainConfig, error) {
+	conf := &chainConfig{}
+	buf := any.GetValue()
+	for len(buf) > 0 {
+		num, typ, n := protowire.ConsumeTag(buf)
+		if n < 0 {
+			return nil, protowire.ParseError(n)
+		}
+		buf = buf[n:]
+		if num == 1 && typ == protowire.BytesType {
+			var v []byte
+			v, n = protowire.ConsumeBytes(buf)
+			if n >= 0 {
+				plugin, err := parseChainPlugin(v)
+				if err != nil {
+					return nil, err
+				}
+				conf.plugins = append(conf.plugins, plugin)
+			}
+		} else if num == 2 && typ == protowire.VarintType {
+			var v uint64
+			v, n = protowire.ConsumeVarint(buf)
+			conf.fanOut = v != 0
+		} else {
+			n = protowire.ConsumeFieldValue(num, typ, buf)
+		}
+		if n < 0 {
+			return nil, protowire.ParseError(n)
+		}
+		buf = buf[n:]
+	}
+	if len(conf.plugins) == 0 {
+		return nil, errInvalidChain
+	}
+	return conf, nil
+}
+
+type chainParser struct {
+}
+
+func (p *chainParser) Parse(any *anypb.Any) interface{} {
+	conf, err := parseChain(any)
+	if err != nil {
+		return nil
+	}
+	return conf
+}
+
+// Merge merges the plugins with the same name, the plugins that only exist in the child are
+// appended to the chain.
+func (p *chainParser) Merge(parent interface{}, child interface{}) interface{} {
+	parentConfig := parent.(*chainConfig)
+	childConfig, ok := child.(*chainConfig)
+	if !ok {
+		// NP: the merged config is still a chain, so the route config that is not a chain
+		// can not be merged, the parent chain is used for the route.
+		Logf(api.Error, "the route config of a chain is not a chain: %T, use the parent chain", child)
+		return parentConfig
+	}
+
+	plugins := append([]chainedPlugin{}, parentConfig.plugins...)
+	for _, c := range childConfig.plugins {
+		merged := false
+		for i := range plugins {
+			if plugins[i].name != c.name {
+				continue
+			}
+			if parser := plugins[i].plugin.parser; parser != nil {
+				plugins[i].config = parser.Merge(plugins[i].config, c.config)
+			} else {
+				plugins[i].config = c.config
+			}
+			merged = true
+			break
+		}
+		if !merged {
+			plugins = append(plugins, c)
+		}
+	}
+	return &chainConfig{plugins: plugins, fanOut: parentConfig.fanOut || childConfig.fanOut}
+}
+
+func chainFactory(c interface{}) api.HttpFilterFactory {
+	conf := c.(*chainConfig)
+	factories := make([]api.HttpFilterFactory, len(conf.plugins))
+	for i, p := range conf.plugins {
+		factories[i] = p.plugin.factory(p.config)
+	}
+	return func(callbacks api.FilterCallbackHandler) api.HttpFilter {
+		f := &chainFilter{
+			callbacks: callbacks,
+			filters:   make([]api.HttpFilter, len(factories)),
+			chained:   make([]*chainCallbacks, len(factories)),
+			fanOut:    conf.fanOut,
+		}
+		for i, factory := range factories {
+			f.chained[i] = &chainCallbacks{FilterCallbackHandler: callbacks, chain: f, index: i}
+			f.filters[i] = factory(f.chained[i])
+		}
+		return f
+	}
+}
+
+// chainCallbacks resumes the chain from the next filter, when an async filter continues.
+// In the fan out, it's the callbacks of the plugin's own branch, from the fan out starts to the
+// verdict of the plugin, so the plugins running concurrently do not share the request state.
+type chainCallbacks struct {
+	api.FilterCallbackHandler
+	chain *chainFilter
+	index int
+
+	// NP: it's set in the Envoy thread, and reset by the goroutine of the plugin.
+	fanningLock sync.Mutex
+	fanning     *fanOut
+}
+
+func (c *chainCallbacks) attach(o *fanOut) {
+	c.fanningLock.Lock()
+	c.fanning = o
+	c.fanningLock.Unlock()
+}
+
+// detach ends the branch of the plugin in the fan out, false means it has ended already.
+func (c *chainCallbacks) detach(o *fanOut) bool {
+	c.fanningLock.Lock()
+	defer c.fanningLock.Unlock()
+	if c.fanning != o {
+		return false
+	}
+	c.fanning = nil
+	return true
+}
+
+func (c *chainCallbacks) getFanning() *fanOut {
+	c.fanningLock.Lock()
+	defer c.fanningLock.Unlock()
+	return c.fanning
+}
+
+func (c *chainCallbacks) Continue(status api.StatusType) {
+	if o := c.getFanning(); o != nil {
+		o.finish(c.index, status, nil)
+		return
+	}
+	c.chain.resume(c.index, status)
+}
+
+func (c *chainCallbacks) SendLocalReply(responseCode int, bodyText string, headers map[string]string, grpcStatus int64, details string) {
+	if o := c.getFanning(); o != nil {
+		o.finish(c.index, api.LocalReply, &localReply{responseCode, bodyText, headers, grpcStatus, details})
+		return
+	}
+	c.FilterCallbackHandler.SendLocalReply(responseCode, bodyText, headers, grpcStatus, details)
+}
+
+// RecoverPanic recovers the panic itself, since recover only works in the deferred function, the
+// panic of a plugin in the fan out is its verdict.
+func (c *chainCallbacks) RecoverPanic() {
+	e := recover()
+	if e == nil {
+		return
+	}
+	if o := c.getFanning(); o != nil {
+		Logf(api.Error, "got panic: %v, phase: fan out %v, stack: %s", e, api.DecodeHeaderPhase, debug.Stack())
+		o.finish(c.index, api.LocalReply, &localReply{responseCode: 500, bodyText: "error happened in Go filter\r\n"})
+		return
+	}
+	if h, ok := c.FilterCallbackHandler.(panicHandler); ok {
+		h.handlePanic(e)
+		return
+	}
+	panic(e)
+}
+
+// AsyncStarted is ignored in the fan out, the scheduling delay of the phase is not of one plugin.
+func (c *chainCallbacks) AsyncStarted() {
+	if c.getFanning() != nil {
+		return
+	}
+	c.FilterCallbackHandler.AsyncStarted()
+}
+
+// panicHandler handles the panic recovered by the callbacks that wrap the request.
+type panicHandler interface {
+	handlePanic(e interface{})
+}
+
+// chainFilter runs the filters sequentially over the same header map and buffer, the decode
+// phases run in the declared order and the encode phases in the reverse order, like the
+// separated filters. A filter that does not continue stops the rest of the chain in the phase,
+// and its status is the status of the chain.
+type chainFilter struct {
+	callbacks api.FilterCallbackHandler
+	filters   []api.HttpFilter
+
+	// the running phase, it's used to resume the chain after an async filter continues.
+	// NP: it's set before running the filters, so it's visible in the goroutines they start.
+	phase     func(api.HttpFilter) api.StatusType
+	reverse   bool
+	resumePos *int
+
+	// the position the data phases resume from. When a filter buffers the data, the filters
+	// before it have continued the buffered bytes already, so the next data of the phase runs
+	// from the buffering filter, instead of passing the same bytes to them again.
+	// NP: the filters before it do not see the data that arrives while it's buffering.
+	decodeDataPos int
+	encodeDataPos int
+
+	// run the decode header phase concurrently, the callbacks of the plugins go to the fan out
+	// while it's running, see chainCallbacks.
+	chained []*chainCallbacks
+	fanOut  bool
+}
+
+// run runs the filters from pos, resumePos is the resume position of the data phases, nil for
+// the other phases.
+func (f *chainFilter) run(pos int, reverse bool, resumePos *int, phase func(api.HttpFilter) api.StatusType) api.StatusType {
+	f.phase, f.reverse, f.resumePos = phase, reverse, resumePos
+	for ; pos < len(f.filters); pos++ {
+		i := pos
+		if reverse {
+			i = len(f.filters) - 1 - pos
+		}
+		if status := phase(f.filters[i]); status != api.Continue {
+			// Running: the async filter resumes the chain when it continues.
+			f.stopAt(pos, status)
+			return status
+		}
+	}
+	f.stopAt(0, api.Continue)
+	return api.Continue
+}
+
+func (f *chainFilter) stopAt(pos int, status api.StatusType) {
+	if f.resumePos == nil || status == api.Running {
+		return
+	}
+	if status == api.StopAndBuffer || status == api.StopAndBufferWatermark {
+		*f.resumePos = pos
+	} else {
+		*f.resumePos = 0
+	}
+}
+
+func (f *chainFilter) resume(index int, status api.StatusType) {
+	pos := index
+	if f.reverse {
+		pos = len(f.filters) - 1 - index
+	}
+	if status == api.Continue {
+		status = f.run(pos+1, f.reverse, f.resumePos, f.phase)
+		if status == api.Running {
+			// another async filter continues it.
+			return
+		}
+	} else {
+		f.stopAt(pos, status)
+	}
+	f.callbacks.Continue(status)
+}
+
+func (f *chainFilter) DecodeHeaders(header api.RequestHeaderMap, endStream bool) api.StatusType {
+	if f.fanOut && len(f.filters) > 1 {
+		return f.fanOutDecodeHeaders(header, endStream)
+	}
+	return f.run(0, false, nil, func(filter api.HttpFilter) api.StatusType {
+		return filter.DecodeHeaders(header, endStream)
+	})
+}
+
+func (f *chainFilter) DecodeData(buffer api.BufferInstance, endStream bool) api.StatusType {
+	return f.run(f.decodeDataPos, false, &f.decodeDataPos, func(filter api.HttpFilter) api.StatusType {
+		return filter.DecodeData(buffer, endStream)
+	})
+}
+
+func (f *chainFilter) DecodeTrailers(trailers api.RequestTrailerMap) api.StatusType {
+	return f.run(0, false, nil, func(filter api.HttpFilter) api.StatusType {
+		return filter.DecodeTrailers(trailers)
+	})
+}
+
+func (f *chainFilter) EncodeHeaders(header api.ResponseHeaderMap, endStream bool) api.StatusType {
+	return f.run(0, true, nil, func(filter api.HttpFilter) api.StatusType {
+		return filter.EncodeHeaders(header, endStream)
+	})
+}
+
+func (f *chainFilter) EncodeData(buffer api.BufferInstance, endStream bool) api.StatusType {
+	return f.run(f.encodeDataPos, true, &f.encodeDataPos, func(filter api.HttpFilter) api.StatusType {
+		return filter.EncodeData(buffer, endStream)
+	})
+}
+
+func (f *chainFilter) EncodeTrailers(trailers api.ResponseTrailerMap) api.StatusType {
+	return f.run(0, true, nil, func(filter api.HttpFilter) api.StatusType {
+		return filter.EncodeTrailers(trailers)
+	})
+}
+
+func (f *chainFilter) OnDestroy(reason api.DestroyReason) {
+	for _, filter := range f.filters {
+		filter.OnDestroy(reason)
+	}
+}
@@ -32,34 +32,67 @@ package http
 import "C"
 
 import (
+	"runtime/debug"
 	"sync"
 	"sync/atomic"
 
 	"google.golang.org/protobuf/proto"
 	"google.golang.org/protobuf/types/known/anypb"
 
+	"mosn.io/envoy-go-extension/pkg/api"
 	"mosn.io/envoy-go-extension/pkg/utils"
 )
 
 var (
 	configNumGenerator uint64
-	configCache        = &sync.Map{} // uint64 -> *anypb.Any
+	configCache        = &sync.Map{} // uint64 -> *pluginConfig
 )
 
+// pluginConfig is the parsed config of a plugin, with the plugin it belongs to.
+type pluginConfig struct {
+	plugin httpFilterPlugin
+	config interface{}
+}
+
+func storePluginConfig(config *pluginConfig) uint64 {
+	configNum := atomic.AddUint64(&configNumGenerator, 1)
+	configCache.Store(configNum, config)
+	return configNum
+}
+
+// recoverConfigPanic turns the panic of the plugin parser into the invalid config 0, instead of
+// panicking in the cgo export.
+func recoverConfigPanic(id *uint64) {
+	if e := recover(); e != nil {
+		Logf(api.Error, "invalid plugin config: %v, stack: %s", e, debug.Stack())
+		*id = 0
+	}
+}
+
 //export moeNewHttpPluginConfig
-func moeNewHttpPluginConfig(configPtr uint64, configLen uint64) uint64 {
+func moeNewHttpPluginConfig(namePtr uint64, nameLen uint64, configPtr uint64, configLen uint64) (id uint64) {
+	defer recoverConfigPanic(&id)
+	name := utils.BytesToString(namePtr, nameLen)
 	buf := utils.BytesToSlice(configPtr, configLen)
 	var any anypb.Any
-	proto.Unmarshal(buf, &any)
-
-	configNum := atomic.AddUint64(&configNumGenerator, 1)
-	if httpFilterConfigParser != nil {
-		configCache.Store(configNum, httpFilterConfigParser.Parse(&any))
-	} else {
-		configCache.Store(configNum, &any)
+	if err := proto.Unmarshal(buf, &any); err != nil {
+		Logf(api.Error, "invalid plugin config of %s: %v", name, err)
+		return 0
 	}
 
-	return configNum
+	plugin := getHttpFilterPlugin(name)
+	if any.GetTypeUrl() == chainTypeURL {
+		chain, err := parseChain(&any)
+		if err != nil {
+			Logf(api.Error, "invalid chain config: %v", err)
+			return 0
+		}
+		return storePluginConfig(&pluginConfig{plugin: chainPlugin, config: chain})
+	}
+	if plugin.parser != nil {
+		return storePluginConfig(&pluginConfig{plugin: plugin, config: plugin.parser.Parse(&any)})
+	}
+	return storePluginConfig(&pluginConfig{plugin: plugin, config: &any})
 }
 
 //export moeDestroyHttpPluginConfig
@@ -67,25 +100,34 @@ func moeDestroyHttpPluginConfig(id uint64) {
 	configCache.Delete(id)
 }
 
+// loadPluginConfig returns nil when the config id is unknown, i.e. it's destroyed already.
+func loadPluginConfig(id uint64) *pluginConfig {
+	v, ok := configCache.Load(id)
+	if !ok {
+		return nil
+	}
+	config, _ := v.(*pluginConfig)
+	return config
+}
+
 //export moeMergeHttpPluginConfig
-func moeMergeHttpPluginConfig(parentId uint64, childId uint64) uint64 {
-	if httpFilterConfigParser != nil {
-		parent, ok := configCache.Load(parentId)
-		if !ok {
-			// TODO: throw error
-		}
-		child, ok := configCache.Load(childId)
-		if !ok {
-			// TODO: throw error
-		}
+func moeMergeHttpPluginConfig(parentId uint64, childId uint64) (id uint64) {
+	defer recoverConfigPanic(&id)
+	parent, child := loadPluginConfig(parentId), loadPluginConfig(childId)
+	if parent == nil || child == nil {
+		// 0 is the invalid config in Envoy.
+		Logf(api.Error, "merge unknown plugin configs: %d + %d", parentId, childId)
+		return 0
+	}
 
-		new := httpFilterConfigParser.Merge(parent, child)
-		configNum := atomic.AddUint64(&configNumGenerator, 1)
-		configCache.Store(configNum, new)
-		return configNum
+	// NP: the parent and child are the configs of the same plugin.
+	if parser := parent.plugin.parser; parser != nil {
+		new := parser.Merge(parent.config, child.config)
+		return storePluginConfig(&pluginConfig{plugin: parent.plugin, config: new})
 
 	} else {
-		// child override parent by default
-		return childId
+		// child override parent by default.
+		// NP: store it as a new config, since every config id is destroyed separately.
+		return storePluginConfig(&pluginConfig{plugin: child.plugin, config: child.config})
 	}
 }
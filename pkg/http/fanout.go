@@ -0,0 +1,223 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package http
+
+import (
+	"runtime/debug"
+	"sync"
+
+	"mosn.io/envoy-go-extension/pkg/api"
+)
+
+type localReply struct {
+	responseCode int
+	bodyText     string
+	headers      map[string]string
+	grpcStatus   int64
+	details      string
+}
+
+// fanOut joins the verdicts of the plugins that run the decode header phase concurrently.
+// The first verdict that does not continue decides the phase at once, without waiting for the
+// other plugins, and the phase continues when all the plugins continue.
+type fanOut struct {
+	chain     *chainFilter
+	header    api.RequestHeaderMap
+	mutex     sync.Mutex
+	pending   int
+	done      bool // the phase is decided, the later verdicts are ignored
+	snapshots []*headerSnapshot
+}
+
+func (o *fanOut) finish(index int, status api.StatusType, reply *localReply) {
+	// NP: the later status of the same plugin is ignored, i.e. the LocalReply status returned
+	// after SendLocalReply.
+	if !o.chain.chained[index].detach(o) {
+		return
+	}
+	o.mutex.Lock()
+	if o.done {
+		o.mutex.Unlock()
+		return
+	}
+	o.pending--
+	if status == api.Continue && o.pending > 0 {
+		o.mutex.Unlock()
+		return
+	}
+	o.done = true
+	o.mutex.Unlock()
+	o.chain.joinFanOut(o, status, reply)
+}
+
+func (f *chainFilter) fanOutDecodeHeaders(header api.RequestHeaderMap, endStream bool) api.StatusType {
+	// copy the headers once in the Envoy thread, so the plugins do not call into Envoy
+	// concurrently.
+	headers := make(map[string][]string)
+	header.Range(func(key, _ string) bool {
+		headers[key] = header.Values(key)
+		return true
+	})
+
+	o := &fanOut{
+		chain:     f,
+		header:    header,
+		pending:   len(f.filters),
+		snapshots: make([]*headerSnapshot, len(f.filters)),
+	}
+	// the callbacks of the plugins go to the fan out, until their own verdicts.
+	for _, c := range f.chained {
+		c.attach(o)
+	}
+	for i, filter := range f.filters {
+		snapshot := &headerSnapshot{headers: headers, byteSize: header.ByteSize()}
+		o.snapshots[i] = snapshot
+		go func(i int, filter api.HttpFilter) {
+			defer func() {
+				if e := recover(); e != nil {
+					Logf(api.Error, "got panic: %v, phase: fan out %v, stack: %s", e, api.DecodeHeaderPhase, debug.Stack())
+					o.finish(i, api.LocalReply, &localReply{responseCode: 500, bodyText: "error happened in Go filter\r\n"})
+				}
+			}()
+			if status := filter.DecodeHeaders(snapshot, endStream); status != api.Running {
+				o.finish(i, status, nil)
+			}
+		}(i, filter)
+	}
+	return api.Running
+}
+
+// joinFanOut continues the phase with the deciding verdict, in the goroutine of the plugin that
+// decides it.
+func (f *chainFilter) joinFanOut(o *fanOut, status api.StatusType, reply *localReply) {
+	defer f.callbacks.RecoverPanic()
+	if r := reply; r != nil {
+		f.callbacks.SendLocalReply(r.responseCode, r.bodyText, r.headers, r.grpcStatus, r.details)
+		return
+	}
+	if status != api.Continue {
+		f.callbacks.Continue(status)
+		return
+	}
+	// all the plugins have continued, their snapshots are not written anymore.
+	for _, snapshot := range o.snapshots {
+		for _, mutate := range snapshot.mutations {
+			mutate(o.header)
+		}
+	}
+	f.callbacks.Continue(api.Continue)
+}
+
+// headerSnapshot is the request header map of a plugin in the fan out phase, it reads the
+// headers copied before the fan out, and records the mutations to apply them after the join.
+type headerSnapshot struct {
+	headers   map[string][]string
+	copied    bool
+	byteSize  uint64
+	mutations []func(api.RequestHeaderMap)
+}
+
+var _ api.RequestHeaderMap = (*headerSnapshot)(nil)
+
+// copy on write, the headers are shared by the plugins.
+func (h *headerSnapshot) mutable() {
+	if h.copied {
+		return
+	}
+	headers := make(map[string][]string, len(h.headers))
+	for k, v := range h.headers {
+		headers[k] = v
+	}
+	h.headers = headers
+	h.copied = true
+}
+
+func (h *headerSnapshot) ByteSize() uint64 {
+	return h.byteSize
+}
+
+func (h *headerSnapshot) Range(f func(key, value string) bool) {
+	for k, values := range h.headers {
+		for _, v := range values {
+			if !f(k, v) {
+				return
+			}
+		}
+	}
+}
+
+func (h *headerSnapshot) Get(key string) (string, bool) {
+	value, ok := h.headers[key]
+	if !ok {
+		return "", false
+	}
+	return value[0], ok
+}
+
+func (h *headerSnapshot) Values(key string) []string {
+	return h.headers[key]
+}
+
+func (h *headerSnapshot) Set(key, value string) {
+	h.mutable()
+	h.headers[key] = []string{value}
+	h.mutations = append(h.mutations, func(header api.RequestHeaderMap) { header.Set(key, value) })
+}
+
+func (h *headerSnapshot) Add(key, value string) {
+	h.mutable()
+	// NP: do not append to the shared slice.
+	h.headers[key] = append(append([]string{}, h.headers[key]...), value)
+	h.mutations = append(h.mutations, func(header api.RequestHeaderMap) { header.Add(key, value) })
+}
+
+func (h *headerSnapshot) Del(key string) {
+	h.mutable()
+	delete(h.headers, key)
+	h.mutations = append(h.mutations, func(header api.RequestHeaderMap) { header.Del(key) })
+}
+
+func (h *headerSnapshot) GetRaw(key string) string {
+	v, _ := h.Get(key)
+	return v
+}
+
+func (h *headerSnapshot) Protocol() string {
+	v, _ := h.Get(":protocol")
+	return v
+}
+
+func (h *headerSnapshot) Scheme() string {
+	v, _ := h.Get(":scheme")
+	return v
+}
+
+func (h *headerSnapshot) Method() string {
+	v, _ := h.Get(":method")
+	return v
+}
+
+func (h *headerSnapshot) Host() string {
+	v, _ := h.Get(":authority")
+	return v
+}
+
+func (h *headerSnapshot) Path() string {
+	v, _ := h.Get(":path")
+	return v
+}
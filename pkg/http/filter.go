@@ -32,9 +32,10 @@ package http
 */
 import "C"
 import (
-	"fmt"
 	"runtime/debug"
 	"sync"
+	"time"
+	"unsafe"
 
 	"mosn.io/envoy-go-extension/pkg/api"
 )
@@ -45,13 +46,54 @@ type httpRequest struct {
 	paniced    bool
 	safePanic  bool
 
-	// lock the req_->strValue in the C side, which do not allow concurrency.
-	mutex sync.Mutex
-
 	// when Go try to read data from Go thread, not in the envoy worker thread,
-	// C will post a callback to Envoy worker thread,
-	// then, we use this sema to wait the callback from the Envoy worker thread.
-	sema sync.WaitGroup
+	// C will post a callback to Envoy worker thread, then, the getter waits the callback from the
+	// Envoy worker thread. Every getter has its own channel, keyed by the result buffer, which is
+	// passed back in the callback.
+	waitMutex sync.Mutex
+	waiters   map[unsafe.Pointer]chan struct{}
+
+	// the tags and spans of the async phase, flushed to Envoy when the phase continues, the ones
+	// of the sync phase are dropped when the phase returns.
+	spanMutex sync.Mutex
+	spanBatch []byte
+
+	// the time of calling into Go of the current phase.
+	phaseStart time.Time
+}
+
+// addWaiter registers the getter before calling into C, since the callback may arrive before C
+// returns.
+func (r *httpRequest) addWaiter(key unsafe.Pointer) chan struct{} {
+	wait := make(chan struct{})
+	r.waitMutex.Lock()
+	if r.waiters == nil {
+		r.waiters = make(map[unsafe.Pointer]chan struct{})
+	}
+	r.waiters[key] = wait
+	r.waitMutex.Unlock()
+	return wait
+}
+
+// wakeWaiter wakes the getter, it's a nop when the getter has been woken already.
+func (r *httpRequest) wakeWaiter(key unsafe.Pointer) {
+	r.waitMutex.Lock()
+	if wait, ok := r.waiters[key]; ok {
+		delete(r.waiters, key)
+		close(wait)
+	}
+	r.waitMutex.Unlock()
+}
+
+// wakeAllWaiters wakes the pending getters when the request is destroyed, since Envoy drops
+// their callbacks.
+func (r *httpRequest) wakeAllWaiters() {
+	r.waitMutex.Lock()
+	for _, wait := range r.waiters {
+		close(wait)
+	}
+	r.waiters = nil
+	r.waitMutex.Unlock()
 }
 
 func (r *httpRequest) Phase() string {
@@ -60,13 +102,15 @@ func (r *httpRequest) Phase() string {
 
 func (r *httpRequest) Continue(status api.StatusType) {
 	if status == api.LocalReply {
-		fmt.Printf("warning: LocalReply status is useless after sendLocalReply, ignoring")
+		Log(api.Warn, "LocalReply status is useless after sendLocalReply, ignoring")
 		return
 	}
+	r.flushSpans()
 	cAPI.HttpContinue(r, uint64(status))
 }
 
 func (r *httpRequest) SendLocalReply(responseCode int, bodyText string, headers map[string]string, grpcStatus int64, details string) {
+	r.flushSpans()
 	cAPI.HttpSendLocalReply(r, responseCode, bodyText, headers, grpcStatus, details)
 }
 
@@ -79,30 +123,122 @@ func (r *httpRequest) safeReplyPanic() {
 
 func (r *httpRequest) RecoverPanic() {
 	if e := recover(); e != nil {
-		// TODO: support register logger?
-		fmt.Printf("got panic: %v, phase: %v, stack: %s\n", e, r.Phase(), debug.Stack())
-		switch e {
-		case ErrRequestFinished, ErrFilterDestroyed:
-			// do nothing
-
-		case ErrNotInGo:
-			// we can not send local reply now, since not in go.
-			r.paniced = true
-
-		default:
-			// ErrInvalidPhase, or panic from other places, not from not-ok C return status.
-			// It's safe to try send a local reply with 500 status.
-			if r.safePanic {
-				// sendLocalReply(means safe mode) may only may get ErrRequestFinished, ErrFilterDestroyed or ErrNotInGo,
-				// won't get these panic errors
-				// TODO: race: two goroutines panics in the same time?
-				panic("impossible")
-			}
-			r.safeReplyPanic()
+		r.handlePanic(e)
+	}
+}
+
+// handlePanic handles the recovered panic, the callbacks that wrap the request recover the panic
+// themselves, since recover only works in the deferred function.
+func (r *httpRequest) handlePanic(e interface{}) {
+	// TODO: support register logger?
+	Logf(api.Error, "got panic: %v, phase: %v, stack: %s", e, r.Phase(), debug.Stack())
+	switch e {
+	case ErrRequestFinished, ErrFilterDestroyed:
+		// do nothing
+
+	case ErrNotInGo:
+		// we can not send local reply now, since not in go.
+		r.paniced = true
+
+	default:
+		// ErrInvalidPhase, or panic from other places, not from not-ok C return status.
+		// It's safe to try send a local reply with 500 status.
+		if r.safePanic {
+			// sendLocalReply(means safe mode) may only may get ErrRequestFinished, ErrFilterDestroyed or ErrNotInGo,
+			// won't get these panic errors
+			// TODO: race: two goroutines panics in the same time?
+			panic("impossible")
 		}
+		r.safeReplyPanic()
 	}
 }
 
+// AsyncStarted only reports the scheduling delay of the goroutine, the CPU time of the async
+// phase is unknown, since the goroutine may move across the Go threads, and block on I/O.
+func (r *httpRequest) AsyncStarted() {
+	// NP: it's read by C when Go continues, after this write in the same goroutine. it's relative
+	// to the phase start, since the monotonic clock of Go is not exposed.
+	r.req.goroutineDelay = C.longlong(time.Since(r.phaseStart))
+}
+
+func (r *httpRequest) CacheDecision(ttl time.Duration) {
+	cAPI.HttpCacheDecision(r, uint64(ttl.Milliseconds()))
+}
+
+// the span batch is length prefixed, in little endian, see SpanBatchReader in Envoy:
+//
+//	't', key, value
+//	's', name, start unix ns (8 bytes), end unix ns (8 bytes), number of tags (4 bytes),
+//	     key, value, ...
+//
+// the strings are a 4 bytes length followed by the bytes.
+func appendUint32(b []byte, v uint32) []byte {
+	return append(b, byte(v), byte(v>>8), byte(v>>16), byte(v>>24))
+}
+
+func appendUint64(b []byte, v uint64) []byte {
+	return appendUint32(appendUint32(b, uint32(v)), uint32(v>>32))
+}
+
+func appendString(b []byte, s string) []byte {
+	return append(appendUint32(b, uint32(len(s))), s...)
+}
+
+func (r *httpRequest) SetSpanTag(key, value string) {
+	r.spanMutex.Lock()
+	r.spanBatch = append(r.spanBatch, 't')
+	r.spanBatch = appendString(r.spanBatch, key)
+	r.spanBatch = appendString(r.spanBatch, value)
+	r.spanMutex.Unlock()
+}
+
+func (r *httpRequest) AddSpan(name string, start, end time.Time, tags map[string]string) {
+	r.spanMutex.Lock()
+	r.spanBatch = append(r.spanBatch, 's')
+	r.spanBatch = appendString(r.spanBatch, name)
+	r.spanBatch = appendUint64(r.spanBatch, uint64(start.UnixNano()))
+	r.spanBatch = appendUint64(r.spanBatch, uint64(end.UnixNano()))
+	r.spanBatch = appendUint32(r.spanBatch, uint32(len(tags)))
+	for k, v := range tags {
+		r.spanBatch = appendString(r.spanBatch, k)
+		r.spanBatch = appendString(r.spanBatch, v)
+	}
+	r.spanMutex.Unlock()
+}
+
+// dropSpans drops the batch of the sync phase, there is no span for it in Envoy.
+func (r *httpRequest) dropSpans(status api.StatusType) {
+	if status == api.Running {
+		return
+	}
+	r.spanMutex.Lock()
+	r.spanBatch = r.spanBatch[:0]
+	r.spanMutex.Unlock()
+}
+
+// flushSpans passes the batch to Envoy in one call, it's applied when the phase continues.
+func (r *httpRequest) flushSpans() {
+	r.spanMutex.Lock()
+	batch := r.spanBatch
+	r.spanBatch = nil
+	r.spanMutex.Unlock()
+	if len(batch) > 0 {
+		cAPI.HttpFlushSpans(r, batch)
+	}
+}
+
+func (r *httpRequest) Log(level api.LogType, message string) {
+	Log(level, message)
+}
+
+func (r *httpRequest) Logf(level api.LogType, format string, args ...interface{}) {
+	Logf(level, format, args...)
+}
+
+func (r *httpRequest) LogEnabled(level api.LogType) bool {
+	return LogEnabled(level)
+}
+
 func (r *httpRequest) StreamInfo() api.StreamInfo {
 	return &streamInfo{
 		request: r,
@@ -18,6 +18,8 @@
 package http
 
 import (
+	"fmt"
+
 	"mosn.io/envoy-go-extension/pkg/api"
 )
 
@@ -35,15 +37,65 @@ func RegisterHttpFilterConfigParser(parser api.HttpFilterConfigParser) {
 	httpFilterConfigParser = parser
 }
 
-func getOrCreateHttpFilterFactory(configId uint64) api.HttpFilterFactory {
-	config, ok := configCache.Load(configId)
+type httpFilterPlugin struct {
+	factory api.HttpFilterConfigFactory
+	parser  api.HttpFilterConfigParser
+}
+
+// plugin name -> *httpFilterPlugin, they're registered in init, so no lock is needed.
+var httpFilterPlugins = map[string]*httpFilterPlugin{}
+
+func getOrCreateHttpFilterPlugin(name string) *httpFilterPlugin {
+	p, ok := httpFilterPlugins[name]
 	if !ok {
-		// TODO: panic
+		p = &httpFilterPlugin{}
+		httpFilterPlugins[name] = p
 	}
-	return httpFilterConfigFactory(config)
+	return p
+}
+
+// RegisterHttpFilterConfigFactoryByName registers the factory of the plugin_name in the golang
+// filter config, so that one library could host many plugins, the plugins that are not
+// registered by name use the default one, @see RegisterHttpFilterConfigFactory.
+func RegisterHttpFilterConfigFactoryByName(name string, f api.HttpFilterConfigFactory) {
+	getOrCreateHttpFilterPlugin(name).factory = f
+}
+
+// RegisterHttpFilterConfigParserByName registers the config parser of the plugin_name.
+func RegisterHttpFilterConfigParserByName(name string, parser api.HttpFilterConfigParser) {
+	getOrCreateHttpFilterPlugin(name).parser = parser
+}
+
+// getHttpFilterPlugin returns the plugin registered by name, or the default one.
+func getHttpFilterPlugin(name string) httpFilterPlugin {
+	p, ok := httpFilterPlugins[name]
+	if !ok {
+		return httpFilterPlugin{factory: httpFilterConfigFactory, parser: httpFilterConfigParser}
+	}
+	plugin := *p
+	if plugin.factory == nil {
+		plugin.factory = httpFilterConfigFactory
+	}
+	return plugin
+}
+
+func getOrCreateHttpFilterFactory(configId uint64) (api.HttpFilterFactory, error) {
+	config := loadPluginConfig(configId)
+	if config == nil {
+		return nil, fmt.Errorf("unknown plugin config: %d", configId)
+	}
+	return config.plugin.factory(config.config), nil
 }
 
 // streaming and async supported by default
 func RegisterStreamingHttpFilterConfigFactory(f api.HttpFilterConfigFactory) {
 	httpFilterConfigFactory = f
 }
+
+var warmupHooks []func()
+
+// RegisterWarmupHook registers a hook that runs before Envoy accepts traffic, after the plugin
+// configs are parsed, i.e. to fill the caches or to drive the hot code paths.
+func RegisterWarmupHook(f func()) {
+	warmupHooks = append(warmupHooks, f)
+}
@@ -0,0 +1,124 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package http
+
+/*
+#include "api.h"
+*/
+import "C"
+
+import (
+	"fmt"
+	"sync"
+	"sync/atomic"
+	"time"
+	"unsafe"
+
+	"mosn.io/envoy-go-extension/pkg/api"
+)
+
+// the log records are queued in a bounded channel, and a goroutine passes them to the logger of
+// Envoy in batches, so logging does not block the caller, nor call into Envoy per record.
+// The records are dropped when the channel is full, they're counted in golang._runtime.log.dropped.
+// NP: Go filters the records by a copy of the Envoy log level, the same goroutine refreshes it once
+// per second, between the synchronous moeLogBatch calls, so after the level is lowered by the admin
+// /logging, the records below the old level are still dropped in Go for up to one second, or longer
+// while the goroutine is busy with the batches. They're not counted in the drop counter.
+
+const (
+	logQueueSize = 4096
+	logBatchSize = 256
+	// the level of the Envoy logger may be changed by the admin interface.
+	logLevelRefreshInterval = time.Second
+)
+
+type logRecord struct {
+	level   api.LogType
+	message string
+}
+
+var logger struct {
+	once    sync.Once
+	level   int32
+	records chan logRecord
+	dropped api.CounterMetric
+}
+
+func startLogger() {
+	logger.once.Do(func() {
+		logger.level = int32(C.moeLogLevel())
+		logger.records = make(chan logRecord, logQueueSize)
+		logger.dropped = defineCounterMetric(runtimeMetricPlugin, "log.dropped")
+		go drainLogs()
+	})
+}
+
+// LogEnabled tells whether the records of the level are logged by Envoy.
+func LogEnabled(level api.LogType) bool {
+	startLogger()
+	return int32(level) >= atomic.LoadInt32(&logger.level)
+}
+
+// Log queues the record to the logger of Envoy, it never blocks.
+func Log(level api.LogType, message string) {
+	if !LogEnabled(level) {
+		return
+	}
+	select {
+	case logger.records <- logRecord{level: level, message: message}:
+	default:
+		logger.dropped.Increment(1)
+	}
+}
+
+// Logf formats the record only when the level is enabled.
+func Logf(level api.LogType, format string, args ...interface{}) {
+	if !LogEnabled(level) {
+		return
+	}
+	Log(level, fmt.Sprintf(format, args...))
+}
+
+func drainLogs() {
+	ticker := time.NewTicker(logLevelRefreshInterval)
+	levels := make([]uint8, 0, logBatchSize)
+	messages := make([]string, 0, logBatchSize)
+	for {
+		select {
+		case r := <-logger.records:
+			levels, messages = append(levels, uint8(r.level)), append(messages, r.message)
+			// the queued records go in the same batch.
+		batch:
+			for len(messages) < logBatchSize {
+				select {
+				case r := <-logger.records:
+					levels, messages = append(levels, uint8(r.level)), append(messages, r.message)
+				default:
+					break batch
+				}
+			}
+			C.moeLogBatch(unsafe.Pointer(&levels), unsafe.Pointer(&messages))
+			for i := range messages {
+				messages[i] = ""
+			}
+			levels, messages = levels[:0], messages[:0]
+		case <-ticker.C:
+			atomic.StoreInt32(&logger.level, int32(C.moeLogLevel()))
+		}
+	}
+}
@@ -0,0 +1,185 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package http
+
+/*
+#include "api.h"
+*/
+import "C"
+
+import (
+	"fmt"
+	"strings"
+	"sync"
+	"sync/atomic"
+	"time"
+	"unsafe"
+
+	"mosn.io/envoy-go-extension/pkg/api"
+)
+
+// the same values as the MetricType in C.
+const (
+	metricCounter   = 0
+	metricGauge     = 1
+	metricHistogram = 2
+)
+
+const (
+	// the plugin names starting with the prefix are reserved, the metrics of the Go extension
+	// itself are defined under them, so they never collide with the ones of the plugins.
+	reservedMetricPrefix = "_"
+	runtimeMetricPlugin  = reservedMetricPrefix + "runtime"
+)
+
+const (
+	histogramBatchSize     = 64
+	histogramFlushInterval = time.Second
+)
+
+func checkMetricPlugin(plugin string) {
+	if strings.HasPrefix(plugin, reservedMetricPrefix) {
+		panic(fmt.Sprintf("metric plugin name %s is reserved, it starts with %s", plugin, reservedMetricPrefix))
+	}
+}
+
+// defineMetric returns the slot of the metric "golang.<plugin>.<name>" in Envoy, and the address
+// of its value, it's shared memory that Go updates atomically.
+// The same name gets the same slot, i.e. when the config is parsed again.
+func defineMetric(metricType int, plugin, name string) (unsafe.Pointer, *uint64) {
+	var value unsafe.Pointer
+	slot := C.moeDefineMetric(C.int(metricType), unsafe.Pointer(&plugin), unsafe.Pointer(&name), unsafe.Pointer(&value))
+	if slot == nil {
+		panic(fmt.Sprintf("metric golang.%s.%s is defined with another type", plugin, name))
+	}
+	return slot, (*uint64)(value)
+}
+
+// DefineCounterMetric defines the counter of the plugin, it's usually invoked in the config
+// parser, or in init.
+func DefineCounterMetric(plugin, name string) api.CounterMetric {
+	checkMetricPlugin(plugin)
+	return defineCounterMetric(plugin, name)
+}
+
+func defineCounterMetric(plugin, name string) api.CounterMetric {
+	_, value := defineMetric(metricCounter, plugin, name)
+	return &counterMetric{value: value}
+}
+
+func DefineGaugeMetric(plugin, name string) api.GaugeMetric {
+	checkMetricPlugin(plugin)
+	_, value := defineMetric(metricGauge, plugin, name)
+	return &gaugeMetric{value: value}
+}
+
+func DefineHistogramMetric(plugin, name string) api.HistogramMetric {
+	checkMetricPlugin(plugin)
+	slot, _ := defineMetric(metricHistogram, plugin, name)
+	histograms.Lock()
+	defer histograms.Unlock()
+	// share the batch with the one defined before.
+	for _, h := range histograms.metrics {
+		if h.slot == slot {
+			return h
+		}
+	}
+	h := &histogramMetric{slot: slot}
+	histograms.metrics = append(histograms.metrics, h)
+	if histograms.ticker == nil {
+		histograms.ticker = time.NewTicker(histogramFlushInterval)
+		go flushHistograms(histograms.ticker)
+	}
+	return h
+}
+
+type counterMetric struct {
+	value *uint64
+}
+
+func (m *counterMetric) Increment(offset int64) {
+	// a negative offset would wrap the total, then Envoy adds a huge delta in the next flush.
+	if offset < 0 {
+		panic(fmt.Sprintf("counter metric can not be incremented by a negative offset %d", offset))
+	}
+	atomic.AddUint64(m.value, uint64(offset))
+}
+
+func (m *counterMetric) Get() uint64 {
+	return atomic.LoadUint64(m.value)
+}
+
+type gaugeMetric struct {
+	value *uint64
+}
+
+func (m *gaugeMetric) Increment(offset int64) {
+	atomic.AddUint64(m.value, uint64(offset))
+}
+
+func (m *gaugeMetric) Set(value int64) {
+	atomic.StoreUint64(m.value, uint64(value))
+}
+
+func (m *gaugeMetric) Get() int64 {
+	return int64(atomic.LoadUint64(m.value))
+}
+
+type histogramMetric struct {
+	slot   unsafe.Pointer
+	mutex  sync.Mutex
+	values []uint64
+}
+
+func (m *histogramMetric) Record(value uint64) {
+	m.mutex.Lock()
+	m.values = append(m.values, value)
+	if len(m.values) >= histogramBatchSize {
+		m.flushLocked()
+	}
+	m.mutex.Unlock()
+}
+
+func (m *histogramMetric) flushLocked() {
+	if len(m.values) == 0 {
+		return
+	}
+	// NP: Envoy copies the values, so the buffer is reused.
+	C.moeRecordHistogram(m.slot, unsafe.Pointer(&m.values))
+	m.values = m.values[:0]
+}
+
+var histograms struct {
+	sync.Mutex
+	metrics []*histogramMetric
+	ticker  *time.Ticker
+}
+
+// flushHistograms passes the values of the histograms that are not enough for a batch.
+func flushHistograms(ticker *time.Ticker) {
+	for range ticker.C {
+		histograms.Lock()
+		metrics := histograms.metrics
+		histograms.Unlock()
+		for _, m := range metrics {
+			m.mutex.Lock()
+			m.flushLocked()
+			m.mutex.Unlock()
+		}
+	}
+}
@@ -33,9 +33,13 @@ package http
 import "C"
 
 import (
+	"encoding/json"
 	"errors"
 	"runtime"
+	"runtime/debug"
 	"sync"
+	"time"
+	"unsafe"
 
 	"mosn.io/envoy-go-extension/pkg/api"
 )
@@ -87,14 +91,29 @@ func createRequest(r *C.httpRequest) *httpRequest {
 	// TODO: error
 	_ = Requests.StoreReq(r, req)
 
-	configId := uint64(r.configId)
-	filterFactory := getOrCreateHttpFilterFactory(configId)
-	f := filterFactory(req)
-	req.httpFilter = f
-
+	req.httpFilter = newHttpFilter(req, uint64(r.configId))
 	return req
 }
 
+// newHttpFilter creates the filter of the plugin config. It's called before the panics are
+// recovered by the request, so a failure is turned into a pass through filter here, and the
+// request is replied with 500 by the panic path, instead of panicking in the cgo export.
+func newHttpFilter(req *httpRequest, configId uint64) (f api.HttpFilter) {
+	defer func() {
+		if e := recover(); e != nil {
+			Logf(api.Error, "failed to create the filter of plugin config %d: %v, stack: %s",
+				configId, e, debug.Stack())
+			req.paniced = true
+			f = &passThroughFilter{callbacks: req}
+		}
+	}()
+	filterFactory, err := getOrCreateHttpFilterFactory(configId)
+	if err != nil {
+		panic(err)
+	}
+	return filterFactory(req)
+}
+
 func getRequest(r *C.httpRequest) *httpRequest {
 	return Requests.GetReq(r)
 }
@@ -119,6 +138,7 @@ func moeOnHttpHeader(r *C.httpRequest, endStream, headerNum, headerBytes uint64)
 		return uint64(api.Continue)
 	}
 	defer req.RecoverPanic()
+	req.phaseStart = time.Now()
 	f := req.httpFilter
 
 	var status api.StatusType
@@ -160,6 +180,7 @@ func moeOnHttpHeader(r *C.httpRequest, endStream, headerNum, headerBytes uint64)
 		}
 		status = f.EncodeTrailers(header)
 	}
+	req.dropSpans(status)
 	return uint64(status)
 }
 
@@ -173,6 +194,7 @@ func moeOnHttpData(r *C.httpRequest, endStream, buffer, length uint64) uint64 {
 		return uint64(api.Continue)
 	}
 	defer req.RecoverPanic()
+	req.phaseStart = time.Now()
 
 	f := req.httpFilter
 	isDecode := api.EnvoyRequestPhase(r.phase) == api.DecodeDataPhase
@@ -189,6 +211,7 @@ func moeOnHttpData(r *C.httpRequest, endStream, buffer, length uint64) uint64 {
 	} else {
 		status = f.EncodeData(buf, endStream == 1)
 	}
+	req.dropSpans(status)
 	return uint64(status)
 }
 
@@ -200,10 +223,8 @@ func moeOnHttpDestroy(r *C.httpRequest, reason uint64) {
 	}
 	defer req.RecoverPanic()
 
-	// should wakeup the waiting goroutine when request destroyed earlier.
-	if r.waitSema == 1 {
-		req.sema.Done()
-	}
+	// should wakeup the waiting goroutines when request destroyed earlier.
+	req.wakeAllWaiters()
 
 	v := api.DestroyReason(reason)
 
@@ -220,8 +241,91 @@ func moeOnHttpDestroy(r *C.httpRequest, reason uint64) {
 }
 
 //export moeOnHttpSemaCallback
-func moeOnHttpSemaCallback(r *C.httpRequest) {
+func moeOnHttpSemaCallback(r *C.httpRequest, waiter unsafe.Pointer) {
 	req := getRequest(r)
 	defer req.RecoverPanic()
-	req.sema.Done()
+	req.wakeWaiter(waiter)
+}
+
+//export moeOnWarmup
+func moeOnWarmup() (ret uint64) {
+	defer func() {
+		if e := recover(); e != nil {
+			ret = 1
+		}
+	}()
+	for _, hook := range warmupHooks {
+		hook()
+	}
+	return 0
+}
+
+// moeSetRuntimeConfig tunes the Go runtime, it's called right after the library is loaded.
+// NP: the init functions of the plugins have run already, they're covered by the GOGC,
+// GOMEMLIMIT and GOMAXPROCS environment variables only.
+// maxProcs <= 0 keeps the current GOMAXPROCS, gcPercent is applied only when setGCPercent is 1,
+// memoryLimit <= 0 keeps the current memory limit.
+//
+//export moeSetRuntimeConfig
+func moeSetRuntimeConfig(maxProcs int64, setGCPercent uint64, gcPercent int64, memoryLimit int64) {
+	if maxProcs > 0 {
+		runtime.GOMAXPROCS(int(maxProcs))
+	}
+	if setGCPercent == 1 {
+		debug.SetGCPercent(int(gcPercent))
+	}
+	if memoryLimit > 0 {
+		debug.SetMemoryLimit(memoryLimit)
+	}
+}
+
+type runtimeStats struct {
+	HeapInUse   uint64 `json:"heap_inuse_bytes"`
+	HeapObjects uint64 `json:"heap_objects"`
+	NumGC       uint32 `json:"num_gc"`
+	// min, 25%, 50%, 75% and max of the recent GC pauses.
+	GCPauseQuantiles []int64 `json:"gc_pause_quantiles_us"`
+	Goroutines       int     `json:"goroutines"`
+	MaxProcs         int     `json:"gomaxprocs"`
+	PluginConfigs    int     `json:"plugin_configs"`
+	Requests         int     `json:"requests"`
+}
+
+func syncMapLen(m *sync.Map) int {
+	n := 0
+	m.Range(func(_, _ interface{}) bool {
+		n++
+		return true
+	})
+	return n
+}
+
+// moeGetRuntimeStats returns the Go runtime stats in JSON, for the admin interface of Envoy.
+// NP: the buffer is malloc'd by C.CString, it's freed by Envoy.
+//
+//export moeGetRuntimeStats
+func moeGetRuntimeStats() *C.char {
+	var mem runtime.MemStats
+	runtime.ReadMemStats(&mem)
+	gc := debug.GCStats{PauseQuantiles: make([]time.Duration, 5)}
+	debug.ReadGCStats(&gc)
+
+	stats := runtimeStats{
+		HeapInUse:        mem.HeapInuse,
+		HeapObjects:      mem.HeapObjects,
+		NumGC:            mem.NumGC,
+		GCPauseQuantiles: make([]int64, len(gc.PauseQuantiles)),
+		Goroutines:       runtime.NumGoroutine(),
+		MaxProcs:         runtime.GOMAXPROCS(0),
+		PluginConfigs:    syncMapLen(configCache),
+		Requests:         syncMapLen(&Requests.m),
+	}
+	for i, d := range gc.PauseQuantiles {
+		stats.GCPauseQuantiles[i] = d.Microseconds()
+	}
+	buf, err := json.Marshal(&stats)
+	if err != nil {
+		return nil
+	}
+	return C.CString(string(buf))
 }
@@ -0,0 +1,120 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package http
+
+/*
+#include <stdlib.h>
+*/
+import "C"
+
+import (
+	"bytes"
+	"runtime/pprof"
+	"sync"
+	"time"
+	"unsafe"
+)
+
+// the profiles are served by the admin interface of Envoy, since there is no HTTP server in the
+// Go runtime. The profile buffers are malloc'd by C.CBytes, and they're freed by Envoy.
+
+var cpuProfile struct {
+	sync.Mutex
+	running bool
+	buf     bytes.Buffer
+	timer   *time.Timer
+	// the last finished profile.
+	result []byte
+}
+
+func profileBytes(b []byte, length *uint64) unsafe.Pointer {
+	*length = uint64(len(b))
+	return C.CBytes(b)
+}
+
+// moeStartCPUProfile starts the CPU profile, it's stopped by moeStopCPUProfile, Envoy calls it
+// after the seconds of the admin request, the seconds here are the limit in case nobody stops it.
+// It returns 1 when a profile is running already.
+//
+//export moeStartCPUProfile
+func moeStartCPUProfile(seconds int64) uint64 {
+	p := &cpuProfile
+	p.Lock()
+	defer p.Unlock()
+	if p.running {
+		return 1
+	}
+	p.buf.Reset()
+	if err := pprof.StartCPUProfile(&p.buf); err != nil {
+		return 1
+	}
+	p.running = true
+	p.result = nil
+	p.timer = time.AfterFunc(time.Duration(seconds)*time.Second, stopCPUProfile)
+	return 0
+}
+
+func stopCPUProfile() {
+	p := &cpuProfile
+	p.Lock()
+	defer p.Unlock()
+	if !p.running {
+		return
+	}
+	p.timer.Stop()
+	pprof.StopCPUProfile()
+	p.running = false
+	p.result = append([]byte{}, p.buf.Bytes()...)
+	p.buf.Reset()
+}
+
+// moeStopCPUProfile stops the running CPU profile, and returns the last finished one, nil means
+// no profile.
+//
+//export moeStopCPUProfile
+func moeStopCPUProfile(length *uint64) unsafe.Pointer {
+	stopCPUProfile()
+	p := &cpuProfile
+	p.Lock()
+	defer p.Unlock()
+	if p.result == nil {
+		return nil
+	}
+	return profileBytes(p.result, length)
+}
+
+//export moeWriteHeapProfile
+func moeWriteHeapProfile(length *uint64) unsafe.Pointer {
+	var buf bytes.Buffer
+	if err := pprof.Lookup("heap").WriteTo(&buf, 0); err != nil {
+		return nil
+	}
+	return profileBytes(buf.Bytes(), length)
+}
+
+// moeWriteGoroutineProfile dumps the goroutines, debug is the same as the debug of the
+// goroutine profile in net/http/pprof, 0 means the protobuf format, 2 means the stacks in text.
+//
+//export moeWriteGoroutineProfile
+func moeWriteGoroutineProfile(debug int64, length *uint64) unsafe.Pointer {
+	var buf bytes.Buffer
+	if err := pprof.Lookup("goroutine").WriteTo(&buf, int(debug)); err != nil {
+		return nil
+	}
+	return profileBytes(buf.Bytes(), length)
+}
@@ -18,7 +18,6 @@
 package async
 
 import (
-	"fmt"
 	"time"
 
 	udpa "github.com/cncf/xds/go/udpa/type/v1"
@@ -37,14 +36,14 @@ func (f *httpFilter) DecodeHeaders(header api.RequestHeaderMap, endStream bool)
 	go func() {
 		sleep := f.config.AsMap()["sleep"]
 		if v, ok := sleep.(float64); ok {
-			fmt.Printf("decode headers, sleeping %v ms\n", v)
+			f.callbacks.Logf(api.Info, "decode headers, sleeping %v ms", v)
 			time.Sleep(time.Millisecond * time.Duration(v))
 		} else {
-			fmt.Printf("config sleep is not number, %T\n", sleep)
+			f.callbacks.Logf(api.Warn, "config sleep is not number, %T", sleep)
 		}
 		foo, _ := header.Get("foo")
-		fmt.Printf("request header Get foo: %s, endStream: %v\n", foo, endStream)
-		fmt.Printf("request header GetRaw foo: %s, endStream: %v\n", header.GetRaw("foo"), endStream)
+		f.callbacks.Logf(api.Info, "request header Get foo: %s, endStream: %v", foo, endStream)
+		f.callbacks.Logf(api.Info, "request header GetRaw foo: %s, endStream: %v", header.GetRaw("foo"), endStream)
 		// f.callbacks.SendLocalReply(403, "forbidden from go", map[string]string{}, -1, "test-from-go")
 		f.callbacks.Continue(api.Continue)
 	}()
@@ -55,12 +54,12 @@ func (f *httpFilter) DecodeData(buffer api.BufferInstance, endStream bool) api.S
 	go func() {
 		sleep := f.config.AsMap()["sleep"]
 		if v, ok := sleep.(float64); ok {
-			fmt.Printf("decode data, sleeping %v ms\n", v)
+			f.callbacks.Logf(api.Info, "decode data, sleeping %v ms", v)
 			time.Sleep(time.Millisecond * time.Duration(v))
 		} else {
-			fmt.Printf("config sleep is not number, %T\n", sleep)
+			f.callbacks.Logf(api.Warn, "config sleep is not number, %T", sleep)
 		}
-		fmt.Printf("request data, length: %d, endStream: %v\n", buffer.Len(), endStream)
+		f.callbacks.Logf(api.Info, "request data, length: %d, endStream: %v", buffer.Len(), endStream)
 		// fmt.Printf("request data: %s\n", buffer.Get())
 		f.callbacks.Continue(api.Continue)
 	}()
@@ -71,7 +70,7 @@ func (f *httpFilter) DecodeTrailers(trailers api.RequestTrailerMap) api.StatusTy
 	go func() {
 		time.Sleep(time.Millisecond * 10)
 		foo, _ := trailers.Get("foo")
-		fmt.Printf("get request trailers, foo: %v\n", foo)
+		f.callbacks.Logf(api.Info, "get request trailers, foo: %v", foo)
 		f.callbacks.Continue(api.Continue)
 	}()
 	return api.Running
@@ -81,14 +80,14 @@ func (f *httpFilter) EncodeHeaders(header api.ResponseHeaderMap, endStream bool)
 	go func() {
 		sleep := f.config.AsMap()["sleep"]
 		if v, ok := sleep.(float64); ok {
-			fmt.Printf("encode headers, sleeping %v ms\n", v)
+			f.callbacks.Logf(api.Info, "encode headers, sleeping %v ms", v)
 			time.Sleep(time.Millisecond * time.Duration(v))
 		} else {
-			fmt.Printf("config sleep is not number, %T\n", sleep)
+			f.callbacks.Logf(api.Warn, "config sleep is not number, %T", sleep)
 		}
 		date, _ := header.Get("date")
-		fmt.Printf("response header Get date: %s, endStream: %v\n", date, endStream)
-		fmt.Printf("response header GetRaw date: %s, endStream: %v\n", header.GetRaw("date"), endStream)
+		f.callbacks.Logf(api.Info, "response header Get date: %s, endStream: %v", date, endStream)
+		f.callbacks.Logf(api.Info, "response header GetRaw date: %s, endStream: %v", header.GetRaw("date"), endStream)
 
 		header.Set("Foo", "Bar")
 		if !endStream {
@@ -104,12 +103,12 @@ func (f *httpFilter) EncodeData(buffer api.BufferInstance, endStream bool) api.S
 	go func() {
 		sleep := f.config.AsMap()["sleep"]
 		if v, ok := sleep.(float64); ok {
-			fmt.Printf("encode data, sleeping %v ms\n", v)
+			f.callbacks.Logf(api.Info, "encode data, sleeping %v ms", v)
 			time.Sleep(time.Millisecond * time.Duration(v))
 		} else {
-			fmt.Printf("config sleep is not number, %T\n", sleep)
+			f.callbacks.Logf(api.Warn, "config sleep is not number, %T", sleep)
 		}
-		fmt.Printf("response data, length: %d, endStream: %v, data: %s\n", buffer.Len(), endStream, string(buffer.Bytes()))
+		f.callbacks.Logf(api.Info, "response data, length: %d, endStream: %v, data: %s", buffer.Len(), endStream, string(buffer.Bytes()))
 		// buffer.Set("foo=bar")
 		f.callbacks.Continue(api.Continue)
 	}()
@@ -120,14 +119,14 @@ func (f *httpFilter) EncodeTrailers(trailers api.ResponseTrailerMap) api.StatusT
 	go func() {
 		time.Sleep(time.Millisecond * 10)
 		atEnd1, _ := trailers.Get("AtEnd1")
-		fmt.Printf("get response trailers, AtEnd1: %v\n", atEnd1)
+		f.callbacks.Logf(api.Info, "get response trailers, AtEnd1: %v", atEnd1)
 		f.callbacks.Continue(api.Continue)
 	}()
 	return api.Running
 }
 
 func (f *httpFilter) OnDestroy(reason api.DestroyReason) {
-	fmt.Printf("OnDestory, reason: %d\n", reason)
+	f.callbacks.Logf(api.Info, "OnDestory, reason: %d", reason)
 }
 
 func ConfigFactory(config interface{}) api.HttpFilterFactory {
@@ -1,26 +1,250 @@
 #include "src/envoy/bootstrap/dso/config.h"
 
+#include <algorithm>
+#include <limits>
+
 #include "envoy/registry/registry.h"
 #include "envoy/server/factory_context.h"
+#include "envoy/singleton/manager.h"
 
 #include "source/common/common/empty_string.h"
 #include "source/common/config/datasource.h"
+#include "source/common/http/headers.h"
+#include "source/common/http/utility.h"
 #include "source/common/protobuf/utility.h"
 
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+
 namespace Envoy {
 namespace Extensions {
 namespace Bootstrap {
 namespace Dso {
 
+SINGLETON_MANAGER_REGISTRATION(golang_admin_handlers);
+
 void DsoExtension::onServerInitialized() {
-  handler_ = context_.lifecycleNotifier().registerCallback(
-      Server::ServerLifecycleNotifier::Stage::PostInit,
-      [so_id = config_.so_id(), so_path = config_.so_path()] {
-        Envoy::Dso::DsoInstanceManager::pub(so_id, so_path);
-        ENVOY_LOG(warn, "DsoExtension::postworker: {} {}", so_id, so_path);
+  // load the dso and warm it up before the listeners accept traffic, the server initialization
+  // waits for the init target.
+  init_target_ = std::make_unique<Init::TargetImpl>(absl::StrCat("dso ", config_.so_id()), [this]() {
+    const auto& so_id = config_.so_id();
+    const auto& so_path = config_.so_path();
+    if (Envoy::Dso::DsoInstanceManager::pub(so_id, so_path, runtimeConfig())) {
+      auto dso = Envoy::Dso::DsoInstanceManager::getDsoInstanceByID(so_id);
+      if (!dso->moeOnWarmup()) {
+        ENVOY_LOG(error, "DsoExtension warmup failed: {} {}", so_id, so_path);
+      }
+    }
+    ENVOY_LOG(info, "DsoExtension ready: {} {}", so_id, so_path);
+    init_target_->ready();
+  });
+  context_.initManager().add(*init_target_);
+
+  admin_handlers_ = AdminHandlers::singleton(context_);
+}
+
+AdminHandlers::AdminHandlers(Server::Admin& admin, Event::Dispatcher& main_thread_dispatcher)
+    : admin_(admin), main_thread_dispatcher_(main_thread_dispatcher) {
+  addHandler("/golang",
+             "print the Go dso instances and their Go runtime stats, and the Go runtimes leaked "
+             "by the reloads",
+             handlerGolang, false);
+  addHandler("/golang/pprof/profile",
+             "start the Go CPU profile of the so_id dso for the seconds (default 30)",
+             [this](absl::string_view path_and_query, Http::ResponseHeaderMap& response_headers,
+                    Buffer::Instance& response, Server::AdminStream& admin_stream) {
+               return handlerCpuProfileStart(path_and_query, response_headers, response,
+                                             admin_stream);
+             },
+             true);
+  addHandler("/golang/pprof/profile/stop",
+             "stop the Go CPU profile of the so_id dso before the seconds, and print the last "
+             "profile",
+             [this](absl::string_view path_and_query, Http::ResponseHeaderMap& response_headers,
+                    Buffer::Instance& response, Server::AdminStream& admin_stream) {
+               return handlerCpuProfileStop(path_and_query, response_headers, response,
+                                            admin_stream);
+             },
+             true);
+  addHandler("/golang/pprof/heap", "print the Go heap profile of the so_id dso",
+             handlerHeapProfile, false);
+  addHandler("/golang/pprof/goroutine",
+             "print the goroutines of the so_id dso, debug=2 prints the stacks in text",
+             handlerGoroutineProfile, false);
+}
+
+AdminHandlersSharedPtr
+AdminHandlers::singleton(Server::Configuration::ServerFactoryContext& context) {
+  return context.singletonManager().getTyped<AdminHandlers>(
+      SINGLETON_MANAGER_REGISTERED_NAME(golang_admin_handlers),
+      [&context] {
+        return std::make_shared<AdminHandlers>(context.admin(), context.mainThreadDispatcher());
       });
 }
 
+void AdminHandlers::addHandler(const std::string& prefix, const std::string& help_text,
+                               Server::Admin::HandlerCb callback, bool mutates_server_state) {
+  // NP: it fails when the prefix is taken already, i.e. by another extension, or when the admin
+  // interface is not configured.
+  if (!admin_.addHandler(prefix, help_text, callback, false, mutates_server_state)) {
+    ENVOY_LOG(error, "failed to add the admin handler {}", prefix);
+  }
+}
+
+namespace {
+
+constexpr uint64_t DefaultCpuProfileSeconds = 30;
+// NP: the profile is kept in the memory, so it can not run too long.
+constexpr uint64_t MaxCpuProfileSeconds = 600;
+
+// the dso instance of the so_id param, nullptr means not found, and the response is set.
+Envoy::Dso::DsoInstanceSharedPtr profileDso(const Http::Utility::QueryParams& params,
+                                            Buffer::Instance& response, Http::Code& code) {
+  auto it = params.find("so_id");
+  if (it == params.end()) {
+    response.add("missing so_id\n");
+    code = Http::Code::BadRequest;
+    return nullptr;
+  }
+  auto dso = Envoy::Dso::DsoInstanceManager::getDsoInstanceByID(it->second);
+  if (dso == nullptr) {
+    response.add(absl::StrCat("dso not found: ", it->second, "\n"));
+    code = Http::Code::NotFound;
+    return nullptr;
+  }
+  if (!dso->supportProfile()) {
+    response.add(absl::StrCat("dso does not support profile: ", it->second, "\n"));
+    code = Http::Code::NotImplemented;
+    return nullptr;
+  }
+  return dso;
+}
+
+Http::Code writeProfile(const absl::optional<std::string>& profile,
+                        Http::ResponseHeaderMap& response_headers, Buffer::Instance& response,
+                        bool text = false) {
+  if (!profile.has_value()) {
+    response.add("no profile\n");
+    return Http::Code::NotFound;
+  }
+  if (!text) {
+    response_headers.setContentType("application/octet-stream");
+    response_headers.addCopy(Http::LowerCaseString("content-disposition"),
+                             "attachment; filename=\"profile\"");
+  }
+  response.add(profile.value());
+  return Http::Code::OK;
+}
+
+} // namespace
+
+Http::Code AdminHandlers::handlerGolang(absl::string_view,
+                                        Http::ResponseHeaderMap& response_headers,
+                                        Buffer::Instance& response, Server::AdminStream&) {
+  response_headers.setReferenceContentType(Http::Headers::get().ContentTypeValues.Json);
+  response.add(Envoy::Dso::DsoInstanceManager::show());
+  return Http::Code::OK;
+}
+
+Http::Code AdminHandlers::handlerCpuProfileStart(absl::string_view path_and_query,
+                                                 Http::ResponseHeaderMap&,
+                                                 Buffer::Instance& response, Server::AdminStream&) {
+  auto params = Http::Utility::parseAndDecodeQueryString(path_and_query);
+  auto code = Http::Code::OK;
+  auto dso = profileDso(params, response, code);
+  if (dso == nullptr) {
+    return code;
+  }
+
+  uint64_t seconds = DefaultCpuProfileSeconds;
+  auto it = params.find("seconds");
+  if (it != params.end() && (!absl::SimpleAtoi(it->second, &seconds) || seconds == 0 ||
+                             seconds > MaxCpuProfileSeconds)) {
+    response.add(absl::StrCat("invalid seconds, it should be in [1, ", MaxCpuProfileSeconds,
+                              "]\n"));
+    return Http::Code::BadRequest;
+  }
+  // NP: the admin handlers run in the main thread, so it does not wait for the profile, the timer
+  // stops it after the seconds, and the profile is fetched by /golang/pprof/profile/stop.
+  // Go stops it after MaxCpuProfileSeconds too, in case the timer is gone with the handlers.
+  if (!dso->moeStartCPUProfile(MaxCpuProfileSeconds)) {
+    response.add("the CPU profile is running already\n");
+    return Http::Code::Conflict;
+  }
+  std::weak_ptr<Envoy::Dso::DsoInstance> weak_dso = dso;
+  auto& timer = profile_timers_[dso.get()];
+  timer = main_thread_dispatcher_.createTimer([weak_dso]() {
+    // Go keeps the profile until the next one starts.
+    if (auto dso = weak_dso.lock()) {
+      dso->moeStopCPUProfile();
+    }
+  });
+  timer->enableTimer(std::chrono::seconds(seconds));
+  response.add(absl::StrCat("the CPU profile is started for ", seconds, " seconds\n"));
+  return Http::Code::Accepted;
+}
+
+Http::Code AdminHandlers::handlerCpuProfileStop(absl::string_view path_and_query,
+                                                Http::ResponseHeaderMap& response_headers,
+                                                Buffer::Instance& response, Server::AdminStream&) {
+  auto params = Http::Utility::parseAndDecodeQueryString(path_and_query);
+  auto code = Http::Code::OK;
+  auto dso = profileDso(params, response, code);
+  if (dso == nullptr) {
+    return code;
+  }
+  // stopped before the seconds.
+  profile_timers_.erase(dso.get());
+  return writeProfile(dso->moeStopCPUProfile(), response_headers, response);
+}
+
+Http::Code AdminHandlers::handlerHeapProfile(absl::string_view path_and_query,
+                                             Http::ResponseHeaderMap& response_headers,
+                                             Buffer::Instance& response, Server::AdminStream&) {
+  auto params = Http::Utility::parseAndDecodeQueryString(path_and_query);
+  auto code = Http::Code::OK;
+  auto dso = profileDso(params, response, code);
+  if (dso == nullptr) {
+    return code;
+  }
+  return writeProfile(dso->moeWriteHeapProfile(), response_headers, response);
+}
+
+Http::Code AdminHandlers::handlerGoroutineProfile(absl::string_view path_and_query,
+                                                  Http::ResponseHeaderMap& response_headers,
+                                                  Buffer::Instance& response,
+                                                  Server::AdminStream&) {
+  auto params = Http::Utility::parseAndDecodeQueryString(path_and_query);
+  auto code = Http::Code::OK;
+  auto dso = profileDso(params, response, code);
+  if (dso == nullptr) {
+    return code;
+  }
+
+  int64_t debug = 0;
+  auto it = params.find("debug");
+  if (it != params.end() && (!absl::SimpleAtoi(it->second, &debug) || debug < 0)) {
+    response.add("invalid debug\n");
+    return Http::Code::BadRequest;
+  }
+  return writeProfile(dso->moeWriteGoroutineProfile(debug), response_headers, response,
+                      debug > 0);
+}
+
+Envoy::Dso::RuntimeConfig DsoExtension::runtimeConfig() const {
+  Envoy::Dso::RuntimeConfig runtime_config;
+  runtime_config.max_procs = config_.match_concurrency() ? context_.options().concurrency()
+                                                         : config_.gomaxprocs();
+  if (config_.has_gogc()) {
+    runtime_config.has_gc_percent = true;
+    runtime_config.gc_percent = config_.gogc().value();
+  }
+  // NP: the Go memory limit is an int64, larger values mean no limit.
+  runtime_config.memory_limit =
+      std::min<uint64_t>(config_.gomemlimit(), std::numeric_limits<int64_t>::max());
+  return runtime_config;
+}
+
 Server::BootstrapExtensionPtr
 DsoFactory::createBootstrapExtension(const Protobuf::Message& config,
                                      Server::Configuration::ServerFactoryContext& context) {
@@ -3,13 +3,20 @@
 #include "envoy/common/pure.h"
 #include "api/dso/v3/dso.pb.h"
 #include "api/dso/v3/dso.pb.validate.h"
+#include "envoy/event/dispatcher.h"
+#include "envoy/event/timer.h"
+#include "envoy/server/admin.h"
 #include "envoy/server/bootstrap_extension_config.h"
 #include "envoy/server/filter_config.h"
 #include "envoy/server/instance.h"
+#include "envoy/singleton/instance.h"
 #include "src/envoy/common/dso/dso.h"
 
+#include "source/common/init/target_impl.h"
 #include "source/common/protobuf/protobuf.h"
 
+#include "absl/container/flat_hash_map.h"
+
 namespace Envoy {
 namespace Extensions {
 namespace Bootstrap {
@@ -27,6 +34,50 @@ public:
   }
 };
 
+/**
+ * The /golang admin handlers, they serve all of the dso instances, so they're added once, by the
+ * first dso extension, and shared by the others as a singleton.
+ */
+class AdminHandlers : public Singleton::Instance, Logger::Loggable<Logger::Id::misc> {
+public:
+  AdminHandlers(Server::Admin& admin, Event::Dispatcher& main_thread_dispatcher);
+
+  static std::shared_ptr<AdminHandlers>
+  singleton(Server::Configuration::ServerFactoryContext& context);
+
+private:
+  void addHandler(const std::string& prefix, const std::string& help_text,
+                  Server::Admin::HandlerCb callback, bool mutates_server_state);
+
+  // the /golang admin handler, it prints all of the dso instances.
+  static Http::Code handlerGolang(absl::string_view path_and_query,
+                                  Http::ResponseHeaderMap& response_headers,
+                                  Buffer::Instance& response, Server::AdminStream& admin_stream);
+  // the /golang/pprof/* admin handlers, the dso instance is chosen by the so_id param.
+  Http::Code handlerCpuProfileStart(absl::string_view path_and_query,
+                                    Http::ResponseHeaderMap& response_headers,
+                                    Buffer::Instance& response, Server::AdminStream& admin_stream);
+  Http::Code handlerCpuProfileStop(absl::string_view path_and_query,
+                                   Http::ResponseHeaderMap& response_headers,
+                                   Buffer::Instance& response, Server::AdminStream& admin_stream);
+  static Http::Code handlerHeapProfile(absl::string_view path_and_query,
+                                       Http::ResponseHeaderMap& response_headers,
+                                       Buffer::Instance& response,
+                                       Server::AdminStream& admin_stream);
+  static Http::Code handlerGoroutineProfile(absl::string_view path_and_query,
+                                            Http::ResponseHeaderMap& response_headers,
+                                            Buffer::Instance& response,
+                                            Server::AdminStream& admin_stream);
+
+  Server::Admin& admin_;
+  Event::Dispatcher& main_thread_dispatcher_;
+  // the timers that stop the running CPU profiles after the seconds, by the dso instance.
+  // NP: a timer does not pin the dso instance, it's replaced by the next profile of the instance.
+  absl::flat_hash_map<const Envoy::Dso::DsoInstance*, Event::TimerPtr> profile_timers_;
+};
+
+using AdminHandlersSharedPtr = std::shared_ptr<AdminHandlers>;
+
 // TODO using dso log instead of golang
 class DsoExtension : public Server::BootstrapExtension, Logger::Loggable<Logger::Id::misc> {
 public:
@@ -36,7 +87,10 @@ public:
   void onServerInitialized() override;
 
 private:
-  Server::ServerLifecycleNotifier::HandlePtr handler_{};
+  Envoy::Dso::RuntimeConfig runtimeConfig() const;
+
+  AdminHandlersSharedPtr admin_handlers_;
+  std::unique_ptr<Init::TargetImpl> init_target_;
   envoy::extensions::dso::v3::dso config_;
   Server::Configuration::ServerFactoryContext& context_;
 };
@@ -16,7 +16,14 @@ typedef struct {
   unsigned long long int configId;
   // TODO: combine these fields into a single int, for save memory
   int phase;
-  int waitSema; // :1
+  // number of getters waiting for the callback from the Envoy worker thread, it's only used in
+  // Envoy, Go wakes its own waiters.
+  int waitSema;
+  // the nanoseconds from calling into Go in the async phase to the goroutine started, written by
+  // Go before it continues, 0 means unknown.
+  long long int goroutineDelay;
+  // the stream id of the filter, for the probes.
+  unsigned long long int streamId;
 } httpRequest;
 
 typedef enum {
@@ -48,11 +55,22 @@ int moeHttpSetTrailer(void* r, void* key, void* value);
 
 int moeHttpGetStringValue(void* r, int id, void* value);
 
+int moeHttpCacheDecision(void* r, unsigned long long int ttl_ms);
+int moeHttpFlushSpans(void* r, void* batch);
+
 void moeHttpFinalize(void* r, int reason);
 
 int moeHttpGetDynamicMetadata(void* r, void* name, void* buf);
 int moeHttpSetDynamicMetadata(void* r, void* name, void* key, void* buf);
 
+// the metrics of the plugins, the address of the counter or gauge value is written to value.
+void* moeDefineMetric(int metric_type, void* plugin_name, void* metric_name, void* value);
+int moeRecordHistogram(void* slot, void* values);
+
+// the log records of Go, the level is checked in Go before the record is formatted.
+int moeLogLevel();
+void moeLogBatch(void* levels, void* messages);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -1,53 +1,157 @@
 #include "src/envoy/common/dso/dso.h"
 
+#include <algorithm>
+#include <cstdlib>
+
+#include "src/envoy/common/dso/probes.h"
+
+#include "source/common/protobuf/utility.h"
+
+#include "absl/time/time.h"
+
 namespace Envoy {
 namespace Dso {
 
-std::map<std::string, DsoInstance*> DsoInstanceManager::dso_map_ = {};
+std::mutex DsoInstanceManager::pub_mutex_ = {};
+std::set<std::string> DsoInstanceManager::runtimes_ = {};
+size_t DsoInstanceManager::max_runtimes_ = DsoInstanceManager::DefaultMaxRuntimes;
+std::map<std::string, DsoInstanceSharedPtr> DsoInstanceManager::dso_map_ = {};
 std::shared_mutex DsoInstanceManager::mutex_ = {};
+std::mutex DsoInstanceManager::pub_callbacks_mutex_ = {};
+Common::CallbackManager<const std::string&, const DsoInstanceSharedPtr&>
+    DsoInstanceManager::pub_callbacks_ = {};
 
-bool DsoInstanceManager::pub(std::string dsoId, std::string dsoName) {
-  if (getDsoInstanceByID(dsoId) != NULL) {
+bool DsoInstanceManager::pub(std::string dsoId, std::string dsoName,
+                             const RuntimeConfig& runtime_config) {
+  std::lock_guard<std::mutex> pub_lock(pub_mutex_);
+  // NP: the same path can not be loaded as a new version, since dlopen returns the same library.
+  auto current = getDsoInstanceByID(dsoId);
+  if (current != nullptr && current->name() == dsoName) {
     ENVOY_LOG_MISC(error, "pub {} {} dso instance failed: already pub.", dsoId, dsoName);
     return false;
   }
+  // the same path loaded before shares its runtime.
+  const bool new_runtime = runtimes_.count(dsoName) == 0;
+  if (new_runtime && runtimes_.size() >= max_runtimes_) {
+    ENVOY_LOG_MISC(error,
+                   "pub {} {} dso instance failed: {} Go runtimes are loaded already, the "
+                   "retired ones can not be unloaded.",
+                   dsoId, dsoName, runtimes_.size());
+    return false;
+  }
 
-  std::unique_lock<std::shared_mutex> w_lock(DsoInstanceManager::mutex_);
-
-  DsoInstance* dso = new DsoInstance(dsoName);
+  auto dso = std::make_shared<DsoInstance>(dsoName);
   if (!dso->loaded()) {
     return false;
   }
-  dso_map_[dsoId] = dso;
+  runtimes_.insert(dsoName);
+  if (!dso->moeSetRuntimeConfig(runtime_config)) {
+    ENVOY_LOG_MISC(warn, "{} {} dso instance does not support the runtime config.", dsoId, dsoName);
+  }
+
+  {
+    std::unique_lock<std::shared_mutex> w_lock(DsoInstanceManager::mutex_);
+    dso_map_[dsoId] = dso;
+  }
+  if (current != nullptr) {
+    ENVOY_LOG_MISC(warn,
+                   "reload {} dso instance from {} to {}, the Go runtime of the old one stays "
+                   "loaded, {} of {} Go runtimes are loaded.",
+                   dsoId, current->name(), dsoName, runtimes_.size(), max_runtimes_);
+  }
+
+  // run callbacks without the dso lock, since they may lookup the dso instance again.
+  std::lock_guard<std::mutex> lock(pub_callbacks_mutex_);
+  pub_callbacks_.runCallbacks(dsoId, dso);
   return true;
 }
 
+Common::CallbackHandlePtr DsoInstanceManager::addPubCallback(PubCallback cb) {
+  std::lock_guard<std::mutex> lock(pub_callbacks_mutex_);
+  return std::make_unique<LockedCallbackHandle>(pub_callbacks_mutex_, pub_callbacks_.add(cb));
+}
+
 bool DsoInstanceManager::unpub(std::string dsoId) {
-  // TODO need delete dso
+  // the instance is retired once the in-flight streams and configs release it.
   std::unique_lock<std::shared_mutex> w_lock(DsoInstanceManager::mutex_);
   ENVOY_LOG_MISC(warn, "unpub {} dso instance.", dsoId);
   return dso_map_.erase(dsoId) == 1;
 }
 
-DsoInstance* DsoInstanceManager::getDsoInstanceByID(std::string dsoId) {
+size_t DsoInstanceManager::runtimes() {
+  std::lock_guard<std::mutex> pub_lock(pub_mutex_);
+  return runtimes_.size();
+}
+
+void DsoInstanceManager::setMaxRuntimes(size_t max_runtimes) {
+  std::lock_guard<std::mutex> pub_lock(pub_mutex_);
+  max_runtimes_ = max_runtimes;
+}
+
+DsoInstanceSharedPtr DsoInstanceManager::getDsoInstanceByID(std::string dsoId) {
   std::shared_lock<std::shared_mutex> r_lock(DsoInstanceManager::mutex_);
   auto it = dso_map_.find(dsoId);
   if (it != dso_map_.end()) {
     return it->second;
   }
 
-  return NULL;
+  return nullptr;
 }
 
-// TODO implement
 std::string DsoInstanceManager::show() {
-  std::shared_lock<std::shared_mutex> r_lock(DsoInstanceManager::mutex_);
-  std::string ids = "";
-  for (auto it = dso_map_.begin(); it != dso_map_.end(); ++it) {
-    ids += it->first;
-    ids += ",";
+  std::map<std::string, DsoInstanceSharedPtr> dso_map;
+  {
+    // NP: reading the Go runtime stats may stop the world of Go, so it's not done with the lock.
+    std::shared_lock<std::shared_mutex> r_lock(DsoInstanceManager::mutex_);
+    dso_map = dso_map_;
+  }
+
+  std::vector<ProtobufWkt::Value> dsos;
+  for (const auto& [id, dso] : dso_map) {
+    ProtobufWkt::Struct obj;
+    auto& fields = *obj.mutable_fields();
+    fields["id"] = ValueUtil::stringValue(id);
+    fields["path"] = ValueUtil::stringValue(dso->name());
+    fields["load_time"] = ValueUtil::stringValue(absl::FormatTime(
+        absl::RFC3339_sec, absl::FromChrono(dso->loadTime()), absl::UTCTimeZone()));
+    std::vector<ProtobufWkt::Value> symbols;
+    for (const auto& symbol : dso->optionalSymbols()) {
+      symbols.push_back(ValueUtil::stringValue(symbol));
+    }
+    fields["optional_symbols"] = ValueUtil::listValue(symbols);
+    fields["streams"] = ValueUtil::numberValue(dso->streams());
+
+    auto stats = dso->moeGetRuntimeStats();
+    if (!stats.empty()) {
+      ProtobufWkt::Struct go_runtime;
+      try {
+        MessageUtil::loadFromJson(stats, go_runtime);
+        fields["go_runtime"] = ValueUtil::structValue(go_runtime);
+      } catch (const EnvoyException& e) {
+        ENVOY_LOG_MISC(error, "lib: {}, invalid Go runtime stats: {}", dso->name(), e.what());
+      }
+    }
+    dsos.push_back(ValueUtil::structValue(obj));
   }
-  return ids;
+
+  ProtobufWkt::Struct root;
+  auto& root_fields = *root.mutable_fields();
+  root_fields["dsos"] = ValueUtil::listValue(dsos);
+  {
+    // the runtimes of the retired versions are leaked, they're never unloaded.
+    std::lock_guard<std::mutex> pub_lock(pub_mutex_);
+    root_fields["loaded_runtimes"] = ValueUtil::numberValue(runtimes_.size());
+    root_fields["max_runtimes"] = ValueUtil::numberValue(max_runtimes_);
+    std::vector<ProtobufWkt::Value> retired;
+    for (const auto& path : runtimes_) {
+      if (std::none_of(dso_map.begin(), dso_map.end(),
+                       [&path](const auto& it) { return it.second->name() == path; })) {
+        retired.push_back(ValueUtil::stringValue(path));
+      }
+    }
+    root_fields["leaked_runtimes"] = ValueUtil::listValue(retired);
+  }
+  return MessageUtil::getJsonStringFromMessageOrDie(root, true);
 }
 
 DsoInstance::DsoInstance(const std::string dsoName) : dsoName_(dsoName) {
@@ -63,13 +167,23 @@ DsoInstance::DsoInstance(const std::string dsoName) : dsoName_(dsoName) {
 
   auto func = dlsym(handler_, "moeNewHttpPluginConfig");
   if (func) {
-    moeNewHttpPluginConfig_ = reinterpret_cast<GoUint64 (*)(GoUint64 p0, GoUint64 p1)>(func);
+    moeNewHttpPluginConfig_ =
+        reinterpret_cast<GoUint64 (*)(GoUint64 p0, GoUint64 p1, GoUint64 p2, GoUint64 p3)>(func);
   } else {
     loaded_ = false;
     ENVOY_LOG_MISC(error, "lib: {}, cannot find symbol: moeNewHttpPluginConfig, err: {}", dsoName,
                    dlerror());
   }
 
+  func = dlsym(handler_, "moeDestroyHttpPluginConfig");
+  if (func) {
+    moeDestroyHttpPluginConfig_ = reinterpret_cast<void (*)(GoUint64 p0)>(func);
+  } else {
+    loaded_ = false;
+    ENVOY_LOG_MISC(error, "lib: {}, cannot find symbol: moeDestroyHttpPluginConfig, err: {}",
+                   dsoName, dlerror());
+  }
+
   func = dlsym(handler_, "moeMergeHttpPluginConfig");
   if (func) {
     moeMergeHttpPluginConfig_ = reinterpret_cast<GoUint64 (*)(GoUint64 p0, GoUint64 p1)>(func);
@@ -103,7 +217,7 @@ DsoInstance::DsoInstance(const std::string dsoName) : dsoName_(dsoName) {
 
   func = dlsym(handler_, "moeOnHttpSemaCallback");
   if (func) {
-    moeOnHttpSemaCallback_ = reinterpret_cast<void (*)(httpRequest * p0)>(func);
+    moeOnHttpSemaCallback_ = reinterpret_cast<void (*)(httpRequest * p0, void* p1)>(func);
   } else {
     loaded_ = false;
     ENVOY_LOG_MISC(error, "lib: {}, cannot find symbol: moeOnHttpSemaCallback, err: {}", dsoName,
@@ -118,26 +232,115 @@ DsoInstance::DsoInstance(const std::string dsoName) : dsoName_(dsoName) {
     ENVOY_LOG_MISC(error, "lib: {}, cannot find symbol: moeOnHttpDecodeDestroy, err: {}", dsoName,
                    dlerror());
   }
+
+  // optional symbols, for the libraries built with the old version of the Go package.
+  func = dlsym(handler_, "moeOnWarmup");
+  if (func) {
+    moeOnWarmup_ = reinterpret_cast<GoUint64 (*)()>(func);
+    optional_symbols_.push_back("moeOnWarmup");
+  } else {
+    ENVOY_LOG_MISC(debug, "lib: {}, no optional symbol: moeOnWarmup", dsoName);
+  }
+
+  func = dlsym(handler_, "moeSetRuntimeConfig");
+  if (func) {
+    moeSetRuntimeConfig_ =
+        reinterpret_cast<void (*)(GoInt64 p0, GoUint64 p1, GoInt64 p2, GoInt64 p3)>(func);
+    optional_symbols_.push_back("moeSetRuntimeConfig");
+  } else {
+    ENVOY_LOG_MISC(debug, "lib: {}, no optional symbol: moeSetRuntimeConfig", dsoName);
+  }
+
+  func = dlsym(handler_, "moeGetRuntimeStats");
+  if (func) {
+    moeGetRuntimeStats_ = reinterpret_cast<char* (*)()>(func);
+    optional_symbols_.push_back("moeGetRuntimeStats");
+  } else {
+    ENVOY_LOG_MISC(debug, "lib: {}, no optional symbol: moeGetRuntimeStats", dsoName);
+  }
+
+  func = dlsym(handler_, "moeStartCPUProfile");
+  if (func) {
+    moeStartCPUProfile_ = reinterpret_cast<GoUint64 (*)(GoInt64 p0)>(func);
+    optional_symbols_.push_back("moeStartCPUProfile");
+  } else {
+    ENVOY_LOG_MISC(debug, "lib: {}, no optional symbol: moeStartCPUProfile", dsoName);
+  }
+
+  func = dlsym(handler_, "moeStopCPUProfile");
+  if (func) {
+    moeStopCPUProfile_ = reinterpret_cast<void* (*)(GoUint64 * p0)>(func);
+    optional_symbols_.push_back("moeStopCPUProfile");
+  } else {
+    ENVOY_LOG_MISC(debug, "lib: {}, no optional symbol: moeStopCPUProfile", dsoName);
+  }
+
+  func = dlsym(handler_, "moeWriteHeapProfile");
+  if (func) {
+    moeWriteHeapProfile_ = reinterpret_cast<void* (*)(GoUint64 * p0)>(func);
+    optional_symbols_.push_back("moeWriteHeapProfile");
+  } else {
+    ENVOY_LOG_MISC(debug, "lib: {}, no optional symbol: moeWriteHeapProfile", dsoName);
+  }
+
+  func = dlsym(handler_, "moeWriteGoroutineProfile");
+  if (func) {
+    moeWriteGoroutineProfile_ = reinterpret_cast<void* (*)(GoInt64 p0, GoUint64 * p1)>(func);
+    optional_symbols_.push_back("moeWriteGoroutineProfile");
+  } else {
+    ENVOY_LOG_MISC(debug, "lib: {}, no optional symbol: moeWriteGoroutineProfile", dsoName);
+  }
 }
 
 DsoInstance::~DsoInstance() {
   moeNewHttpPluginConfig_ = nullptr;
+  moeDestroyHttpPluginConfig_ = nullptr;
   moeMergeHttpPluginConfig_ = nullptr;
   moeOnHttpHeader_ = nullptr;
   moeOnHttpData_ = nullptr;
   moeOnHttpSemaCallback_ = nullptr;
   moeOnHttpDestroy_ = nullptr;
+  moeOnWarmup_ = nullptr;
+  moeSetRuntimeConfig_ = nullptr;
+  moeGetRuntimeStats_ = nullptr;
+  moeStartCPUProfile_ = nullptr;
+  moeStopCPUProfile_ = nullptr;
+  moeWriteHeapProfile_ = nullptr;
+  moeWriteGoroutineProfile_ = nullptr;
 
+  // NP: the Go runtime can not be unloaded, its threads are still running, so the library is
+  // kept loaded after the instance is retired, it's leaked for the life of the process.
   if (handler_ != nullptr) {
-    dlclose(handler_);
+    ENVOY_LOG_MISC(warn, "dso instance {} is retired, its Go runtime stays loaded.", dsoName_);
     handler_ = nullptr;
   }
 }
 
-GoUint64 DsoInstance::moeNewHttpPluginConfig(GoUint64 p0, GoUint64 p1) {
+size_t DsoInstance::streamShard() {
+  // the threads take the shards in turn.
+  static std::atomic<size_t> next{0};
+  thread_local const size_t shard = next++ % StreamShards;
+  return shard;
+}
+
+uint64_t DsoInstance::streams() const {
+  int64_t streams = 0;
+  for (const auto& shard : streams_) {
+    streams += shard.value_.load(std::memory_order_relaxed);
+  }
+  return streams > 0 ? streams : 0;
+}
+
+GoUint64 DsoInstance::moeNewHttpPluginConfig(GoUint64 p0, GoUint64 p1, GoUint64 p2,
+                                              GoUint64 p3) {
   // TODO: use ASSERT instead
   assert(moeNewHttpPluginConfig_ != nullptr);
-  return moeNewHttpPluginConfig_(p0, p1);
+  return moeNewHttpPluginConfig_(p0, p1, p2, p3);
+}
+
+void DsoInstance::moeDestroyHttpPluginConfig(GoUint64 p0) {
+  assert(moeDestroyHttpPluginConfig_ != nullptr);
+  moeDestroyHttpPluginConfig_(p0);
 }
 
 GoUint64 DsoInstance::moeMergeHttpPluginConfig(GoUint64 p0, GoUint64 p1) {
@@ -148,22 +351,109 @@ GoUint64 DsoInstance::moeMergeHttpPluginConfig(GoUint64 p0, GoUint64 p1) {
 
 GoUint64 DsoInstance::moeOnHttpHeader(httpRequest* p0, GoUint64 p1, GoUint64 p2, GoUint64 p3) {
   assert(moeOnHttpHeader_ != nullptr);
-  return moeOnHttpHeader_(p0, p1, p2, p3);
+  GOLANG_PROBE4(on_http_header_entry, p0->streamId, p0->phase, p1, p3);
+  auto status = moeOnHttpHeader_(p0, p1, p2, p3);
+  GOLANG_PROBE3(on_http_header_exit, p0->streamId, p0->phase, status);
+  return status;
 }
 
 GoUint64 DsoInstance::moeOnHttpData(httpRequest* p0, GoUint64 p1, GoUint64 p2, GoUint64 p3) {
   assert(moeOnHttpData_ != nullptr);
-  return moeOnHttpData_(p0, p1, p2, p3);
+  GOLANG_PROBE4(on_http_data_entry, p0->streamId, p0->phase, p1, p3);
+  auto status = moeOnHttpData_(p0, p1, p2, p3);
+  GOLANG_PROBE3(on_http_data_exit, p0->streamId, p0->phase, status);
+  return status;
 }
 
-void DsoInstance::moeOnHttpSemaCallback(httpRequest* p0) {
+void DsoInstance::moeOnHttpSemaCallback(httpRequest* p0, void* p1) {
   assert(moeOnHttpSemaCallback_ != nullptr);
-  return moeOnHttpSemaCallback_(p0);
+  return moeOnHttpSemaCallback_(p0, p1);
 }
 
 void DsoInstance::moeOnHttpDestroy(httpRequest* p0, int p1) {
   assert(moeOnHttpDestroy_ != nullptr);
+  GOLANG_PROBE2(on_http_destroy_entry, p0->streamId, p1);
+  // NP: the request may be finalized by Go in the destroy, so the id is read before.
+  auto stream_id = p0->streamId;
   moeOnHttpDestroy_(p0, GoUint64(p1));
+  GOLANG_PROBE1(on_http_destroy_exit, stream_id);
+}
+
+bool DsoInstance::moeOnWarmup() {
+  if (moeOnWarmup_ == nullptr) {
+    return true;
+  }
+  return moeOnWarmup_() == 0;
+}
+
+bool DsoInstance::moeSetRuntimeConfig(const RuntimeConfig& config) {
+  if (config.max_procs == 0 && !config.has_gc_percent && config.memory_limit == 0) {
+    return true;
+  }
+  if (moeSetRuntimeConfig_ == nullptr) {
+    return false;
+  }
+  ENVOY_LOG_MISC(info, "lib: {}, set Go runtime config, gomaxprocs: {}, gogc: {}, gomemlimit: {}",
+                 dsoName_, config.max_procs,
+                 config.has_gc_percent ? std::to_string(config.gc_percent) : "default",
+                 config.memory_limit);
+  moeSetRuntimeConfig_(config.max_procs, config.has_gc_percent ? 1 : 0, config.gc_percent,
+                       config.memory_limit);
+  return true;
+}
+
+std::string DsoInstance::moeGetRuntimeStats() {
+  if (moeGetRuntimeStats_ == nullptr) {
+    return "";
+  }
+  // the buffer is malloc'd in Go, and it's freed here.
+  char* buf = moeGetRuntimeStats_();
+  if (buf == nullptr) {
+    return "";
+  }
+  std::string stats(buf);
+  free(buf);
+  return stats;
+}
+
+namespace {
+
+// take the profile buffer that malloc'd in Go.
+absl::optional<std::string> takeProfile(void* buf, GoUint64 length) {
+  if (buf == nullptr) {
+    return absl::nullopt;
+  }
+  std::string profile(static_cast<const char*>(buf), length);
+  free(buf);
+  return profile;
+}
+
+} // namespace
+
+bool DsoInstance::moeStartCPUProfile(int64_t seconds) {
+  assert(moeStartCPUProfile_ != nullptr);
+  return moeStartCPUProfile_(seconds) == 0;
+}
+
+absl::optional<std::string> DsoInstance::moeStopCPUProfile() {
+  assert(moeStopCPUProfile_ != nullptr);
+  GoUint64 length = 0;
+  auto buf = moeStopCPUProfile_(&length);
+  return takeProfile(buf, length);
+}
+
+absl::optional<std::string> DsoInstance::moeWriteHeapProfile() {
+  assert(moeWriteHeapProfile_ != nullptr);
+  GoUint64 length = 0;
+  auto buf = moeWriteHeapProfile_(&length);
+  return takeProfile(buf, length);
+}
+
+absl::optional<std::string> DsoInstance::moeWriteGoroutineProfile(int64_t debug) {
+  assert(moeWriteGoroutineProfile_ != nullptr);
+  GoUint64 length = 0;
+  auto buf = moeWriteGoroutineProfile_(debug, &length);
+  return takeProfile(buf, length);
 }
 
 } // namespace Dso
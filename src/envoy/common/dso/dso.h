@@ -1,59 +1,195 @@
 #pragma once
 
 #include <string>
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <dlfcn.h>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
 #include <shared_mutex>
+#include <vector>
 
+#include "envoy/common/callback.h"
+
+#include "source/common/common/callback_impl.h"
 #include "source/common/common/logger.h"
 
+#include "absl/types/optional.h"
+
 #include "src/envoy/common/dso/libgolang.h"
 
 namespace Envoy {
 namespace Dso {
 
+/**
+ * The Go runtime knobs applied right after the library is loaded, the zero values keep the
+ * Go defaults.
+ */
+struct RuntimeConfig {
+  // GOMAXPROCS, 0 means the Go default.
+  int64_t max_procs{0};
+  // GOGC, it's applied only when has_gc_percent is set, a negative value turns off the GC.
+  bool has_gc_percent{false};
+  int64_t gc_percent{100};
+  // GOMEMLIMIT in bytes, 0 means no limit.
+  int64_t memory_limit{0};
+};
+
 class DsoInstance {
 public:
   DsoInstance(const std::string dsoName);
   ~DsoInstance();
 
-  GoUint64 moeNewHttpPluginConfig(GoUint64 p0, GoUint64 p1);
+  GoUint64 moeNewHttpPluginConfig(GoUint64 p0, GoUint64 p1, GoUint64 p2, GoUint64 p3);
+  void moeDestroyHttpPluginConfig(GoUint64 p0);
   GoUint64 moeMergeHttpPluginConfig(GoUint64 p0, GoUint64 p1);
 
   GoUint64 moeOnHttpHeader(httpRequest* p0, GoUint64 p1, GoUint64 p2, GoUint64 p3);
   GoUint64 moeOnHttpData(httpRequest* p0, GoUint64 p1, GoUint64 p2, GoUint64 p3);
 
-  void moeOnHttpSemaCallback(httpRequest* p0);
+  void moeOnHttpSemaCallback(httpRequest* p0, void* p1);
 
   void moeOnHttpDestroy(httpRequest* p0, int p1);
 
+  // run the warmup of the plugins, it's optional, false means failed.
+  bool moeOnWarmup();
+
+  // apply the Go runtime knobs, it's optional, false means the library does not support it.
+  bool moeSetRuntimeConfig(const RuntimeConfig& config);
+
+  // the Go runtime stats in JSON, it's optional, empty means the library does not support it.
+  std::string moeGetRuntimeStats();
+
+  // the Go profiles, they're optional, the library supports them only when it exports all of
+  // the profile symbols.
+  bool supportProfile() const {
+    return moeStartCPUProfile_ != nullptr && moeStopCPUProfile_ != nullptr &&
+           moeWriteHeapProfile_ != nullptr && moeWriteGoroutineProfile_ != nullptr;
+  }
+  // start the CPU profile, false means it's running already. It's stopped by moeStopCPUProfile,
+  // or by Go after the seconds at the latest.
+  bool moeStartCPUProfile(int64_t seconds);
+  // stop the CPU profile if it's running, and return the last one, nullopt means no profile.
+  absl::optional<std::string> moeStopCPUProfile();
+  absl::optional<std::string> moeWriteHeapProfile();
+  // debug is the debug level of the goroutine profile, 0 means the protobuf format.
+  absl::optional<std::string> moeWriteGoroutineProfile(int64_t debug);
+
   bool loaded() { return loaded_; }
+  const std::string& name() const { return dsoName_; }
+  std::chrono::system_clock::time_point loadTime() const { return load_time_; }
+  // the optional symbols exported by the library, they tell the version of the Go package.
+  const std::vector<std::string>& optionalSymbols() const { return optional_symbols_; }
+
+  // the in-flight streams that pinned the instance, counted per thread, so the workers do not
+  // contend on one cache line.
+  void streamCreated() { streams_[streamShard()].value_.fetch_add(1, std::memory_order_relaxed); }
+  void streamDestroyed() {
+    streams_[streamShard()].value_.fetch_sub(1, std::memory_order_relaxed);
+  }
+  uint64_t streams() const;
 
 private:
   const std::string dsoName_;
   void* handler_{nullptr};
   bool loaded_{false};
-
-  GoUint64 (*moeNewHttpPluginConfig_)(GoUint64 p0, GoUint64 p1) = {nullptr};
+  const std::chrono::system_clock::time_point load_time_{std::chrono::system_clock::now()};
+  std::vector<std::string> optional_symbols_;
+  // NP: a stream may be destroyed in another thread, so a shard may go negative, only the sum
+  // makes sense.
+  struct alignas(64) StreamShard {
+    std::atomic<int64_t> value_{0};
+  };
+  static constexpr size_t StreamShards = 16;
+  static size_t streamShard();
+  std::array<StreamShard, StreamShards> streams_;
+
+  GoUint64 (*moeNewHttpPluginConfig_)(GoUint64 p0, GoUint64 p1, GoUint64 p2,
+                                      GoUint64 p3) = {nullptr};
+  void (*moeDestroyHttpPluginConfig_)(GoUint64 p0) = {nullptr};
   GoUint64 (*moeMergeHttpPluginConfig_)(GoUint64 p0, GoUint64 p1) = {nullptr};
 
   GoUint64 (*moeOnHttpHeader_)(httpRequest* p0, GoUint64 p1, GoUint64 p2, GoUint64 p3) = {nullptr};
   GoUint64 (*moeOnHttpData_)(httpRequest* p0, GoUint64 p1, GoUint64 p2, GoUint64 p3) = {nullptr};
 
-  void (*moeOnHttpSemaCallback_)(httpRequest* p0) = {nullptr};
+  void (*moeOnHttpSemaCallback_)(httpRequest* p0, void* p1) = {nullptr};
 
   void (*moeOnHttpDestroy_)(httpRequest* p0, GoUint64 p1) = {nullptr};
+
+  GoUint64 (*moeOnWarmup_)() = {nullptr};
+  void (*moeSetRuntimeConfig_)(GoInt64 p0, GoUint64 p1, GoInt64 p2, GoInt64 p3) = {nullptr};
+  char* (*moeGetRuntimeStats_)() = {nullptr};
+  GoUint64 (*moeStartCPUProfile_)(GoInt64 p0) = {nullptr};
+  void* (*moeStopCPUProfile_)(GoUint64* p0) = {nullptr};
+  void* (*moeWriteHeapProfile_)(GoUint64* p0) = {nullptr};
+  void* (*moeWriteGoroutineProfile_)(GoInt64 p0, GoUint64* p1) = {nullptr};
+};
+
+/**
+ * Removes the callback with the mutex held, since the handle owners, i.e. filter configs, may be
+ * released in the worker threads, while the callbacks run in the main thread.
+ */
+class LockedCallbackHandle : public Common::CallbackHandle {
+public:
+  LockedCallbackHandle(std::mutex& mutex, Common::CallbackHandlePtr handle)
+      : mutex_(mutex), handle_(std::move(handle)) {}
+  ~LockedCallbackHandle() override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    handle_.reset();
+  }
+
+private:
+  std::mutex& mutex_;
+  Common::CallbackHandlePtr handle_;
 };
 
+using DsoInstanceSharedPtr = std::shared_ptr<DsoInstance>;
+
+/**
+ * The published dso instances, a dso id could be published again with a new library path, then
+ * the new version serves the new streams, and the old version is retired once the in-flight
+ * streams and configs that pinned it are released.
+ * NP: a Go runtime can not be unloaded, every library path loaded keeps its runtime, with its
+ * threads and heap, for the life of the process, even after it's retired, so the number of the
+ * loaded libraries is capped, and the pubs beyond it are refused.
+ */
 class DsoInstanceManager {
 public:
-  static bool pub(std::string dsoId, std::string dsoName);
+  using PubCallback = std::function<void(const std::string& dsoId, const DsoInstanceSharedPtr& dso)>;
+
+  // the runtime config is applied to the new loaded instance before the pub callbacks run.
+  static bool pub(std::string dsoId, std::string dsoName,
+                  const RuntimeConfig& runtime_config = {});
   static bool unpub(std::string dsoId);
-  static DsoInstance* getDsoInstanceByID(std::string dsoId);
+  // the current version of the dso id.
+  static DsoInstanceSharedPtr getDsoInstanceByID(std::string dsoId);
+  // the published dso instances and their Go runtime stats in JSON.
   static std::string show();
+  // the number of the Go runtimes loaded, including the retired ones.
+  static size_t runtimes();
+  // for testing.
+  static void setMaxRuntimes(size_t max_runtimes);
+
+  static constexpr size_t DefaultMaxRuntimes = 16;
+
+  // The callback is invoked in the main thread after a dso instance is published, including the
+  // new versions, it is removed when the returned handle is destroyed.
+  static Common::CallbackHandlePtr addPubCallback(PubCallback cb);
 
 private:
+  // serializes the pubs, from checking the current version to publishing the new one.
+  static std::mutex pub_mutex_;
+  // the library paths loaded by the pubs, guarded by pub_mutex_.
+  static std::set<std::string> runtimes_;
+  static size_t max_runtimes_;
   static std::shared_mutex mutex_;
-  static std::map<std::string, DsoInstance*> dso_map_;
+  static std::map<std::string, DsoInstanceSharedPtr> dso_map_;
+  static std::mutex pub_callbacks_mutex_;
+  static Common::CallbackManager<const std::string&, const DsoInstanceSharedPtr&> pub_callbacks_;
 };
 
 } // namespace Dso
@@ -107,10 +107,17 @@ extern "C" {
 extern GoUint64 moeOnHttpHeader(httpRequest* r, GoUint64 endStream, GoUint64 headerNum, GoUint64 headerBytes);
 extern GoUint64 moeOnHttpData(httpRequest* r, GoUint64 endStream, GoUint64 buffer, GoUint64 length);
 extern void moeOnHttpDestroy(httpRequest* r, GoUint64 reason);
-extern void moeOnHttpSemaCallback(httpRequest* r);
-extern GoUint64 moeNewHttpPluginConfig(GoUint64 configPtr, GoUint64 configLen);
+extern void moeOnHttpSemaCallback(httpRequest* r, void* waiter);
+extern GoUint64 moeNewHttpPluginConfig(GoUint64 namePtr, GoUint64 nameLen, GoUint64 configPtr, GoUint64 configLen);
 extern void moeDestroyHttpPluginConfig(GoUint64 id);
 extern GoUint64 moeMergeHttpPluginConfig(GoUint64 parentId, GoUint64 childId);
+extern GoUint64 moeOnWarmup();
+extern void moeSetRuntimeConfig(GoInt64 maxProcs, GoUint64 setGCPercent, GoInt64 gcPercent, GoInt64 memoryLimit);
+extern char* moeGetRuntimeStats();
+extern GoUint64 moeStartCPUProfile(GoInt64 seconds);
+extern void* moeStopCPUProfile(GoUint64* length);
+extern void* moeWriteHeapProfile(GoUint64* length);
+extern void* moeWriteGoroutineProfile(GoInt64 debug, GoUint64* length);
 
 #ifdef __cplusplus
 }
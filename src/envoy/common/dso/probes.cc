@@ -0,0 +1,14 @@
+#include "src/envoy/common/dso/probes.h"
+
+#ifdef GOLANG_HAS_SDT
+
+// the semaphores are in the .probes section, the tracer increases them when it attaches the
+// probes.
+#define GOLANG_DEFINE_PROBE_SEMAPHORE(name)                                                        \
+  volatile unsigned short GOLANG_PROBE_SEMAPHORE(name) __attribute__((section(".probes"))) = 0;
+
+extern "C" {
+GOLANG_PROBES(GOLANG_DEFINE_PROBE_SEMAPHORE)
+}
+
+#endif
@@ -0,0 +1,74 @@
+#pragma once
+
+// USDT probes at the cgo boundaries, for tracing the crossings by bpftrace or perf, i.e.
+//   bpftrace -e 'usdt:/usr/local/bin/envoy:golang:on_http_header_entry { @[arg0] = nsecs; }'
+// Each probe has a semaphore that is raised by the tracer when it's attached, the arguments are
+// only evaluated then, so the probes cost a predicted branch otherwise. The probes are compiled
+// out when <sys/sdt.h> is not available.
+// The stream is identified by the stream id of the filter.
+
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+// NP: it must be defined before including sys/sdt.h, the notes record the semaphores then.
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+#define GOLANG_HAS_SDT 1
+#endif
+#endif
+
+// all the probes, their semaphores are defined in probes.cc.
+#define GOLANG_PROBES(PROBE)                                                                       \
+  PROBE(on_http_header_entry)                                                                      \
+  PROBE(on_http_header_exit)                                                                       \
+  PROBE(on_http_data_entry)                                                                        \
+  PROBE(on_http_data_exit)                                                                         \
+  PROBE(on_http_destroy_entry)                                                                     \
+  PROBE(on_http_destroy_exit)                                                                      \
+  PROBE(capi_entry)                                                                                \
+  PROBE(capi_exit)                                                                                 \
+  PROBE(capi_finalize)                                                                             \
+  PROBE(continue_status)
+
+#ifdef GOLANG_HAS_SDT
+
+#define GOLANG_PROBE_SEMAPHORE(name) golang_##name##_semaphore
+#define GOLANG_DECLARE_PROBE_SEMAPHORE(name)                                                       \
+  extern "C" volatile unsigned short GOLANG_PROBE_SEMAPHORE(name);
+GOLANG_PROBES(GOLANG_DECLARE_PROBE_SEMAPHORE)
+
+#define GOLANG_PROBE_ENABLED(name) __builtin_expect(GOLANG_PROBE_SEMAPHORE(name) != 0, 0)
+
+#define GOLANG_PROBE1(name, a1)                                                                    \
+  do {                                                                                             \
+    if (GOLANG_PROBE_ENABLED(name)) {                                                              \
+      DTRACE_PROBE1(golang, name, a1);                                                             \
+    }                                                                                              \
+  } while (0)
+#define GOLANG_PROBE2(name, a1, a2)                                                                \
+  do {                                                                                             \
+    if (GOLANG_PROBE_ENABLED(name)) {                                                              \
+      DTRACE_PROBE2(golang, name, a1, a2);                                                         \
+    }                                                                                              \
+  } while (0)
+#define GOLANG_PROBE3(name, a1, a2, a3)                                                            \
+  do {                                                                                             \
+    if (GOLANG_PROBE_ENABLED(name)) {                                                              \
+      DTRACE_PROBE3(golang, name, a1, a2, a3);                                                     \
+    }                                                                                              \
+  } while (0)
+#define GOLANG_PROBE4(name, a1, a2, a3, a4)                                                        \
+  do {                                                                                             \
+    if (GOLANG_PROBE_ENABLED(name)) {                                                              \
+      DTRACE_PROBE4(golang, name, a1, a2, a3, a4);                                                 \
+    }                                                                                              \
+  } while (0)
+
+#else
+
+#define GOLANG_PROBE_ENABLED(name) false
+#define GOLANG_PROBE1(name, a1)
+#define GOLANG_PROBE2(name, a1, a2)
+#define GOLANG_PROBE3(name, a1, a2, a3)
+#define GOLANG_PROBE4(name, a1, a2, a3, a4)
+
+#endif
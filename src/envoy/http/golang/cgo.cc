@@ -1,4 +1,7 @@
 #include "src/envoy/http/golang/golang_filter.h"
+#include "src/envoy/http/golang/metrics.h"
+
+#include "src/envoy/common/dso/probes.h"
 
 namespace Envoy {
 namespace Extensions {
@@ -26,39 +29,78 @@ absl::string_view stringViewFromGoSlice(void* slice) {
   return absl::string_view(static_cast<const char*>(goSlice->data), goSlice->len);
 }
 
+// the records from Go, the level has been checked in Go already.
+void logFromGo(uint8_t level, absl::string_view message) {
+  auto& logger = Logger::Registry::getLog(Logger::Id::http);
+  switch (static_cast<spdlog::level::level_enum>(level)) {
+  case spdlog::level::trace:
+    ENVOY_LOG_TO_LOGGER(logger, trace, "golang: {}", message);
+    break;
+  case spdlog::level::debug:
+    ENVOY_LOG_TO_LOGGER(logger, debug, "golang: {}", message);
+    break;
+  case spdlog::level::info:
+    ENVOY_LOG_TO_LOGGER(logger, info, "golang: {}", message);
+    break;
+  case spdlog::level::warn:
+    ENVOY_LOG_TO_LOGGER(logger, warn, "golang: {}", message);
+    break;
+  case spdlog::level::err:
+    ENVOY_LOG_TO_LOGGER(logger, error, "golang: {}", message);
+    break;
+  default:
+    ENVOY_LOG_TO_LOGGER(logger, critical, "golang: {}", message);
+    break;
+  }
+}
+
 extern "C" {
 
-int moeHandlerWrapper(void* r, std::function<int(std::shared_ptr<Filter>&)> f) {
+// api is the name of the C API, for the probes.
+int moeHandlerWrapper(void* r, const char* api, std::function<int(std::shared_ptr<Filter>&)> f) {
   auto req = reinterpret_cast<httpRequestInternal*>(r);
+  GOLANG_PROBE3(capi_entry, req->streamId, api, req->phase);
+  auto ret = CAPIFilterIsGone;
   auto weakFilter = req->weakFilter();
   if (auto filter = weakFilter.lock()) {
-    return f(filter);
+    ret = f(filter);
   }
-  return CAPIFilterIsGone;
+  GOLANG_PROBE3(capi_exit, req->streamId, api, ret);
+  return ret;
 }
 
 int moeHttpContinue(void* r, int status) {
-  return moeHandlerWrapper(r, [status](std::shared_ptr<Filter>& filter) -> int {
+  return moeHandlerWrapper(r, __func__, [status](std::shared_ptr<Filter>& filter) -> int {
     return filter->continueStatus(static_cast<GolangStatus>(status));
   });
 }
 
 int moeHttpSendLocalReply(void* r, int response_code, void* body_text, void* headers,
                           long long int grpc_status, void* details) {
-  return moeHandlerWrapper(r,
+  return moeHandlerWrapper(r, __func__,
                            [response_code, body_text, headers, grpc_status,
                             details](std::shared_ptr<Filter>& filter) -> int {
-                             (void)headers;
+                             // the key value pairs in a Go []string.
+                             LocalReplyHeaders replyHeaders;
+                             auto goSlice = reinterpret_cast<GoSlice*>(headers);
+                             if (goSlice != nullptr) {
+                               auto goStrs = reinterpret_cast<GoString*>(goSlice->data);
+                               for (GoInt i = 0; i + 1 < goSlice->len; i += 2) {
+                                 replyHeaders.emplace_back(
+                                     Http::LowerCaseString(copyGoString(&goStrs[i])),
+                                     std::string(copyGoString(&goStrs[i + 1])));
+                               }
+                             }
                              auto grpcStatus = static_cast<Grpc::Status::GrpcStatus>(grpc_status);
-                             return filter->sendLocalReply(static_cast<Http::Code>(response_code),
-                                                           copyGoString(body_text), nullptr,
-                                                           grpcStatus, copyGoString(details));
+                             return filter->sendLocalReply(
+                                 static_cast<Http::Code>(response_code), copyGoString(body_text),
+                                 std::move(replyHeaders), grpcStatus, copyGoString(details));
                            });
 }
 
 // unsafe API, without copy memory from c to go.
 int moeHttpGetHeader(void* r, void* key, void* value) {
-  return moeHandlerWrapper(r, [key, value](std::shared_ptr<Filter>& filter) -> int {
+  return moeHandlerWrapper(r, __func__, [key, value](std::shared_ptr<Filter>& filter) -> int {
     auto keyStr = copyGoString(key);
     auto goValue = reinterpret_cast<GoString*>(value);
     return filter->getHeader(keyStr, goValue);
@@ -66,7 +108,7 @@ int moeHttpGetHeader(void* r, void* key, void* value) {
 }
 
 int moeHttpCopyHeaders(void* r, void* strs, void* buf) {
-  return moeHandlerWrapper(r, [strs, buf](std::shared_ptr<Filter>& filter) -> int {
+  return moeHandlerWrapper(r, __func__, [strs, buf](std::shared_ptr<Filter>& filter) -> int {
     auto goStrs = reinterpret_cast<GoString*>(strs);
     auto goBuf = reinterpret_cast<char*>(buf);
     return filter->copyHeaders(goStrs, goBuf);
@@ -74,7 +116,7 @@ int moeHttpCopyHeaders(void* r, void* strs, void* buf) {
 }
 
 int moeHttpSetHeaderHelper(void* r, void* key, void* value, headerAction act) {
-  return moeHandlerWrapper(r, [key, value, act](std::shared_ptr<Filter>& filter) -> int {
+  return moeHandlerWrapper(r, __func__, [key, value, act](std::shared_ptr<Filter>& filter) -> int {
     auto keyStr = copyGoString(key);
     auto valueStr = copyGoString(value);
     return filter->setHeader(keyStr, valueStr, act);
@@ -82,7 +124,7 @@ int moeHttpSetHeaderHelper(void* r, void* key, void* value, headerAction act) {
 }
 
 int moeHttpRemoveHeader(void* r, void* key) {
-  return moeHandlerWrapper(r, [key](std::shared_ptr<Filter>& filter) -> int {
+  return moeHandlerWrapper(r, __func__, [key](std::shared_ptr<Filter>& filter) -> int {
     // TODO: it's safe to skip copy
     auto keyStr = copyGoString(key);
     return filter->removeHeader(keyStr);
@@ -90,7 +132,7 @@ int moeHttpRemoveHeader(void* r, void* key) {
 }
 
 int moeHttpGetBuffer(void* r, unsigned long long int bufferPtr, void* data) {
-  return moeHandlerWrapper(r, [bufferPtr, data](std::shared_ptr<Filter>& filter) -> int {
+  return moeHandlerWrapper(r, __func__, [bufferPtr, data](std::shared_ptr<Filter>& filter) -> int {
     auto buffer = reinterpret_cast<Buffer::Instance*>(bufferPtr);
     return filter->copyBuffer(buffer, reinterpret_cast<char*>(data));
   });
@@ -99,7 +141,7 @@ int moeHttpGetBuffer(void* r, unsigned long long int bufferPtr, void* data) {
 int moeHttpSetBufferHelper(void* r, unsigned long long int bufferPtr, void* data, int length,
                            bufferAction action) {
   return moeHandlerWrapper(
-      r, [bufferPtr, data, length, action](std::shared_ptr<Filter>& filter) -> int {
+      r, __func__, [bufferPtr, data, length, action](std::shared_ptr<Filter>& filter) -> int {
         auto buffer = reinterpret_cast<Buffer::Instance*>(bufferPtr);
         auto value = absl::string_view(reinterpret_cast<const char*>(data), length);
         return filter->setBufferHelper(buffer, value, action);
@@ -107,7 +149,7 @@ int moeHttpSetBufferHelper(void* r, unsigned long long int bufferPtr, void* data
 }
 
 int moeHttpCopyTrailers(void* r, void* strs, void* buf) {
-  return moeHandlerWrapper(r, [strs, buf](std::shared_ptr<Filter>& filter) -> int {
+  return moeHandlerWrapper(r, __func__, [strs, buf](std::shared_ptr<Filter>& filter) -> int {
     auto goStrs = reinterpret_cast<GoString*>(strs);
     auto goBuf = reinterpret_cast<char*>(buf);
     return filter->copyTrailers(goStrs, goBuf);
@@ -115,7 +157,7 @@ int moeHttpCopyTrailers(void* r, void* strs, void* buf) {
 }
 
 int moeHttpSetTrailer(void* r, void* key, void* value) {
-  return moeHandlerWrapper(r, [key, value](std::shared_ptr<Filter>& filter) -> int {
+  return moeHandlerWrapper(r, __func__, [key, value](std::shared_ptr<Filter>& filter) -> int {
     auto keyStr = copyGoString(key);
     auto valueStr = copyGoString(value);
     return filter->setTrailer(keyStr, valueStr);
@@ -123,20 +165,33 @@ int moeHttpSetTrailer(void* r, void* key, void* value) {
 }
 
 int moeHttpGetStringValue(void* r, int id, void* value) {
-  return moeHandlerWrapper(r, [id, value](std::shared_ptr<Filter>& filter) -> int {
+  return moeHandlerWrapper(r, __func__, [id, value](std::shared_ptr<Filter>& filter) -> int {
     auto valueStr = reinterpret_cast<GoString*>(value);
     return filter->getStringValue(id, valueStr);
   });
 }
 
+int moeHttpCacheDecision(void* r, unsigned long long int ttl_ms) {
+  return moeHandlerWrapper(r, __func__, [ttl_ms](std::shared_ptr<Filter>& filter) -> int {
+    return filter->cacheDecision(ttl_ms);
+  });
+}
+
+int moeHttpFlushSpans(void* r, void* batch) {
+  return moeHandlerWrapper(r, __func__, [batch](std::shared_ptr<Filter>& filter) -> int {
+    return filter->flushSpans(reinterpret_cast<GoSlice*>(batch));
+  });
+}
+
 void moeHttpFinalize(void* r, int reason) {
   (void)reason;
   auto req = reinterpret_cast<httpRequestInternal*>(r);
+  GOLANG_PROBE2(capi_finalize, req->streamId, reason);
   delete req;
 }
 
 int moeHttpGetDynamicMetadata(void* r, void* name, void* buf) {
-  return moeHandlerWrapper(r, [name, buf](std::shared_ptr<Filter>& filter) -> int {
+  return moeHandlerWrapper(r, __func__, [name, buf](std::shared_ptr<Filter>& filter) -> int {
     auto nameStr = std::string(copyGoString(name));
     auto bufSlice = reinterpret_cast<GoSlice*>(buf);
     return filter->getDynamicMetadata(nameStr, bufSlice);
@@ -144,13 +199,43 @@ int moeHttpGetDynamicMetadata(void* r, void* name, void* buf) {
 }
 
 int moeHttpSetDynamicMetadata(void* r, void* name, void* key, void* buf) {
-  return moeHandlerWrapper(r, [name, key, buf](std::shared_ptr<Filter>& filter) -> int {
+  return moeHandlerWrapper(r, __func__, [name, key, buf](std::shared_ptr<Filter>& filter) -> int {
     auto nameStr = std::string(copyGoString(name));
     auto keyStr = std::string(copyGoString(key));
     auto bufStr = stringViewFromGoSlice(buf);
     return filter->setDynamicMetadata(nameStr, keyStr, bufStr);
   });
 }
+
+void* moeDefineMetric(int metric_type, void* plugin_name, void* metric_name, void* value) {
+  auto slot = GoMetrics::define(static_cast<MetricType>(metric_type), copyGoString(plugin_name),
+                                copyGoString(metric_name));
+  if (slot == nullptr) {
+    return nullptr;
+  }
+  *reinterpret_cast<void**>(value) = &slot->value_;
+  return slot;
+}
+
+int moeRecordHistogram(void* slot, void* values) {
+  auto goSlice = reinterpret_cast<GoSlice*>(values);
+  GoMetrics::record(*reinterpret_cast<MetricSlot*>(slot),
+                    static_cast<const uint64_t*>(goSlice->data), goSlice->len);
+  return CAPIOK;
+}
+
+int moeLogLevel() { return static_cast<int>(Logger::Registry::getLog(Logger::Id::http).level()); }
+
+// it's called by the goroutine that drains the log queue, not in the request path.
+void moeLogBatch(void* levels, void* messages) {
+  auto levelSlice = reinterpret_cast<GoSlice*>(levels);
+  auto messageSlice = reinterpret_cast<GoSlice*>(messages);
+  auto levelData = static_cast<const uint8_t*>(levelSlice->data);
+  auto strs = static_cast<const GoString*>(messageSlice->data);
+  for (GoInt i = 0; i < messageSlice->len && i < levelSlice->len; i++) {
+    logFromGo(levelData[i], absl::string_view(strs[i].p, strs[i].n));
+  }
+}
 }
 
 } // namespace Golang
@@ -3,6 +3,7 @@
 #include "envoy/registry/registry.h"
 
 #include "src/envoy/http/golang/golang_filter.h"
+#include "src/envoy/http/golang/metrics.h"
 
 namespace Envoy {
 namespace Extensions {
@@ -10,15 +11,17 @@ namespace HttpFilters {
 namespace Golang {
 
 Http::FilterFactoryCb GolangFilterConfig::createFilterFactoryFromProtoTyped(
-    const envoy::extensions::filters::http::golang::v3::Config& proto_config, const std::string&,
-    Server::Configuration::FactoryContext& factory_context) {
+    const envoy::extensions::filters::http::golang::v3::Config& proto_config,
+    const std::string& stats_prefix, Server::Configuration::FactoryContext& factory_context) {
 
-  FilterConfigSharedPtr config = std::make_shared<FilterConfig>(proto_config);
+  FilterConfigSharedPtr config = std::make_shared<FilterConfig>(
+      proto_config, stats_prefix, factory_context.scope(), factory_context.threadLocal());
+  // the metrics of the Go plugins are flushed by it, while the filter chain is alive.
+  GoMetricsSharedPtr metrics = GoMetrics::singleton(factory_context.getServerFactoryContext());
 
-  return [&factory_context, config](Http::FilterChainFactoryCallbacks& callbacks) {
-    auto filter =
-        std::make_shared<Filter>(factory_context.grpcContext(), config, Filter::global_stream_id_++,
-                                 Dso::DsoInstanceManager::getDsoInstanceByID(config->so_id()));
+  return [&factory_context, config, metrics](Http::FilterChainFactoryCallbacks& callbacks) {
+    auto filter = std::make_shared<Filter>(factory_context.grpcContext(), config,
+                                           Filter::global_stream_id_++, config->workerConfig());
     callbacks.addStreamFilter(filter);
     callbacks.addAccessLogHandler(filter);
   };
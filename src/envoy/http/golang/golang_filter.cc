@@ -1,5 +1,8 @@
 #include "src/envoy/http/golang/golang_filter.h"
 
+#include <time.h>
+
+#include <algorithm>
 #include <cstdint>
 #include <string>
 #include <vector>
@@ -8,13 +11,23 @@
 
 #include "source/common/buffer/buffer_impl.h"
 #include "source/common/common/base64.h"
+#include "source/common/common/empty_string.h"
 #include "source/common/common/enum_to_int.h"
+#include "source/common/common/hash.h"
 #include "source/common/common/utility.h"
 #include "source/common/grpc/common.h"
 #include "source/common/grpc/context_impl.h"
 #include "source/common/grpc/status.h"
+#include "source/common/http/header_map_impl.h"
 #include "source/common/http/headers.h"
 #include "source/common/http/http1/codec_impl.h"
+#include "source/common/protobuf/utility.h"
+#include "source/common/tracing/http_tracer_impl.h"
+
+#include "src/envoy/common/dso/probes.h"
+
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
 
 namespace Envoy {
 namespace Extensions {
@@ -23,6 +36,63 @@ namespace Golang {
 
 std::atomic<uint64_t> Filter::global_stream_id_;
 
+namespace {
+
+// the CPU time of the current thread, the sync crossings run Go in the calling thread, so the
+// time spent in Go is counted.
+std::chrono::nanoseconds threadCpuTime() {
+  struct timespec ts;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) {
+    return std::chrono::nanoseconds(0);
+  }
+  return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+}
+
+// set the headers of the local reply, nullptr means none.
+std::function<void(Http::ResponseHeaderMap& headers)>
+modifyReplyHeaders(const LocalReplyHeaders& headers) {
+  if (headers.empty()) {
+    return nullptr;
+  }
+  return [headers](Http::ResponseHeaderMap& reply_headers) {
+    for (const auto& header : headers) {
+      reply_headers.setCopy(header.first, header.second);
+    }
+  };
+}
+
+// the route name in the stat names, the routes without a name share the "unnamed" one, and the
+// dots and colons are replaced, so the name is one element of the stat name.
+std::string routeStatName(absl::string_view route_name) {
+  if (route_name.empty()) {
+    return "unnamed";
+  }
+  std::string name(route_name);
+  std::replace_if(
+      name.begin(), name.end(), [](char c) { return c == '.' || c == ':'; }, '_');
+  return name;
+}
+
+absl::string_view statusName(GolangStatus status) {
+  switch (status) {
+  case GolangStatus::Running:
+    return "Running";
+  case GolangStatus::LocalReply:
+    return "LocalReply";
+  case GolangStatus::Continue:
+    return "Continue";
+  case GolangStatus::StopAndBuffer:
+    return "StopAndBuffer";
+  case GolangStatus::StopAndBufferWatermark:
+    return "StopAndBufferWatermark";
+  case GolangStatus::StopNoBuffer:
+    return "StopNoBuffer";
+  }
+  return "Unknown";
+}
+
+} // namespace
+
 void Filter::onHeadersModified() {
   // Any changes to request headers can affect how the request is going to be
   // routed. If we are changing the headers we also need to clear the route
@@ -54,6 +124,26 @@ Http::FilterHeadersStatus Filter::decodeHeaders(Http::RequestHeaderMap& headers,
 
   state.setEndStream(end_stream);
 
+  auto cache = config_->decisionCache();
+  if (cache != nullptr) {
+    auto decision = lookupDecision(*cache, headers);
+    if (decision != nullptr) {
+      return serveDecision(*decision, headers);
+    }
+  }
+
+  Http::FilterHeadersStatus shed_status;
+  if (shedByCpuBudget(shed_status)) {
+    return shed_status;
+  }
+
+  // NP: only the idempotent requests are speculated, since the upstream may have served the
+  // request already when Go rejects it.
+  if (config_->speculative() && isIdempotent(headers)) {
+    speculating_ = true;
+    return doHeadersSpeculative(state, headers, end_stream);
+  }
+
   bool done = doHeaders(state, headers, end_stream);
 
   return done ? Http::FilterHeadersStatus::Continue : Http::FilterHeadersStatus::StopIteration;
@@ -71,12 +161,18 @@ Http::FilterDataStatus Filter::decodeData(Buffer::Instance& data, bool end_strea
     return Http::FilterDataStatus::Continue;
   }
 
+  // the request body is not passed to Go in the speculative mode.
+  if (speculating_ || bypass_go_) {
+    return Http::FilterDataStatus::Continue;
+  }
+
   state.setEndStream(end_stream);
 
   bool done = doData(state, data, end_stream);
 
   if (done) {
     state.doDataList.moveOut(data);
+    state.reportBufferedBytes();
     return Http::FilterDataStatus::Continue;
   }
 
@@ -96,6 +192,10 @@ Http::FilterTrailersStatus Filter::decodeTrailers(Http::RequestTrailerMap& trail
     return Http::FilterTrailersStatus::Continue;
   }
 
+  if (speculating_ || bypass_go_) {
+    return Http::FilterTrailersStatus::Continue;
+  }
+
   bool done = doTrailer(state, trailers);
 
   return done ? Http::FilterTrailersStatus::Continue : Http::FilterTrailersStatus::StopIteration;
@@ -114,6 +214,18 @@ Http::FilterHeadersStatus Filter::encodeHeaders(Http::ResponseHeaderMap& headers
 
   encoding_state_.setEndStream(end_stream);
 
+  if (bypass_go_) {
+    return Http::FilterHeadersStatus::Continue;
+  }
+
+  if (speculative_pending_) {
+    ENVOY_LOG(debug, "golang filter holds the response headers until Go continues the request");
+    held_headers_ = &headers;
+    // the response data and trailers are buffered by the filter manager, they're passed to this
+    // filter after continueEncoding.
+    return Http::FilterHeadersStatus::StopAllIterationAndBuffer;
+  }
+
   // NP: may enter encodeHeaders in any phase & any state_,
   // since other filters or filtermanager could call encodeHeaders or sendLocalReply in any time.
   // eg. filtermanager may invoke sendLocalReply, when scheme is invalid,
@@ -181,6 +293,10 @@ Http::FilterDataStatus Filter::encodeData(Buffer::Instance& data, bool end_strea
 
   encoding_state_.setEndStream(end_stream);
 
+  if (bypass_go_) {
+    return Http::FilterDataStatus::Continue;
+  }
+
   if (local_reply_waiting_go_) {
     ENVOY_LOG(debug, "golang filter appending data to buffer");
     encoding_state_.addBufferData(data);
@@ -191,6 +307,7 @@ Http::FilterDataStatus Filter::encodeData(Buffer::Instance& data, bool end_strea
 
   if (done) {
     state.doDataList.moveOut(data);
+    state.reportBufferedBytes();
     return Http::FilterDataStatus::Continue;
   }
 
@@ -210,6 +327,10 @@ Http::FilterTrailersStatus Filter::encodeTrailers(Http::ResponseTrailerMap& trai
     return Http::FilterTrailersStatus::Continue;
   }
 
+  if (bypass_go_) {
+    return Http::FilterTrailersStatus::Continue;
+  }
+
   if (local_reply_waiting_go_) {
     // NP: save to another local_trailers_ variable to avoid conflict,
     // since the trailers_ may be used in Go side.
@@ -232,15 +353,27 @@ void Filter::onDestroy() {
       return;
     }
     has_destroyed_ = true;
+    // the pending getters won't be resumed in the worker anymore.
+    if (req_ != nullptr) {
+      config_->stats().sema_waiters_.sub(req_->waitSema);
+    }
   }
 
-  if (dynamicLib_ == NULL) {
+  // the async phase never continues.
+  finishGoSpan("Terminated");
+
+  if (dynamicLib_ == nullptr) {
     ENVOY_LOG(error, "golang filter dynamicLib is nullPtr.");
     return;
   }
 
+  if (req_ == nullptr) {
+    // served by the decision cache or shed by the CPU budget, nothing is called into Go.
+    ASSERT(bypass_go_);
+    return;
+  }
+
   try {
-    ASSERT(req_ != nullptr);
     auto& state = getProcessorState();
     auto reason = state.isProcessingInGo() ? DestroyReason::Terminate : DestroyReason::Normal;
 
@@ -252,9 +385,18 @@ void Filter::onDestroy() {
 }
 
 void Filter::onStreamComplete() {
+  config_->stats().crossings_per_stream_.recordValue(crossings_);
+  if (crossings_ > 0) {
+    auto cpu_time = std::chrono::duration_cast<std::chrono::microseconds>(cpu_time_).count();
+    config_->stats().cpu_time_us_.add(cpu_time);
+    const auto& route = decoding_state_.getFilterCallbacks()->route();
+    const auto* entry = route != nullptr ? route->routeEntry() : nullptr;
+    const std::string& route_name = entry != nullptr ? entry->routeName() : EMPTY_STRING;
+    config_->routeCpuTimeCounter(route_name).add(cpu_time);
+  }
   addGolangMetadata("cost_decode", cost_time_decode_);
   addGolangMetadata("cost_encode", cost_time_encode_);
-  addGolangMetadata("cost_total", cost_time_decode_ + cost_time_encode_ + cost_time_mem_);
+  addGolangMetadata("cost_total", cost_time_decode_ + cost_time_encode_);
 }
 
 void Filter::addGolangMetadata(const std::string& k, const uint64_t v) {
@@ -280,15 +422,23 @@ GolangStatus Filter::doHeadersGo(ProcessorState& state, Http::RequestOrResponseH
 
   try {
     if (req_ == nullptr) {
-      req_ = new httpRequestInternal(weak_from_this());
-      req_->configId = getMergedConfigId(state);
+      req_ = new httpRequestInternal(weak_from_this(), stream_id_,
+                                     config_->stats().requests_outstanding_);
+      // it may be resolved already by the decision cache lookup.
+      if (plugin_config_ == nullptr) {
+        plugin_config_ = getMergedConfig(state);
+      }
+      req_->configId = plugin_config_ != nullptr ? plugin_config_->configId() : 0;
     }
 
     req_->phase = static_cast<int>(state.phase());
     headers_ = &headers;
-    auto status =
-        dynamicLib_->moeOnHttpHeader(req_, end_stream ? 1 : 0, headers.size(), headers.byteSize());
-    return static_cast<GolangStatus>(status);
+    auto start = state.getDispatcher().timeSource().monotonicTime();
+    auto cpu_start = threadCpuTime();
+    auto status = static_cast<GolangStatus>(
+        dynamicLib_->moeOnHttpHeader(req_, end_stream ? 1 : 0, headers.size(), headers.byteSize()));
+    onGoReturn(state, start, cpu_start, status);
+    return status;
 
   } catch (const EnvoyException& e) {
     ENVOY_LOG(error, "golang filter doHeadersGo catch: {}.", e.what());
@@ -309,6 +459,9 @@ bool Filter::doHeaders(ProcessorState& state, Http::RequestOrResponseHeaderMap&
 
   state.processHeader(end_stream);
   auto status = doHeadersGo(state, headers, end_stream);
+  if (decision_ != nullptr) {
+    finishDecision(status);
+  }
   auto done = state.handleHeaderGolangStatus(status);
   if (done) {
     headers_ = nullptr;
@@ -316,6 +469,42 @@ bool Filter::doHeaders(ProcessorState& state, Http::RequestOrResponseHeaderMap&
   return done;
 }
 
+bool Filter::isIdempotent(const Http::RequestHeaderMap& headers) {
+  const auto method = headers.getMethodValue();
+  const auto& methods = Http::Headers::get().MethodValues;
+  return method == methods.Get || method == methods.Head || method == methods.Options;
+}
+
+Http::FilterHeadersStatus Filter::doHeadersSpeculative(ProcessorState& state,
+                                                       Http::RequestHeaderMap& headers,
+                                                       bool end_stream) {
+  // Go reads a copy of the headers, since they're forwarded while Go is running.
+  speculative_headers_ = Http::createHeaderMap<Http::RequestHeaderMapImpl>(headers);
+
+  // NP: the decoding is done after the header phase, since the request body and trailers are
+  // not passed to Go.
+  state.processHeader(true);
+  auto status = doHeadersGo(state, *speculative_headers_, end_stream);
+  if (decision_ != nullptr) {
+    finishDecision(status);
+  }
+  if (status == GolangStatus::Running) {
+    ENVOY_LOG(debug, "golang filter forwards the request while Go is running");
+    speculative_pending_ = true;
+    return Http::FilterHeadersStatus::Continue;
+  }
+
+  if (status != GolangStatus::Continue && status != GolangStatus::LocalReply) {
+    ENVOY_LOG(error, "unexpected status in speculative mode: {}, continue", int(status));
+    status = GolangStatus::Continue;
+  }
+  auto done = state.handleHeaderGolangStatus(status);
+  if (done) {
+    headers_ = nullptr;
+  }
+  return done ? Http::FilterHeadersStatus::Continue : Http::FilterHeadersStatus::StopIteration;
+}
+
 bool Filter::doDataGo(ProcessorState& state, Buffer::Instance& data, bool end_stream) {
   ENVOY_LOG(debug, "golang filter passing data to golang, state: {}, phase: {}, end_stream: {}",
             state.stateStr(), state.phaseStr(), end_stream);
@@ -327,10 +516,13 @@ bool Filter::doDataGo(ProcessorState& state, Buffer::Instance& data, bool end_st
   try {
     ASSERT(req_ != nullptr);
     req_->phase = static_cast<int>(state.phase());
-    auto status = dynamicLib_->moeOnHttpData(req_, end_stream ? 1 : 0,
-                                             reinterpret_cast<uint64_t>(&buffer), buffer.length());
+    auto start = state.getDispatcher().timeSource().monotonicTime();
+    auto cpu_start = threadCpuTime();
+    auto status = static_cast<GolangStatus>(dynamicLib_->moeOnHttpData(
+        req_, end_stream ? 1 : 0, reinterpret_cast<uint64_t>(&buffer), buffer.length()));
+    onGoReturn(state, start, cpu_start, status);
 
-    return state.handleDataGolangStatus(static_cast<GolangStatus>(status));
+    return state.handleDataGolangStatus(status);
 
   } catch (const EnvoyException& e) {
     ENVOY_LOG(error, "golang filter decodeData catch: {}.", e.what());
@@ -393,8 +585,12 @@ bool Filter::doTrailerGo(ProcessorState& state, Http::HeaderMap& trailers) {
   try {
     ASSERT(req_ != nullptr);
     req_->phase = static_cast<int>(state.phase());
-    auto status = dynamicLib_->moeOnHttpHeader(req_, 1, trailers.size(), trailers.byteSize());
-    done = state.handleTrailerGolangStatus(static_cast<GolangStatus>(status));
+    auto start = state.getDispatcher().timeSource().monotonicTime();
+    auto cpu_start = threadCpuTime();
+    auto status = static_cast<GolangStatus>(
+        dynamicLib_->moeOnHttpHeader(req_, 1, trailers.size(), trailers.byteSize()));
+    onGoReturn(state, start, cpu_start, status);
+    done = state.handleTrailerGolangStatus(status);
 
   } catch (const EnvoyException& e) {
     ENVOY_LOG(error, "golang filter doTrailer catch: {}.", e.what());
@@ -449,6 +645,255 @@ bool Filter::doTrailer(ProcessorState& state, Http::HeaderMap& trailers) {
   return done;
 }
 
+/*** CPU budget ***/
+
+bool Filter::shedByCpuBudget(Http::FilterHeadersStatus& status) {
+  auto budget = config_->cpuBudget();
+  if (budget == nullptr ||
+      !budget->exceeded(decoding_state_.getDispatcher().timeSource().monotonicTime())) {
+    return false;
+  }
+
+  auto reply_status = config_->cpuBudgetReplyStatus();
+  if (reply_status == 0) {
+    // NP: the stream ids are sequential, so it samples the percent of the new streams.
+    if (stream_id_ % 100 >= config_->cpuBudgetBypassPercent()) {
+      return false;
+    }
+    ENVOY_LOG(debug, "golang filter is over the CPU budget, bypass the go plugin");
+    config_->stats().cpu_budget_bypassed_.inc();
+    bypass_go_ = true;
+    status = Http::FilterHeadersStatus::Continue;
+    return true;
+  }
+
+  ENVOY_LOG(debug, "golang filter is over the CPU budget, reply {}", reply_status);
+  config_->stats().cpu_budget_rejected_.inc();
+  bypass_go_ = true;
+  decoding_state_.sendLocalReply(static_cast<Http::Code>(reply_status),
+                                 "golang filter is over the CPU budget\r\n", nullptr,
+                                 Grpc::Status::WellKnownGrpcStatus::Unavailable,
+                                 "golang_cpu_budget_exceeded");
+  status = Http::FilterHeadersStatus::StopIteration;
+  return true;
+}
+
+/*** time spent in Go ***/
+
+void Filter::onGoReturn(ProcessorState& state, MonotonicTime start,
+                        std::chrono::nanoseconds cpu_start, GolangStatus status) {
+  auto cpu_time = threadCpuTime() - cpu_start;
+  cpu_time_ += cpu_time;
+  auto now = state.getDispatcher().timeSource().monotonicTime();
+  auto budget = config_->cpuBudget();
+  if (budget != nullptr) {
+    budget->charge(now, cpu_time);
+  }
+  auto sync_time = std::chrono::duration_cast<std::chrono::microseconds>(now - start);
+  auto phase = state.phase();
+  crossings_++;
+  config_->stats().crossings_.inc();
+  config_->phaseHistograms(phase).sync_time_->recordValue(sync_time.count());
+
+  if (status == GolangStatus::Running) {
+    running_since_ = now;
+    running_phase_ = phase;
+    running_sync_time_ = sync_time;
+    startGoSpan(state);
+    return;
+  }
+  req_->goroutineDelay = 0;
+  recordGoTime(phase, sync_time);
+  {
+    // the batch flushed in the sync phase has no span, it's dropped.
+    std::lock_guard<std::mutex> lock(mutex_);
+    span_batch_.clear();
+  }
+}
+
+void Filter::onGoContinue(MonotonicTime handoff, int64_t goroutine_delay, GolangStatus status) {
+  if (!running_since_.has_value()) {
+    // Go continued in the sync phase.
+    return;
+  }
+  auto now = decoding_state_.getDispatcher().timeSource().monotonicTime();
+  auto since = running_since_.value();
+  running_since_.reset();
+  auto micros = [](MonotonicTime::duration d) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+  };
+
+  // NP: Go may continue before the worker sees Running.
+  handoff = std::clamp(handoff, since, now);
+  auto& stats = config_->stats();
+  // the goroutine runs in the Go threads, its CPU time is not counted in cpu_time_us, nor charged
+  // to the CPU budget.
+  stats.async_cpu_time_unknown_.inc();
+  stats.async_dispatch_lag_.recordValue(micros(now - handoff));
+  if (goroutine_delay > 0) {
+    // the delay is since calling into Go, which is the sync time before returning Running.
+    auto start = std::clamp(since - running_sync_time_ + std::chrono::nanoseconds(goroutine_delay),
+                            since, handoff);
+    stats.async_schedule_lag_.recordValue(micros(start - since));
+    stats.async_work_time_.recordValue(micros(handoff - start));
+  } else {
+    stats.async_work_time_.recordValue(micros(handoff - since));
+  }
+
+  auto async_time = std::chrono::duration_cast<std::chrono::microseconds>(now - since);
+  config_->phaseHistograms(running_phase_).async_time_->recordValue(async_time.count());
+  recordGoTime(running_phase_, running_sync_time_ + async_time);
+
+  auto threshold = config_->slowAsyncThreshold();
+  if (threshold.count() > 0 && async_time >= threshold) {
+    dumpSlowAsync(async_time);
+  }
+  finishGoSpan(statusName(status));
+}
+
+void Filter::startGoSpan(ProcessorState& state) {
+  // NP: it's a null span when tracing is not enabled.
+  go_span_ = state.getFilterCallbacks()->activeSpan().spawnChild(
+      Tracing::EgressConfig::get(),
+      absl::StrCat("golang ", config_->plugin_name(), " ", state.phaseStr()),
+      state.getDispatcher().timeSource().systemTime());
+  go_span_->setTag("golang.plugin", config_->plugin_name());
+  go_span_->setTag("golang.phase", state.phaseStr());
+}
+
+void Filter::finishGoSpan(absl::string_view status) {
+  if (go_span_ == nullptr) {
+    return;
+  }
+  std::string batch;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    batch.swap(span_batch_);
+  }
+  if (!applySpanBatch(*go_span_, batch)) {
+    ENVOY_LOG(error, "golang filter invalid span batch, plugin: {}", config_->plugin_name());
+  }
+  go_span_->setTag("golang.status", status);
+  go_span_->finishSpan();
+  go_span_.reset();
+}
+
+namespace {
+
+// reads the span batch of Go, the fields are length prefixed, in little endian:
+//   't', key, value
+//   's', name, start unix ns (8 bytes), end unix ns (8 bytes), number of tags (4 bytes),
+//        key, value, ...
+// the strings are a 4 bytes length followed by the bytes.
+class SpanBatchReader {
+public:
+  explicit SpanBatchReader(absl::string_view batch) : batch_(batch) {}
+
+  bool done() const { return batch_.empty(); }
+
+  bool readKind(char& kind) {
+    if (batch_.empty()) {
+      return false;
+    }
+    kind = batch_[0];
+    batch_.remove_prefix(1);
+    return true;
+  }
+
+  bool readInt(uint64_t& value, size_t size) {
+    if (batch_.size() < size) {
+      return false;
+    }
+    value = 0;
+    for (size_t i = 0; i < size; i++) {
+      value |= uint64_t(static_cast<uint8_t>(batch_[i])) << (i * 8);
+    }
+    batch_.remove_prefix(size);
+    return true;
+  }
+
+  bool readString(absl::string_view& value) {
+    uint64_t len;
+    if (!readInt(len, 4) || batch_.size() < len) {
+      return false;
+    }
+    value = batch_.substr(0, len);
+    batch_.remove_prefix(len);
+    return true;
+  }
+
+private:
+  absl::string_view batch_;
+};
+
+} // namespace
+
+bool Filter::applySpanBatch(Tracing::Span& span, absl::string_view batch) {
+  SpanBatchReader reader(batch);
+  while (!reader.done()) {
+    char kind;
+    absl::string_view name, key, value;
+    uint64_t start_ns, end_ns, tags;
+    if (!reader.readKind(kind)) {
+      return false;
+    }
+    if (kind == 't') {
+      if (!reader.readString(key) || !reader.readString(value)) {
+        return false;
+      }
+      span.setTag(key, value);
+      continue;
+    }
+    if (kind != 's' || !reader.readString(name) || !reader.readInt(start_ns, 8) ||
+        !reader.readInt(end_ns, 8) || !reader.readInt(tags, 4)) {
+      return false;
+    }
+    // NP: the span can not be finished at the end time in Envoy, so the duration is a tag.
+    auto child = span.spawnChild(Tracing::EgressConfig::get(), std::string(name),
+                                 SystemTime(std::chrono::duration_cast<SystemTime::duration>(
+                                     std::chrono::nanoseconds(start_ns))));
+    bool valid = true;
+    for (uint64_t i = 0; i < tags; i++) {
+      if (!reader.readString(key) || !reader.readString(value)) {
+        valid = false;
+        break;
+      }
+      child->setTag(key, value);
+    }
+    child->setTag("golang.duration_us",
+                  std::to_string((static_cast<int64_t>(end_ns - start_ns)) / 1000));
+    child->finishSpan();
+    if (!valid) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void Filter::dumpSlowAsync(std::chrono::microseconds async_time) {
+  auto buffered = [](ProcessorState& state) -> uint64_t {
+    return state.isBufferDataEmpty() ? 0 : state.getBufferData().length();
+  };
+  ENVOY_LOG(debug,
+            "golang filter slow async phase, plugin: {}, stream: {}, phase: {}, async time: {}us, "
+            "decoding state: {}, phase: {}, buffered: {}, encoding state: {}, phase: {}, "
+            "buffered: {}, crossings: {}, waiting sema: {}, speculative pending: {}",
+            config_->plugin_name(), stream_id_, static_cast<int>(running_phase_),
+            async_time.count(), decoding_state_.stateStr(), decoding_state_.phaseStr(),
+            buffered(decoding_state_), encoding_state_.stateStr(), encoding_state_.phaseStr(),
+            buffered(encoding_state_), crossings_, req_ != nullptr ? req_->waitSema : 0,
+            speculative_pending_);
+}
+
+void Filter::recordGoTime(Phase phase, std::chrono::microseconds go_time) {
+  config_->phaseHistograms(phase).go_time_->recordValue(go_time.count());
+  if (phase <= Phase::DecodeTrailer) {
+    cost_time_decode_ += go_time.count();
+  } else {
+    cost_time_encode_ += go_time.count();
+  }
+}
+
 /*** APIs for go call C ***/
 
 void Filter::continueEncodeLocalReply(ProcessorState& state) {
@@ -478,7 +923,44 @@ void Filter::continueEncodeLocalReply(ProcessorState& state) {
   continueStatusInternal(status);
 }
 
+void Filter::continueSpeculative(GolangStatus status) {
+  ENVOY_LOG(debug, "golang filter speculative request passed, response held: {}",
+            held_headers_ != nullptr);
+
+  if (status != GolangStatus::Continue) {
+    ENVOY_LOG(error, "unexpected status in speculative mode: {}, continue", int(status));
+  }
+  // the request is forwarded already.
+  speculative_pending_ = false;
+  decoding_state_.handleHeaderGolangStatus(GolangStatus::Continue);
+  headers_ = nullptr;
+
+  if (held_headers_ == nullptr) {
+    return;
+  }
+  auto& headers = *held_headers_;
+  held_headers_ = nullptr;
+
+  enter_encoding_ = true;
+  if (doHeaders(encoding_state_, headers, encoding_state_.getEndStream())) {
+    encoding_state_.continueProcessing();
+  }
+}
+
 void Filter::continueStatusInternal(GolangStatus status) {
+  GOLANG_PROBE3(continue_status, stream_id_, static_cast<int>(getProcessorState().phase()),
+                static_cast<int>(status));
+  if (decision_ != nullptr) {
+    // the async verdict of the decode header phase, it's not cached when another filter sent a
+    // local reply meanwhile.
+    finishDecision(local_reply_waiting_go_ ? GolangStatus::StopNoBuffer : status);
+  }
+
+  if (speculative_pending_) {
+    continueSpeculative(status);
+    return;
+  }
+
   ProcessorState& state = getProcessorState();
   ASSERT(state.isThreadSafe());
   auto saved_state = state.state();
@@ -545,14 +1027,37 @@ void Filter::continueStatusInternal(GolangStatus status) {
   }
 }
 
-void Filter::sendLocalReplyInternal(
-    Http::Code response_code, absl::string_view body_text,
-    std::function<void(Http::ResponseHeaderMap& headers)> modify_headers,
-    Grpc::Status::GrpcStatus grpc_status, absl::string_view details) {
+void Filter::sendLocalReplyInternal(Http::Code response_code, absl::string_view body_text,
+                                    const LocalReplyHeaders& headers,
+                                    Grpc::Status::GrpcStatus grpc_status,
+                                    absl::string_view details) {
   ENVOY_LOG(debug, "sendLocalReply Internal, response code: {}", int(response_code));
 
   ProcessorState& state = getProcessorState();
 
+  if (decision_ != nullptr) {
+    if (!local_reply_waiting_go_) {
+      decision_->local_reply_ = true;
+      decision_->response_code_ = response_code;
+      decision_->body_text_ = std::string(body_text);
+      decision_->reply_headers_ = headers;
+      decision_->grpc_status_ = grpc_status;
+      decision_->details_ = std::string(details);
+      finishDecision(GolangStatus::Continue);
+    } else {
+      finishDecision(GolangStatus::StopNoBuffer);
+    }
+  }
+
+  if (speculative_pending_) {
+    // NP: the held response headers are replaced by the local reply, and the upstream request is
+    // reset when the stream is finished.
+    ENVOY_LOG(debug, "golang filter rejects the speculative request, response held: {}",
+              held_headers_ != nullptr);
+    speculative_pending_ = false;
+    held_headers_ = nullptr;
+  }
+
   if (local_reply_waiting_go_) {
     ENVOY_LOG(warn,
               "other filter already invoked sendLocalReply or encodeHeaders, ignoring the local "
@@ -569,12 +1074,13 @@ void Filter::sendLocalReplyInternal(
   // drain buffer data if it's not empty, before sendLocalReply
   state.drainBufferData();
 
-  state.sendLocalReply(response_code, body_text, modify_headers, grpc_status, details);
+  state.sendLocalReply(response_code, body_text, modifyReplyHeaders(headers), grpc_status,
+                       details);
 }
 
 int Filter::sendLocalReply(Http::Code response_code, absl::string_view body_text,
-                           std::function<void(Http::ResponseHeaderMap& headers)> modify_headers,
-                           Grpc::Status::GrpcStatus grpc_status, absl::string_view details) {
+                           LocalReplyHeaders headers, Grpc::Status::GrpcStatus grpc_status,
+                           absl::string_view details) {
   std::lock_guard<std::mutex> lock(mutex_);
   if (has_destroyed_) {
     ENVOY_LOG(warn, "golang filter has been destroyed");
@@ -587,13 +1093,19 @@ int Filter::sendLocalReply(Http::Code response_code, absl::string_view body_text
 
   ENVOY_LOG(debug, "sendLocalReply, response code: {}, body: {}", int(response_code), body_text);
 
+  auto handoff = state.getDispatcher().timeSource().monotonicTime();
+  auto goroutine_delay = req_->goroutineDelay;
+  req_->goroutineDelay = 0;
   auto weak_ptr = weak_from_this();
   state.getDispatcher().post(
-      [this, &state, weak_ptr, response_code, body_text, modify_headers, grpc_status, details] {
+      [this, &state, weak_ptr, response_code, body_text, headers = std::move(headers),
+       grpc_status, details, handoff, goroutine_delay] {
         ASSERT(state.isThreadSafe());
         // do not need lock here, since it's the work thread now.
         if (!weak_ptr.expired() && !has_destroyed_) {
-          sendLocalReplyInternal(response_code, body_text, modify_headers, grpc_status, details);
+          // the async Go finished the phase by the local reply.
+          onGoContinue(handoff, goroutine_delay, GolangStatus::LocalReply);
+          sendLocalReplyInternal(response_code, body_text, headers, grpc_status, details);
         } else {
           ENVOY_LOG(info, "golang filter has gone or destroyed in sendLocalReply");
         }
@@ -614,13 +1126,18 @@ int Filter::continueStatus(GolangStatus status) {
   ENVOY_LOG(debug, "golang filter continue from Go, status: {}, state: {}, phase: {}", int(status),
             state.stateStr(), state.phaseStr());
 
+  // the time that Go handed off the continue to the worker, and the goroutine started.
+  auto handoff = state.getDispatcher().timeSource().monotonicTime();
+  auto goroutine_delay = req_->goroutineDelay;
+  req_->goroutineDelay = 0;
   auto weak_ptr = weak_from_this();
   // TODO: skip post event to dispatcher, and return continue in the caller,
   // when it's invoked in the current envoy thread, for better performance & latency.
-  state.getDispatcher().post([this, &state, weak_ptr, status] {
+  state.getDispatcher().post([this, &state, weak_ptr, status, handoff, goroutine_delay] {
     ASSERT(state.isThreadSafe());
     // do not need lock here, since it's the work thread now.
     if (!weak_ptr.expired() && !has_destroyed_) {
+      onGoContinue(handoff, goroutine_delay, status);
       continueStatusInternal(status);
     } else {
       ENVOY_LOG(info, "golang filter has gone or destroyed in continueStatus event");
@@ -706,14 +1223,20 @@ int Filter::setHeader(absl::string_view key, absl::string_view value, headerActi
   if (headers_ == nullptr) {
     return CAPIInvalidPhase;
   }
+  // the request headers are forwarded already in the speculative mode.
+  if (speculative_headers_ != nullptr && headers_ == speculative_headers_.get()) {
+    return CAPIInvalidPhase;
+  }
 
   switch (act) {
   case HeaderAdd:
     headers_->addCopy(Http::LowerCaseString(key), value);
+    recordHeaderMutation(DecisionCache::HeaderMutation::Action::Add, key, value);
     break;
 
   case HeaderSet:
     headers_->setCopy(Http::LowerCaseString(key), value);
+    recordHeaderMutation(DecisionCache::HeaderMutation::Action::Set, key, value);
     break;
 
   default:
@@ -735,7 +1258,11 @@ int Filter::removeHeader(absl::string_view key) {
   if (headers_ == nullptr) {
     return CAPIInvalidPhase;
   }
+  if (speculative_headers_ != nullptr && headers_ == speculative_headers_.get()) {
+    return CAPIInvalidPhase;
+  }
   headers_->remove(Http::LowerCaseString(key));
+  recordHeaderMutation(DecisionCache::HeaderMutation::Action::Remove, key, "");
   return CAPIOK;
 }
 
@@ -823,17 +1350,18 @@ int Filter::getStringValue(int id, GoString* valueStr) {
   if (!state.isProcessingInGo()) {
     return CAPINotInGo;
   }
+  absl::string_view value;
   switch (static_cast<StringValue>(id)) {
   case StringValue::RouteName:
-    // string will copy to req->strValue, but not deep copy
-    req_->strValue = state.streamInfo().getRouteName();
+    // copy into the request arena, it's stable until the request is finalized in Go.
+    value = req_->arena_.copy(state.streamInfo().getRouteName());
     break;
   default:
     ASSERT(false, "invalid string value id");
   }
 
-  valueStr->p = req_->strValue.data();
-  valueStr->n = req_->strValue.length();
+  valueStr->p = value.data();
+  valueStr->n = value.length();
   return CAPIOK;
 }
 
@@ -848,16 +1376,21 @@ int Filter::getDynamicMetadata(std::string filter_name, GoSlice* bufSlice) {
   }
   if (!state.isThreadSafe()) {
     auto weak_ptr = weak_from_this();
-    // mark it is waiting sema, it will be used in OnDestroy in Go side.
-    // Go will resume the sema when Go is On Destroy and waitSema = 1.
-    req_->waitSema = 1;
-    ENVOY_LOG(info, "golang filter getDynamicMetadata will go to async mode");
+    // count the waiting sema, it will be used in OnDestroy in Go side.
+    // Go will resume the sema for each pending getter when Go is On Destroy.
+    req_->waitSema++;
+    config_->stats().sema_waiters_.inc();
+    ENVOY_LOG(debug, "golang filter getDynamicMetadata will go to async mode");
     state.getDispatcher().post([this, &state, weak_ptr, filter_name, bufSlice] {
-      ENVOY_LOG(info, "golang filter getDynamicMetadata entering async mode");
-      // do not need lock here, since it's the work thread now.
+      ENVOY_LOG(debug, "golang filter getDynamicMetadata entering async mode");
       if (!weak_ptr.expired() && !has_destroyed_) {
         ASSERT(state.isThreadSafe());
-        req_->waitSema = 0;
+        {
+          // other getters may increase waitSema concurrently from Go threads.
+          std::lock_guard<std::mutex> lock(mutex_);
+          req_->waitSema--;
+          config_->stats().sema_waiters_.dec();
+        }
         getDynamicMetadataAsync(filter_name, bufSlice);
       } else {
         ENVOY_LOG(info, "golang filter has gone or destroyed in getDynamicMetadata");
@@ -874,10 +1407,7 @@ int Filter::getDynamicMetadata(std::string filter_name, GoSlice* bufSlice) {
     return CAPIOK;
   }
 
-  filter_it->second.SerializeToString(&req_->strValue);
-  bufSlice->data = req_->strValue.data();
-  bufSlice->len = req_->strValue.length();
-  bufSlice->cap = req_->strValue.length();
+  serializeToGoSlice(filter_it->second, bufSlice);
 
   return CAPIOK;
 }
@@ -887,13 +1417,21 @@ void Filter::getDynamicMetadataAsync(std::string filter_name, GoSlice* bufSlice)
   const auto& metadata = state.streamInfo().dynamicMetadata().filter_metadata();
   const auto filter_it = metadata.find(filter_name);
   if (filter_it != metadata.end()) {
-    filter_it->second.SerializeToString(&req_->strValue);
-    bufSlice->data = req_->strValue.data();
-    bufSlice->len = req_->strValue.length();
-    bufSlice->cap = req_->strValue.length();
+    serializeToGoSlice(filter_it->second, bufSlice);
   }
-  ENVOY_LOG(info, "golang filter async callback getDynamicMetadata");
-  dynamicLib_->moeOnHttpSemaCallback(req_);
+  ENVOY_LOG(debug, "golang filter async callback getDynamicMetadata");
+  // the buf slice identifies the waiting getter in Go.
+  dynamicLib_->moeOnHttpSemaCallback(req_, bufSlice);
+}
+
+// serialize the message into the request arena directly, without an extra copy.
+void Filter::serializeToGoSlice(const Protobuf::Message& message, GoSlice* bufSlice) {
+  auto len = message.ByteSizeLong();
+  auto data = req_->arena_.allocate(len);
+  message.SerializeWithCachedSizesToArray(reinterpret_cast<uint8_t*>(data));
+  bufSlice->data = data;
+  bufSlice->len = len;
+  bufSlice->cap = len;
 }
 
 int Filter::setDynamicMetadata(std::string filter_name, std::string key, absl::string_view bufStr) {
@@ -937,125 +1475,736 @@ void Filter::setDynamicMetadataInternal(ProcessorState& state, std::string filte
   state.streamInfo().setDynamicMetadata(filter_name, value);
 }
 
+int Filter::cacheDecision(uint64_t ttl_ms) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (has_destroyed_) {
+    return CAPIFilterIsDestroy;
+  }
+  auto& state = getProcessorState();
+  if (!state.isProcessingInGo()) {
+    return CAPINotInGo;
+  }
+  if (state.phase() != Phase::DecodeHeader) {
+    return CAPIInvalidPhase;
+  }
+  if (decision_ == nullptr) {
+    // the decision cache is not configured, or the key is unknown.
+    return CAPIOK;
+  }
+  // the shortest one wins, when several plugins of a chain cache the decision.
+  if (ttl_ms > 0 && (decision_ttl_ms_ == 0 || ttl_ms < decision_ttl_ms_)) {
+    decision_ttl_ms_ = ttl_ms;
+  }
+  return CAPIOK;
+}
+
+int Filter::flushSpans(GoSlice* batch) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (has_destroyed_) {
+    return CAPIFilterIsDestroy;
+  }
+  auto& state = getProcessorState();
+  if (!state.isProcessingInGo()) {
+    return CAPINotInGo;
+  }
+  span_batch_.append(static_cast<const char*>(batch->data), batch->len);
+  return CAPIOK;
+}
+
+/*** decision cache ***/
+
+DecisionCache::DecisionConstSharedPtr Filter::lookupDecision(DecisionCache& cache,
+                                                             Http::RequestHeaderMap& headers) {
+  plugin_config_ = getMergedConfig(decoding_state_);
+  if (plugin_config_ == nullptr) {
+    return nullptr;
+  }
+
+  // NP: header values do not contain '\n', and every header starts with the number of its values,
+  // so the key is not ambiguous, i.e. a missing header differs from an empty one, and the values
+  // containing ',' differ from the multiple values.
+  std::string key = absl::StrCat(plugin_config_->configId());
+  for (const auto& name : config_->decisionKeyHeaders()) {
+    const auto values = headers.get(name);
+    absl::StrAppend(&key, "\n", values.size());
+    for (size_t i = 0; i < values.size(); i++) {
+      absl::StrAppend(&key, "\n", values[i]->value().getStringView());
+    }
+  }
+
+  auto decision = cache.lookup(key, decoding_state_.getDispatcher().timeSource().monotonicTime());
+  if (decision == nullptr) {
+    // record the verdict of Go.
+    decision_ = std::make_unique<DecisionCache::Decision>();
+    decision_key_ = std::move(key);
+  }
+  return decision;
+}
+
+Http::FilterHeadersStatus Filter::serveDecision(const DecisionCache::Decision& decision,
+                                                Http::RequestHeaderMap& headers) {
+  ENVOY_LOG(debug, "golang filter serves the cached decision, local reply: {}",
+            decision.local_reply_);
+  bypass_go_ = true;
+
+  if (decision.local_reply_) {
+    decoding_state_.sendLocalReply(decision.response_code_, decision.body_text_,
+                                   modifyReplyHeaders(decision.reply_headers_),
+                                   decision.grpc_status_, decision.details_);
+    return Http::FilterHeadersStatus::StopIteration;
+  }
+
+  for (const auto& mutation : decision.mutations_) {
+    switch (mutation.action_) {
+    case DecisionCache::HeaderMutation::Action::Set:
+      headers.setCopy(mutation.key_, mutation.value_);
+      break;
+    case DecisionCache::HeaderMutation::Action::Add:
+      headers.addCopy(mutation.key_, mutation.value_);
+      break;
+    case DecisionCache::HeaderMutation::Action::Remove:
+      headers.remove(mutation.key_);
+      break;
+    }
+  }
+  return Http::FilterHeadersStatus::Continue;
+}
+
+void Filter::recordHeaderMutation(DecisionCache::HeaderMutation::Action action,
+                                  absl::string_view key, absl::string_view value) {
+  // only the request header mutations of the decode header phase are recorded.
+  if (decision_ == nullptr || getProcessorState().phase() != Phase::DecodeHeader) {
+    return;
+  }
+  decision_->mutations_.push_back({action, Http::LowerCaseString(key), std::string(value)});
+}
+
+void Filter::finishDecision(GolangStatus status) {
+  if (status == GolangStatus::Running || status == GolangStatus::LocalReply) {
+    // the verdict is not decided yet, Go will continue or send the local reply later.
+    return;
+  }
+
+  auto decision = std::move(decision_);
+  auto ttl_ms = decision_ttl_ms_;
+  decision_ttl_ms_ = 0;
+  // only the final verdicts of the header phase are cached, i.e. not the ones waiting the body.
+  if (status != GolangStatus::Continue || ttl_ms == 0) {
+    return;
+  }
+  auto cache = config_->decisionCache();
+  if (cache == nullptr) {
+    return;
+  }
+  auto expire = decoding_state_.getDispatcher().timeSource().monotonicTime() +
+                std::chrono::milliseconds(ttl_ms);
+  cache->insert(decision_key_, std::move(decision), expire);
+}
+
+/*** DecisionCache ***/
+
+DecisionCache::DecisionConstSharedPtr DecisionCache::lookup(const std::string& key,
+                                                            MonotonicTime now) {
+  auto it = index_.find(key);
+  if (it == index_.end()) {
+    stats_.decision_cache_miss_.inc();
+    return nullptr;
+  }
+  auto entry = it->second;
+  if (entry->expire_ <= now) {
+    stats_.decision_cache_expired_.inc();
+    stats_.decision_cache_miss_.inc();
+    index_.erase(it);
+    entries_.erase(entry);
+    return nullptr;
+  }
+  stats_.decision_cache_hit_.inc();
+  entries_.splice(entries_.begin(), entries_, entry);
+  return entry->decision_;
+}
+
+void DecisionCache::insert(const std::string& key, DecisionConstSharedPtr decision,
+                           MonotonicTime expire) {
+  stats_.decision_cache_insert_.inc();
+  auto it = index_.find(key);
+  if (it != index_.end()) {
+    // the concurrent streams of the same key may both miss, the later one wins.
+    it->second->expire_ = expire;
+    it->second->decision_ = std::move(decision);
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return;
+  }
+  if (entries_.size() >= max_entries_) {
+    stats_.decision_cache_eviction_.inc();
+    index_.erase(entries_.back().key_);
+    entries_.pop_back();
+  }
+  entries_.push_front({key, expire, std::move(decision)});
+  index_.emplace(key, entries_.begin());
+}
+
+void DecisionCache::clear() {
+  index_.clear();
+  entries_.clear();
+}
+
 /* ConfigId */
 
-uint64_t Filter::getMergedConfigId(ProcessorState& state) {
-  Http::StreamFilterCallbacks* callbacks = state.getFilterCallbacks();
+const PluginConfigHandle* Filter::getMergedConfig(ProcessorState& state) {
+  auto worker_config = config_->workerConfig();
+  if (worker_config->pluginConfig() != nullptr && worker_config->dso().get() != dynamicLib_) {
+    // a new version of the dso is published after the stream created, nothing is called into
+    // the pinned one yet, so switch to the new version, and move the stream count along, since
+    // the destructor decrements the pinned one.
+    if (dynamicLib_ != nullptr) {
+      dynamicLib_->streamDestroyed();
+    }
+    worker_config_ = std::move(worker_config);
+    dynamicLib_ = worker_config_->dso().get();
+    if (dynamicLib_ != nullptr) {
+      dynamicLib_->streamCreated();
+    }
+  }
+  if (worker_config_ == nullptr) {
+    return nullptr;
+  }
+
+  const auto& filter_config = worker_config_->pluginConfig();
+  const auto* route_config =
+      Http::Utility::resolveMostSpecificPerFilterConfig<FilterConfigPerRoute>(
+          state.getFilterCallbacks());
+  if (route_config == nullptr) {
+    return filter_config.get();
+  }
+  return route_config->getMergedConfig(*config_, filter_config, worker_config_->dso(),
+                                       state.getFilterCallbacks());
+}
 
-  // get all of the per route config
-  std::list<const FilterConfigPerRoute*> route_config_list;
-  callbacks->traversePerFilterConfig(
-      [&route_config_list](const Router::RouteSpecificFilterConfig& cfg) {
-        route_config_list.push_back(dynamic_cast<const FilterConfigPerRoute*>(&cfg));
-      });
+/*** PluginConfigTable ***/
+
+std::mutex PluginConfigTable::mutex_ = {};
+absl::flat_hash_map<PluginConfigTable::Key, PluginConfigTable::Bucket>
+    PluginConfigTable::configs_ = {};
+
+PluginConfigHandle::~PluginConfigHandle() {
+  PluginConfigTable::release(dso_.get(), hash_);
+  dso_->moeDestroyHttpPluginConfig(config_id_);
+}
+
+PluginConfigHandleSharedPtr PluginConfigTable::newConfig(const Dso::DsoInstanceSharedPtr& dso,
+                                                         const std::string& plugin_name,
+                                                         const Protobuf::Any& plugin_config) {
+  // NP: plugin name is not empty, so it won't conflict with the merged ones.
+  // the serialized config is only kept in the key, the config is parsed from the tail of it.
+  auto key = absl::StrCat(plugin_name, "\n");
+  if (!plugin_config.AppendToString(&key)) {
+    ENVOY_LOG_MISC(error, "failed to serialize any pb to string");
+    return nullptr;
+  }
+  auto hash = HashUtil::xxHash64(key);
+  auto handle = find(dso, hash, key);
+  if (handle != nullptr) {
+    return handle;
+  }
+
+  // NP: parse it without the lock, the same config may be parsed twice when racing,
+  // then both are kept in the table, which is fine.
+  // the plugin name selects the plugin in the library, since one library may host many plugins.
+  auto name_ptr = reinterpret_cast<unsigned long long>(plugin_name.data());
+  auto name_len = plugin_name.length();
+  auto ptr = reinterpret_cast<unsigned long long>(key.data() + name_len + 1);
+  auto len = key.length() - name_len - 1;
+  auto config_id = dso->moeNewHttpPluginConfig(name_ptr, name_len, ptr, len);
+  if (config_id == 0) {
+    ENVOY_LOG_MISC(error, "invalid golang plugin config");
+    return nullptr;
+  }
+  return insert(dso, hash, std::move(key), config_id);
+}
+
+PluginConfigHandleSharedPtr PluginConfigTable::mergeConfig(const Dso::DsoInstanceSharedPtr& dso,
+                                                           const PluginConfigHandle& parent,
+                                                           const PluginConfigHandle& child) {
+  // config ids are never reused in Go, so they identify the parsed configs.
+  auto key = absl::StrCat("\n", parent.configId(), "+", child.configId());
+  auto hash = HashUtil::xxHash64(key);
+  auto handle = find(dso, hash, key);
+  if (handle != nullptr) {
+    return handle;
+  }
+
+  auto config_id = dso->moeMergeHttpPluginConfig(parent.configId(), child.configId());
+  ENVOY_LOG_MISC(debug, "golang filter merge plugin config, from {} + {} to {}",
+                 parent.configId(), child.configId(), config_id);
+  if (config_id == 0) {
+    ENVOY_LOG_MISC(error, "invalid golang plugin config");
+    return nullptr;
+  }
+  return insert(dso, hash, std::move(key), config_id);
+}
+
+size_t PluginConfigTable::size() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t size = 0;
+  for (const auto& it : configs_) {
+    size += it.second.size();
+  }
+  return size;
+}
+
+PluginConfigHandleSharedPtr PluginConfigTable::find(const Dso::DsoInstanceSharedPtr& dso,
+                                                    uint64_t hash, absl::string_view key) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = configs_.find(Key{dso.get(), hash});
+  if (it == configs_.end()) {
+    return nullptr;
+  }
+  for (const auto& weak : it->second) {
+    auto handle = weak.lock();
+    // NP: the hash may collide, compare the bytes.
+    if (handle != nullptr && handle->key_ == key) {
+      return handle;
+    }
+  }
+  return nullptr;
+}
+
+PluginConfigHandleSharedPtr PluginConfigTable::insert(const Dso::DsoInstanceSharedPtr& dso,
+                                                      uint64_t hash, std::string key,
+                                                      uint64_t config_id) {
+  auto handle = std::make_shared<const PluginConfigHandle>(dso, config_id, hash, std::move(key));
+  std::lock_guard<std::mutex> lock(mutex_);
+  configs_[Key{dso.get(), hash}].push_back(handle);
+  return handle;
+}
+
+void PluginConfigTable::release(const Dso::DsoInstance* dso, uint64_t hash) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = configs_.find(Key{dso, hash});
+  if (it == configs_.end()) {
+    return;
+  }
+  // the released one has expired, the others of the bucket may still be alive.
+  auto& bucket = it->second;
+  bucket.erase(std::remove_if(bucket.begin(), bucket.end(),
+                              [](const auto& weak) { return weak.expired(); }),
+               bucket.end());
+  if (bucket.empty()) {
+    configs_.erase(it);
+  }
+}
+
+/*** PluginBindings ***/
 
-  ENVOY_LOG(info, "golang filter route config list length: {}.", route_config_list.size());
+std::mutex PluginBindings::mutex_ = {};
+std::map<std::string, PluginBindings::Binding> PluginBindings::bindings_ = {};
 
-  auto id = config_->getConfigId();
-  for (auto it = route_config_list.cbegin(); it != route_config_list.cend(); ++it) {
-    auto route_config = *it;
-    id = route_config->getPluginConfigId(id, config_->plugin_name(), config_->so_id());
+void PluginBindings::bind(const std::string& plugin_name, const std::string& so_id,
+                          const Dso::DsoInstanceSharedPtr& dso) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto& binding = bindings_[plugin_name];
+  auto it = binding.dsos_.find(so_id);
+  if (it != binding.dsos_.end() && it->second == dso) {
+    return;
   }
+  binding.dsos_[so_id] = dso;
+  binding.callbacks_.runCallbacks(so_id, dso);
+}
 
-  return id;
+Common::CallbackHandlePtr PluginBindings::watch(const std::string& plugin_name, BindCallback cb) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto& binding = bindings_[plugin_name];
+  for (const auto& it : binding.dsos_) {
+    cb(it.first, it.second);
+  }
+  return std::make_unique<Dso::LockedCallbackHandle>(mutex_, binding.callbacks_.add(cb));
 }
 
 /*** FilterConfig ***/
 
-FilterConfig::FilterConfig(const envoy::extensions::filters::http::golang::v3::Config& proto_config)
+FilterConfig::FilterConfig(const envoy::extensions::filters::http::golang::v3::Config& proto_config,
+                           const std::string& stats_prefix, Stats::Scope& scope)
     : plugin_name_(proto_config.plugin_name()), so_id_(proto_config.so_id()),
-      plugin_config_(proto_config.plugin_config()) {
+      plugin_config_(proto_config.plugin_config()), merge_policy_(proto_config.merge_policy()),
+      speculative_(proto_config.speculative()),
+      slow_async_threshold_(PROTOBUF_GET_MS_OR_DEFAULT(proto_config, slow_async_threshold, 0)),
+      decision_key_headers_(proto_config.decision_cache().key_headers().begin(),
+                            proto_config.decision_cache().key_headers().end()),
+      decision_cache_max_entries_(proto_config.decision_cache().max_entries() > 0
+                                      ? proto_config.decision_cache().max_entries()
+                                      : DefaultDecisionCacheMaxEntries),
+      cpu_budget_window_(proto_config.has_cpu_budget()
+                             ? PROTOBUF_GET_MS_OR_DEFAULT(proto_config.cpu_budget(), window,
+                                                          DefaultCpuBudgetWindowMs)
+                             : DefaultCpuBudgetWindowMs),
+      cpu_budget_max_percent_(proto_config.cpu_budget().max_percent()),
+      cpu_budget_bypass_percent_(proto_config.cpu_budget().bypass().percent()),
+      cpu_budget_reply_status_(proto_config.cpu_budget().local_reply().status()),
+      scope_(scope), stats_prefix_(absl::StrCat(stats_prefix, "golang.", plugin_name_, ".")),
+      stats_(generateStats(stats_prefix_, scope)),
+      phase_histograms_{{
+          {&stats_.decode_header_sync_time_, &stats_.decode_header_async_time_,
+           &stats_.decode_header_go_time_},
+          {&stats_.decode_data_sync_time_, &stats_.decode_data_async_time_,
+           &stats_.decode_data_go_time_},
+          {&stats_.decode_trailer_sync_time_, &stats_.decode_trailer_async_time_,
+           &stats_.decode_trailer_go_time_},
+          {&stats_.encode_header_sync_time_, &stats_.encode_header_async_time_,
+           &stats_.encode_header_go_time_},
+          {&stats_.encode_data_sync_time_, &stats_.encode_data_async_time_,
+           &stats_.encode_data_go_time_},
+          {&stats_.encode_trailer_sync_time_, &stats_.encode_trailer_async_time_,
+           &stats_.encode_trailer_go_time_},
+      }},
+      route_stat_names_(scope.symbolTable()) {
   ENVOY_LOG(info, "initilizing golang filter config");
-  // NP: dso may not loaded yet, can not invoke moeNewHttpPluginConfig yet.
-};
 
-uint64_t FilterConfig::getConfigId() {
-  if (config_id_ != 0) {
-    return config_id_;
+  // parse the plugin config now when the dso is already published, i.e. listener updates,
+  // otherwise, it's deferred to the time of publishing the dso.
+  auto dso = Dso::DsoInstanceManager::getDsoInstanceByID(so_id_);
+  if (dso != nullptr) {
+    newGoPluginConfig(dso);
+  }
+  // also parse it again when a new version of the dso is published.
+  pub_handle_ = Dso::DsoInstanceManager::addPubCallback(
+      [this](const std::string& so_id, const Dso::DsoInstanceSharedPtr& dso) {
+        if (so_id == so_id_) {
+          newGoPluginConfig(dso);
+        }
+      });
+}
+
+FilterConfig::FilterConfig(const envoy::extensions::filters::http::golang::v3::Config& proto_config,
+                           const std::string& stats_prefix, Stats::Scope& scope,
+                           ThreadLocal::SlotAllocator& tls)
+    : FilterConfig(proto_config, stats_prefix, scope) {
+  tls_slot_ = ThreadLocal::TypedSlot<ThreadLocalPluginConfig>::makeUnique(tls);
+  tls_slot_->set([this, worker_config = workerConfig()](Event::Dispatcher&) {
+    // copied in the worker, so the reference counting of the streams stays in the worker.
+    auto obj = std::make_shared<ThreadLocalPluginConfig>(
+        std::make_shared<const WorkerPluginConfig>(*worker_config));
+    if (!decision_key_headers_.empty()) {
+      // per worker, so it's lock free.
+      obj->decision_cache_ = std::make_unique<DecisionCache>(decision_cache_max_entries_, stats_);
+    }
+    if (cpu_budget_max_percent_ > 0) {
+      obj->cpu_budget_ = std::make_unique<CpuBudget>(cpu_budget_window_, cpu_budget_max_percent_);
+    }
+    return obj;
+  });
+}
+
+GolangFilterStats FilterConfig::generateStats(const std::string& prefix, Stats::Scope& scope) {
+  return GolangFilterStats{ALL_GOLANG_FILTER_STATS(POOL_COUNTER_PREFIX(scope, prefix),
+                                                   POOL_GAUGE_PREFIX(scope, prefix),
+                                                   POOL_HISTOGRAM_PREFIX(scope, prefix))};
+}
+
+WorkerPluginConfigSharedPtr FilterConfig::workerConfig() const {
+  if (tls_slot_ != nullptr && tls_slot_->currentThreadRegistered()) {
+    return (*tls_slot_)->worker_config_;
   }
-  auto dlib = Dso::DsoInstanceManager::getDsoInstanceByID(so_id_);
-  if (dlib == NULL) {
-    ENVOY_LOG(error, "golang extension filter dynamicLib is nullPtr.");
-    return 0;
+  return std::atomic_load(&worker_config_);
+}
+
+DecisionCache* FilterConfig::decisionCache() const {
+  if (tls_slot_ != nullptr && tls_slot_->currentThreadRegistered()) {
+    return (*tls_slot_)->decision_cache_.get();
+  }
+  return nullptr;
+}
+
+CpuBudget* FilterConfig::cpuBudget() const {
+  if (tls_slot_ != nullptr && tls_slot_->currentThreadRegistered()) {
+    return (*tls_slot_)->cpu_budget_.get();
   }
+  return nullptr;
+}
 
-  std::string str;
-  if (!plugin_config_.SerializeToString(&str)) {
-    ENVOY_LOG(error, "failed to serialize any pb to string");
-    return 0;
+Stats::Counter& FilterConfig::routeCpuTimeCounter(const std::string& route_name) {
+  // the per worker cache, the lock is only taken for the first stream of the route.
+  absl::flat_hash_map<std::string, Stats::Counter*>* cache = nullptr;
+  if (tls_slot_ != nullptr && tls_slot_->currentThreadRegistered()) {
+    cache = &(*tls_slot_)->route_cpu_time_;
+    auto it = cache->find(route_name);
+    if (it != cache->end()) {
+      return *it->second;
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(route_cpu_time_mutex_);
+  auto it = route_cpu_time_.find(route_name);
+  if (it == route_cpu_time_.end()) {
+    auto counter = [this](absl::string_view name) {
+      return &scope_.counterFromStatName(
+          route_stat_names_.add(absl::StrCat(stats_prefix_, "route.", name, ".cpu_time_us")));
+    };
+    if (route_cpu_time_.size() >= MaxRouteCpuTimeCounters) {
+      // NP: the routes beyond the limit share the "other" one, they're not cached, so the memory
+      // is bounded, and the rare overflowed routes take the lock.
+      if (route_cpu_time_other_ == nullptr) {
+        route_cpu_time_other_ = counter("other");
+      }
+      return *route_cpu_time_other_;
+    }
+    it = route_cpu_time_.emplace(route_name, counter(routeStatName(route_name))).first;
   }
-  auto ptr = reinterpret_cast<unsigned long long>(str.data());
-  auto len = str.length();
-  config_id_ = dlib->moeNewHttpPluginConfig(ptr, len);
-  if (config_id_ == 0) {
-    ENVOY_LOG(error, "invalid golang plugin config");
+  if (cache != nullptr) {
+    cache->emplace(route_name, it->second);
   }
-  return config_id_;
+  return *it->second;
 }
 
+void FilterConfig::newGoPluginConfig(const Dso::DsoInstanceSharedPtr& dso) {
+  auto plugin_config = PluginConfigTable::newConfig(dso, plugin_name_, plugin_config_);
+  ENVOY_LOG(debug, "golang filter new plugin config, id: {}",
+            plugin_config != nullptr ? plugin_config->configId() : 0);
+  auto worker_config = std::make_shared<const WorkerPluginConfig>(std::move(plugin_config), dso);
+  std::atomic_store(&worker_config_, worker_config);
+  if (tls_slot_ != nullptr) {
+    // the in-flight streams keep the old one, the new streams get the new one.
+    tls_slot_->runOnAllThreads([worker_config](OptRef<ThreadLocalPluginConfig> obj) {
+      if (obj.has_value()) {
+        obj->worker_config_ = std::make_shared<const WorkerPluginConfig>(*worker_config);
+        // the cached decisions of the old config won't be hit anymore.
+        if (obj->decision_cache_ != nullptr) {
+          obj->decision_cache_->clear();
+        }
+      }
+    });
+  }
+
+  // the route level configs of this plugin could be parsed by the dso now.
+  PluginBindings::bind(plugin_name_, so_id_, dso);
+}
+
+/*** FilterConfigPerRoute ***/
+
 FilterConfigPerRoute::FilterConfigPerRoute(
     const envoy::extensions::filters::http::golang::v3::ConfigsPerRoute& config,
     Server::Configuration::ServerFactoryContext&) {
-  // NP: dso may not loaded yet, can not invoke moeNewHttpPluginConfig yet.
   ENVOY_LOG(info, "initilizing per route golang filter config");
 
   for (auto it = config.plugins_config().cbegin(); it != config.plugins_config().cend(); ++it) {
     auto plugin_name = it->first;
     auto route_plugin = it->second;
-    auto conf = new RoutePluginConfig(route_plugin);
+    auto conf = new RoutePluginConfig(plugin_name, route_plugin);
     ENVOY_LOG(debug, "per route golang filter config, type_url: {}",
               route_plugin.config().type_url());
     plugins_config_.insert({plugin_name, conf});
   }
 }
 
-uint64_t FilterConfigPerRoute::getPluginConfigId(uint64_t parent_id, std::string plugin_name,
-                                                 std::string so_id) const {
-  auto it = plugins_config_.find(plugin_name);
-  if (it != plugins_config_.end()) {
-    return it->second->getMergedConfigId(parent_id, so_id);
+const PluginConfigHandle*
+FilterConfigPerRoute::getMergedConfig(const FilterConfig& config,
+                                      const PluginConfigHandleSharedPtr& filter_config,
+                                      const Dso::DsoInstanceSharedPtr& dso,
+                                      const Http::StreamFilterCallbacks* callbacks) const {
+  // the route configs are merged onto the filter config, nothing to merge when it's not parsed.
+  if (filter_config == nullptr) {
+    return nullptr;
   }
-  ENVOY_LOG(debug, "golang filter not found plugin config: {}", plugin_name);
-  // not found
-  return parent_id;
+  // NP: the filter config is the key, rather than the FilterConfig, since a new filter config
+  // may be allocated at the same address after a listener update, or parsed again by a new
+  // version of the dso, while the pinned plugin config can not be reused.
+  auto merged = findLastMerged(filter_config.get(), config.merge_policy());
+  if (merged != nullptr) {
+    return merged;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto& entry : merged_configs_) {
+    if (entry.filter_config_ == filter_config && entry.merge_policy_ == config.merge_policy()) {
+      setLastMerged(entry);
+      return entry.config_.get();
+    }
+  }
+
+  auto plugin_config = mergeConfig(config, filter_config, dso, callbacks);
+  if (plugin_config == nullptr) {
+    // do not cache the failure.
+    return nullptr;
+  }
+
+  const auto* result = plugin_config.get();
+  merged_configs_.push_back(
+      MergedConfig{filter_config, config.merge_policy(), std::move(plugin_config)});
+  setLastMerged(merged_configs_.back());
+
+  // drop the ones of the filter configs that nobody else pins, i.e. the filter config is updated
+  // or removed, and its streams are gone, since the streams pin the filter config they merged
+  // onto. NP: it's after the last merged one is replaced, so the freed ones are not read.
+  merged_configs_.erase(
+      std::remove_if(merged_configs_.begin(), merged_configs_.end(),
+                     [](const MergedConfig& entry) {
+                       // the merged one may be the filter config itself.
+                       auto pinned = entry.config_ == entry.filter_config_ ? 2 : 1;
+                       return entry.filter_config_.use_count() <= pinned;
+                     }),
+      merged_configs_.end());
+  return result;
+}
+
+const PluginConfigHandle*
+FilterConfigPerRoute::findLastMerged(const PluginConfigHandle* filter_config,
+                                     MergePolicy merge_policy) const {
+  auto seq = last_merged_.seq_.load(std::memory_order_acquire);
+  if (seq % 2 != 0) {
+    // it's being written.
+    return nullptr;
+  }
+  auto last_filter_config = last_merged_.filter_config_.load(std::memory_order_relaxed);
+  auto last_merge_policy = last_merged_.merge_policy_.load(std::memory_order_relaxed);
+  auto config = last_merged_.config_.load(std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (last_merged_.seq_.load(std::memory_order_relaxed) != seq) {
+    return nullptr;
+  }
+  if (last_filter_config != filter_config || last_merge_policy != merge_policy) {
+    return nullptr;
+  }
+  return config;
 }
 
-uint64_t RoutePluginConfig::getMergedConfigId(uint64_t parent_id, std::string so_id) {
-  if (merged_config_id_ > 0) {
-    return merged_config_id_;
+void FilterConfigPerRoute::setLastMerged(const MergedConfig& merged) const {
+  // invoked with mutex_ held.
+  auto seq = last_merged_.seq_.load(std::memory_order_relaxed);
+  last_merged_.seq_.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  last_merged_.filter_config_.store(merged.filter_config_.get(), std::memory_order_relaxed);
+  last_merged_.merge_policy_.store(merged.merge_policy_, std::memory_order_relaxed);
+  last_merged_.config_.store(merged.config_.get(), std::memory_order_relaxed);
+  last_merged_.seq_.store(seq + 2, std::memory_order_release);
+}
+
+PluginConfigHandleSharedPtr
+FilterConfigPerRoute::mergeConfig(const FilterConfig& config,
+                                  const PluginConfigHandleSharedPtr& filter_config,
+                                  const Dso::DsoInstanceSharedPtr& dso,
+                                  const Http::StreamFilterCallbacks* callbacks) const {
+  // the plugin configs from the least specific to the most specific, i.e. virtual host, route.
+  std::vector<PluginConfigHandleSharedPtr> route_configs;
+  callbacks->traversePerFilterConfig([&](const Router::RouteSpecificFilterConfig& cfg) {
+    const auto* route_config = dynamic_cast<const FilterConfigPerRoute*>(&cfg);
+    if (route_config == nullptr) {
+      return;
+    }
+    auto it = route_config->plugins_config_.find(config.plugin_name());
+    if (it == route_config->plugins_config_.end()) {
+      return;
+    }
+    auto plugin_config = it->second->getPluginConfig(config.so_id(), dso);
+    if (plugin_config == nullptr) {
+      return;
+    }
+    route_configs.push_back(std::move(plugin_config));
+  });
+
+  if (route_configs.empty()) {
+    return filter_config;
   }
-  auto dlib = Dso::DsoInstanceManager::getDsoInstanceByID(so_id);
-  if (dlib == NULL) {
-    ENVOY_LOG(error, "golang extension filter dynamicLib is nullPtr.");
-    return 0;
+
+  PluginConfigHandleSharedPtr plugin_config;
+  switch (config.merge_policy()) {
+  case envoy::extensions::filters::http::golang::v3::Config::OVERRIDE:
+    return route_configs.back();
+  case envoy::extensions::filters::http::golang::v3::Config::MERGE_VIRTUALHOST_ROUTER:
+    break;
+  default:
+    plugin_config = filter_config;
+    break;
   }
 
-  if (config_id_ == 0) {
-    std::string str;
-    if (!plugin_config_.SerializeToString(&str)) {
-      ENVOY_LOG(error, "failed to serialize any pb to string");
-      return 0;
+  // NP: the intermediate merged configs are destroyed in Go once they are merged again.
+  for (auto& child : route_configs) {
+    if (plugin_config == nullptr) {
+      plugin_config = child;
+      continue;
+    }
+    plugin_config = PluginConfigTable::mergeConfig(dso, *plugin_config, *child);
+    if (plugin_config == nullptr) {
+      return nullptr;
     }
-    auto ptr = reinterpret_cast<unsigned long long>(str.data());
-    auto len = str.length();
-    config_id_ = dlib->moeNewHttpPluginConfig(ptr, len);
-    if (config_id_ == 0) {
-      // TODO: throw error
-      ENVOY_LOG(error, "invalid golang plugin config");
-      return parent_id;
+  }
+  return plugin_config;
+}
+
+/*** RoutePluginConfig ***/
+
+RoutePluginConfig::RoutePluginConfig(
+    const std::string& plugin_name,
+    const envoy::extensions::filters::http::golang::v3::RouterPlugin& config)
+    : plugin_name_(plugin_name), plugin_config_(config.config()) {
+  ENVOY_LOG(debug, "initilizing golang filter route plugin config, type_url: {}",
+            config.config().type_url());
+
+  // parse the plugin config in the main thread, for every dso that the plugin bound to.
+  bind_handle_ = PluginBindings::watch(
+      plugin_name, [this](const std::string& so_id, const Dso::DsoInstanceSharedPtr& dso) {
+        newGoPluginConfig(so_id, dso);
+      });
+}
+
+void RoutePluginConfig::newGoPluginConfig(const std::string& so_id,
+                                          const Dso::DsoInstanceSharedPtr& dso) {
+  auto plugin_config = PluginConfigTable::newConfig(dso, plugin_name_, plugin_config_);
+  ENVOY_LOG(debug, "golang filter new route plugin config, so_id: {}, id: {}", so_id,
+            plugin_config != nullptr ? plugin_config->configId() : 0);
+
+  std::unique_lock<std::shared_mutex> lock(mutex_);
+  auto& versions = plugin_configs_[so_id];
+  if (versions.current_ != nullptr && versions.current_->dso() != dso) {
+    versions.previous_ = std::move(versions.current_);
+  }
+  versions.current_ = std::move(plugin_config);
+}
+
+PluginConfigHandleSharedPtr
+RoutePluginConfig::getPluginConfig(const std::string& so_id,
+                                   const Dso::DsoInstanceSharedPtr& dso) {
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  auto it = plugin_configs_.find(so_id);
+  if (it != plugin_configs_.end()) {
+    for (const auto* plugin_config : {&it->second.current_, &it->second.previous_}) {
+      if (*plugin_config != nullptr && (*plugin_config)->dso() == dso) {
+        return *plugin_config;
+      }
     }
-    ENVOY_LOG(debug, "golang filter new plugin config, id: {}", config_id_);
   }
+  // NP: it's parsed in the main thread once the plugin is bound to the dso, the streams that
+  // pinned an older version go without the route config.
+  ENVOY_LOG(debug, "golang filter route plugin config is not parsed by the dso, so_id: {}", so_id);
+  return nullptr;
+}
+
+/* StringArena */
+
+char* StringArena::allocate(size_t len) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (len > left_) {
+    if (len > BlockSize / 2) {
+      // large value takes a dedicated block, keep the rest of the current block for later.
+      blocks_.push_back(std::make_unique<char[]>(len));
+      return blocks_.back().get();
+    }
+    blocks_.push_back(std::make_unique<char[]>(BlockSize));
+    cur_ = blocks_.back().get();
+    left_ = BlockSize;
+  }
+  auto ptr = cur_;
+  cur_ += len;
+  left_ -= len;
+  return ptr;
+}
 
-  merged_config_id_ = dlib->moeMergeHttpPluginConfig(parent_id, config_id_);
-  if (merged_config_id_ == 0) {
-    // TODO: throw error
-    ENVOY_LOG(error, "invalid golang plugin config");
+absl::string_view StringArena::copy(absl::string_view value) {
+  if (value.empty()) {
+    return "";
   }
-  ENVOY_LOG(debug, "golang filter merge plugin config, from {} + {} to {}", parent_id, config_id_,
-            merged_config_id_);
-  return merged_config_id_;
-};
+  auto ptr = allocate(value.length());
+  memcpy(ptr, value.data(), value.length());
+  return {ptr, value.length()};
+}
 
 /* ProcessorState */
 ProcessorState& Filter::getProcessorState() {
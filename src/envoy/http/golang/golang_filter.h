@@ -1,19 +1,35 @@
 #pragma once
 
+#include <array>
 #include <atomic>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
 #include <mutex>
+#include <shared_mutex>
+#include <vector>
 
 #include "envoy/access_log/access_log.h"
 #include "api/http/golang/v3/golang.pb.h"
+#include "envoy/common/time.h"
 #include "envoy/http/filter.h"
+#include "envoy/stats/scope.h"
+#include "envoy/stats/stats_macros.h"
+#include "envoy/thread_local/thread_local.h"
+#include "envoy/tracing/http_tracer.h"
 #include "envoy/upstream/cluster_manager.h"
 
 #include "source/common/http/utility.h"
 #include "source/common/grpc/context_impl.h"
 
 #include "source/common/common/linked_object.h"
+#include "source/common/stats/symbol_table_impl.h"
 #include "source/common/buffer/watermark_buffer.h"
 
+#include "absl/container/flat_hash_map.h"
+#include "absl/types/optional.h"
+
 #include "src/envoy/common/dso/dso.h"
 #include "src/envoy/http/golang/processor_state.h"
 
@@ -22,47 +38,405 @@ namespace Extensions {
 namespace HttpFilters {
 namespace Golang {
 
+/**
+ * The plugin config parsed in Go, it's destroyed in Go when the last reference is released,
+ * the references are held by the filter config, the route configs and the in-flight streams.
+ */
+class PluginConfigHandle {
+public:
+  PluginConfigHandle(Dso::DsoInstanceSharedPtr dso, uint64_t config_id, uint64_t hash,
+                     std::string key)
+      : dso_(std::move(dso)), config_id_(config_id), hash_(hash), key_(std::move(key)) {}
+  ~PluginConfigHandle();
+
+  uint64_t configId() const { return config_id_; }
+  // the dso version that parsed the config, it's pinned by the config.
+  const Dso::DsoInstanceSharedPtr& dso() const { return dso_; }
+
+private:
+  friend class PluginConfigTable;
+
+  const Dso::DsoInstanceSharedPtr dso_;
+  const uint64_t config_id_;
+  // the hash that keys the config in PluginConfigTable, and the only copy of the key bytes,
+  // which tell the colliding configs apart.
+  const uint64_t hash_;
+  const std::string key_;
+};
+
+using PluginConfigHandleSharedPtr = std::shared_ptr<const PluginConfigHandle>;
+
+/**
+ * The snapshot of the plugin config in a worker, it's copied into every worker for every version
+ * of the plugin config, and the streams of the worker pin the copy, instead of the one shared by
+ * all the workers, so the reference counting on the stream creation path stays worker local.
+ */
+class WorkerPluginConfig {
+public:
+  WorkerPluginConfig(PluginConfigHandleSharedPtr plugin_config, Dso::DsoInstanceSharedPtr dso)
+      : plugin_config_(std::move(plugin_config)), dso_(std::move(dso)) {}
+
+  // nullptr means not parsed yet, or failed.
+  const PluginConfigHandleSharedPtr& pluginConfig() const { return plugin_config_; }
+  // the dso version of the plugin config, or the version that failed to parse it.
+  const Dso::DsoInstanceSharedPtr& dso() const { return dso_; }
+
+private:
+  const PluginConfigHandleSharedPtr plugin_config_;
+  const Dso::DsoInstanceSharedPtr dso_;
+};
+
+using WorkerPluginConfigSharedPtr = std::shared_ptr<const WorkerPluginConfig>;
+
+/**
+ * The process wide intern table of the plugin configs, identical configs share one config in Go,
+ * across the listeners and the routes. The parsed configs are keyed by the hash of the plugin name
+ * and the serialized config, and the merged configs by the hash of the parent and child config ids.
+ */
+class PluginConfigTable {
+public:
+  // nullptr means failed.
+  static PluginConfigHandleSharedPtr newConfig(const Dso::DsoInstanceSharedPtr& dso,
+                                               const std::string& plugin_name,
+                                               const Protobuf::Any& plugin_config);
+  static PluginConfigHandleSharedPtr mergeConfig(const Dso::DsoInstanceSharedPtr& dso,
+                                                 const PluginConfigHandle& parent,
+                                                 const PluginConfigHandle& child);
+  // the number of the configs alive, for testing.
+  static size_t size();
+
+private:
+  friend class PluginConfigHandle;
+
+  // the dso version and the hash of the key, the configs with colliding hashes share the bucket.
+  using Key = std::pair<const Dso::DsoInstance*, uint64_t>;
+  using Bucket = std::vector<std::weak_ptr<const PluginConfigHandle>>;
+  static PluginConfigHandleSharedPtr find(const Dso::DsoInstanceSharedPtr& dso, uint64_t hash,
+                                          absl::string_view key);
+  static PluginConfigHandleSharedPtr insert(const Dso::DsoInstanceSharedPtr& dso, uint64_t hash,
+                                            std::string key, uint64_t config_id);
+  static void release(const Dso::DsoInstance* dso, uint64_t hash);
+
+  static std::mutex mutex_;
+  static absl::flat_hash_map<Key, Bucket> configs_;
+};
+
+/**
+ * Route level plugin configs only know the plugin name, the dso that parses them is learnt from
+ * the filter level configs of the same plugin. Main thread only, except releasing the handles.
+ */
+class PluginBindings {
+public:
+  using BindCallback =
+      std::function<void(const std::string& so_id, const Dso::DsoInstanceSharedPtr& dso)>;
+
+  // bind the plugin to a published dso, the watchers of the plugin are notified for new binding,
+  // including the new version of the same so_id.
+  static void bind(const std::string& plugin_name, const std::string& so_id,
+                   const Dso::DsoInstanceSharedPtr& dso);
+  // invoke the callback for every dso that the plugin already bound to, and the later ones.
+  static Common::CallbackHandlePtr watch(const std::string& plugin_name, BindCallback cb);
+
+private:
+  struct Binding {
+    std::map<std::string, Dso::DsoInstanceSharedPtr> dsos_;
+    Common::CallbackManager<const std::string&, const Dso::DsoInstanceSharedPtr&> callbacks_;
+  };
+  static std::mutex mutex_;
+  static std::map<std::string, Binding> bindings_;
+};
+
+/**
+ * All golang filter stats. @see stats_macros.h
+ */
+// NP: for every phase, sync_time is the time of calling into Go, async_time is the time from Go
+// returning Running to the continue being handled in the worker, and go_time is the sum of them.
+// The async time is split into async_schedule_lag, from returning Running to the goroutine
+// started, async_work_time, from then to Go continuing, and async_dispatch_lag, from then to the
+// continue being handled in the worker.
+// The gauges are the in-flight state of the plugin, they're updated incrementally on the state
+// transitions: the streams in the processing and waiting all data states, the bytes buffered in
+// the filter, the requests not finalized by Go yet, and the Go threads waiting on waitSema.
+// cpu_time_us is the thread CPU time of the sync crossings, it's also counted per route in
+// route.<route_name>.cpu_time_us. The CPU time of the goroutines of the async phases is unknown,
+// they're counted in async_cpu_time_unknown.
+#define ALL_GOLANG_FILTER_STATS(COUNTER, GAUGE, HISTOGRAM)                                         \
+  COUNTER(decision_cache_hit)                                                                      \
+  COUNTER(decision_cache_miss)                                                                     \
+  COUNTER(decision_cache_insert)                                                                   \
+  COUNTER(decision_cache_eviction)                                                                 \
+  COUNTER(decision_cache_expired)                                                                  \
+  COUNTER(crossings)                                                                               \
+  COUNTER(cpu_time_us)                                                                             \
+  COUNTER(async_cpu_time_unknown)                                                                  \
+  COUNTER(cpu_budget_bypassed)                                                                     \
+  COUNTER(cpu_budget_rejected)                                                                     \
+  GAUGE(streams_processing_header, Accumulate)                                                     \
+  GAUGE(streams_processing_data, Accumulate)                                                       \
+  GAUGE(streams_processing_trailer, Accumulate)                                                    \
+  GAUGE(streams_waiting_all_data, Accumulate)                                                      \
+  GAUGE(buffered_bytes, Accumulate)                                                                \
+  GAUGE(requests_outstanding, Accumulate)                                                          \
+  GAUGE(sema_waiters, Accumulate)                                                                  \
+  HISTOGRAM(crossings_per_stream, Unspecified)                                                     \
+  HISTOGRAM(async_schedule_lag, Microseconds)                                                      \
+  HISTOGRAM(async_work_time, Microseconds)                                                         \
+  HISTOGRAM(async_dispatch_lag, Microseconds)                                                      \
+  HISTOGRAM(decode_header_sync_time, Microseconds)                                                 \
+  HISTOGRAM(decode_header_async_time, Microseconds)                                                \
+  HISTOGRAM(decode_header_go_time, Microseconds)                                                   \
+  HISTOGRAM(decode_data_sync_time, Microseconds)                                                   \
+  HISTOGRAM(decode_data_async_time, Microseconds)                                                  \
+  HISTOGRAM(decode_data_go_time, Microseconds)                                                     \
+  HISTOGRAM(decode_trailer_sync_time, Microseconds)                                                \
+  HISTOGRAM(decode_trailer_async_time, Microseconds)                                               \
+  HISTOGRAM(decode_trailer_go_time, Microseconds)                                                  \
+  HISTOGRAM(encode_header_sync_time, Microseconds)                                                 \
+  HISTOGRAM(encode_header_async_time, Microseconds)                                                \
+  HISTOGRAM(encode_header_go_time, Microseconds)                                                   \
+  HISTOGRAM(encode_data_sync_time, Microseconds)                                                   \
+  HISTOGRAM(encode_data_async_time, Microseconds)                                                  \
+  HISTOGRAM(encode_data_go_time, Microseconds)                                                     \
+  HISTOGRAM(encode_trailer_sync_time, Microseconds)                                                \
+  HISTOGRAM(encode_trailer_async_time, Microseconds)                                               \
+  HISTOGRAM(encode_trailer_go_time, Microseconds)
+
+/**
+ * Struct definition for all golang filter stats. @see stats_macros.h
+ */
+struct GolangFilterStats {
+  ALL_GOLANG_FILTER_STATS(GENERATE_COUNTER_STRUCT, GENERATE_GAUGE_STRUCT,
+                          GENERATE_HISTOGRAM_STRUCT)
+};
+
+// the time histograms of a phase.
+struct PhaseHistograms {
+  Stats::Histogram* sync_time_;
+  Stats::Histogram* async_time_;
+  Stats::Histogram* go_time_;
+};
+
+/**
+ * The CPU budget of the go plugin in a worker, it's charged by the thread CPU time of the sync
+ * calls into Go, and of the async goroutines when they continue, and it's over the budget when
+ * the CPU time of the current or the last window exceeded the limit.
+ * Worker thread only.
+ */
+class CpuBudget {
+public:
+  CpuBudget(std::chrono::milliseconds window, uint32_t max_percent)
+      : window_(window), limit_(std::chrono::duration_cast<std::chrono::nanoseconds>(window) *
+                                max_percent / 100) {}
+
+  void charge(MonotonicTime now, std::chrono::nanoseconds cpu_time) {
+    roll(now);
+    used_ += cpu_time;
+  }
+  bool exceeded(MonotonicTime now) {
+    roll(now);
+    return last_exceeded_ || used_ > limit_;
+  }
+
+private:
+  void roll(MonotonicTime now) {
+    if (now - window_start_ < window_) {
+      return;
+    }
+    // NP: the last window is empty when more than one window passed.
+    last_exceeded_ = now - window_start_ < 2 * window_ && used_ > limit_;
+    used_ = std::chrono::nanoseconds(0);
+    window_start_ = now;
+  }
+
+  const MonotonicTime::duration window_;
+  const std::chrono::nanoseconds limit_;
+  MonotonicTime window_start_;
+  std::chrono::nanoseconds used_{0};
+  bool last_exceeded_{false};
+};
+
+// the headers of the local reply from Go, copied out of the Go memory.
+using LocalReplyHeaders = std::vector<std::pair<Http::LowerCaseString, std::string>>;
+
+/**
+ * The verdicts of the decode header phase cached in a worker, keyed by the plugin config id and
+ * the values of the key headers, the least recently used one is evicted when it's full.
+ * Worker thread only.
+ */
+class DecisionCache {
+public:
+  struct HeaderMutation {
+    enum class Action { Set, Add, Remove };
+    Action action_;
+    Http::LowerCaseString key_;
+    std::string value_;
+  };
+
+  // the verdict of the go plugin, continue with the request header mutations, or the local reply.
+  struct Decision {
+    std::vector<HeaderMutation> mutations_;
+    bool local_reply_{false};
+    Http::Code response_code_{Http::Code::OK};
+    std::string body_text_;
+    LocalReplyHeaders reply_headers_;
+    Grpc::Status::GrpcStatus grpc_status_{Grpc::Status::WellKnownGrpcStatus::InvalidCode};
+    std::string details_;
+  };
+  using DecisionPtr = std::unique_ptr<Decision>;
+  using DecisionConstSharedPtr = std::shared_ptr<const Decision>;
+
+  DecisionCache(uint32_t max_entries, GolangFilterStats& stats)
+      : max_entries_(max_entries), stats_(stats) {}
+
+  // nullptr means miss.
+  DecisionConstSharedPtr lookup(const std::string& key, MonotonicTime now);
+  void insert(const std::string& key, DecisionConstSharedPtr decision, MonotonicTime expire);
+  void clear();
+  size_t size() const { return entries_.size(); }
+
+private:
+  struct Entry {
+    std::string key_;
+    MonotonicTime expire_;
+    DecisionConstSharedPtr decision_;
+  };
+  using EntryList = std::list<Entry>;
+
+  const uint32_t max_entries_;
+  GolangFilterStats& stats_;
+  // the most recently used one first.
+  EntryList entries_;
+  absl::flat_hash_map<std::string, EntryList::iterator> index_;
+};
+
+using MergePolicy = envoy::extensions::filters::http::golang::v3::Config::MergePolicy;
+
 /**
  * Configuration for the HTTP golang extension filter.
  */
 class FilterConfig : Logger::Loggable<Logger::Id::http> {
 public:
-  FilterConfig(const envoy::extensions::filters::http::golang::v3::Config& proto_config);
-  ~FilterConfig() {
-    // TODO: delete config in Go
-  }
+  FilterConfig(const envoy::extensions::filters::http::golang::v3::Config& proto_config,
+               const std::string& stats_prefix, Stats::Scope& scope);
+  // the plugin config is published to the workers by a thread local slot, so that reading it
+  // on the stream creation path is lock free.
+  FilterConfig(const envoy::extensions::filters::http::golang::v3::Config& proto_config,
+               const std::string& stats_prefix, Stats::Scope& scope,
+               ThreadLocal::SlotAllocator& tls);
 
   const std::string& filter_chain() const { return filter_chain_; }
   const std::string& so_id() const { return so_id_; }
   const std::string& plugin_name() const { return plugin_name_; }
-  uint64_t getConfigId();
+  MergePolicy merge_policy() const { return merge_policy_; }
+  bool speculative() const { return speculative_; }
+  std::chrono::milliseconds slowAsyncThreshold() const { return slow_async_threshold_; }
+  GolangFilterStats& stats() { return stats_; }
+  const PhaseHistograms& phaseHistograms(Phase phase) const {
+    ASSERT(phase >= Phase::DecodeHeader && phase <= Phase::EncodeTrailer);
+    return phase_histograms_[static_cast<int>(phase) - static_cast<int>(Phase::DecodeHeader)];
+  }
+  const std::vector<Http::LowerCaseString>& decisionKeyHeaders() const {
+    return decision_key_headers_;
+  }
+  // the decision cache of the current worker, nullptr means not configured.
+  DecisionCache* decisionCache() const;
+  // the CPU budget of the current worker, nullptr means not configured.
+  CpuBudget* cpuBudget() const;
+  // the status to reply when it's over the CPU budget, 0 means bypassing the go plugin for
+  // cpuBudgetBypassPercent of the new streams.
+  uint32_t cpuBudgetReplyStatus() const { return cpu_budget_reply_status_; }
+  uint32_t cpuBudgetBypassPercent() const { return cpu_budget_bypass_percent_; }
+  // the CPU time counter of the route, the counters are created once per route, and cached per
+  // worker.
+  Stats::Counter& routeCpuTimeCounter(const std::string& route_name);
+  // the snapshot of the current worker, it's replaced in the main thread when a new version of
+  // the dso is published, the streams pin it.
+  WorkerPluginConfigSharedPtr workerConfig() const;
+  // nullptr means not parsed yet.
+  PluginConfigHandleSharedPtr getPluginConfig() const { return workerConfig()->pluginConfig(); }
+  Dso::DsoInstanceSharedPtr getDso() const { return workerConfig()->dso(); }
 
 private:
+  struct ThreadLocalPluginConfig : public ThreadLocal::ThreadLocalObject {
+    ThreadLocalPluginConfig(WorkerPluginConfigSharedPtr worker_config)
+        : worker_config_(std::move(worker_config)) {}
+    WorkerPluginConfigSharedPtr worker_config_;
+    std::unique_ptr<DecisionCache> decision_cache_;
+    std::unique_ptr<CpuBudget> cpu_budget_;
+    // route name -> counter in the scope.
+    absl::flat_hash_map<std::string, Stats::Counter*> route_cpu_time_;
+  };
+
+  static constexpr uint32_t DefaultDecisionCacheMaxEntries = 1024;
+  static constexpr uint64_t DefaultCpuBudgetWindowMs = 10000;
+  // the routes beyond it share the route.other.cpu_time_us counter.
+  static constexpr size_t MaxRouteCpuTimeCounters = 1024;
+
+  static GolangFilterStats generateStats(const std::string& prefix, Stats::Scope& scope);
+
+  // parse the plugin config in Go, invoked in the main thread once the dso is published.
+  void newGoPluginConfig(const Dso::DsoInstanceSharedPtr& dso);
+
   const std::string filter_chain_;
   const std::string plugin_name_;
   const std::string so_id_;
   const Protobuf::Any plugin_config_;
-  uint64_t config_id_{0};
+  const MergePolicy merge_policy_;
+  const bool speculative_;
+  const std::chrono::milliseconds slow_async_threshold_;
+  const std::vector<Http::LowerCaseString> decision_key_headers_;
+  const uint32_t decision_cache_max_entries_;
+  // max_percent is 0 when the CPU budget is not configured.
+  const std::chrono::milliseconds cpu_budget_window_;
+  const uint32_t cpu_budget_max_percent_;
+  const uint32_t cpu_budget_bypass_percent_;
+  const uint32_t cpu_budget_reply_status_;
+  Stats::Scope& scope_;
+  const std::string stats_prefix_;
+  GolangFilterStats stats_;
+  // indexed by Phase, from DecodeHeader to EncodeTrailer.
+  const std::array<PhaseHistograms, 6> phase_histograms_;
+  // the CPU time counters of the routes, shared by the workers, keyed by the route name.
+  std::mutex route_cpu_time_mutex_;
+  Stats::StatNamePool route_stat_names_;
+  absl::flat_hash_map<std::string, Stats::Counter*> route_cpu_time_;
+  Stats::Counter* route_cpu_time_other_{nullptr};
+  // the snapshot for the threads without the thread local slot, i.e. the main thread.
+  WorkerPluginConfigSharedPtr worker_config_{
+      std::make_shared<const WorkerPluginConfig>(nullptr, nullptr)};
+  ThreadLocal::TypedSlotPtr<ThreadLocalPluginConfig> tls_slot_;
+  Common::CallbackHandlePtr pub_handle_;
 };
 
 using FilterConfigSharedPtr = std::shared_ptr<FilterConfig>;
 
 class RoutePluginConfig : Logger::Loggable<Logger::Id::http> {
 public:
-  RoutePluginConfig(const envoy::extensions::filters::http::golang::v3::RouterPlugin& config)
-      : plugin_config_(config.config()) {
-    ENVOY_LOG(debug, "initilizing golang filter route plugin config, type_url: {}",
-              config.config().type_url());
-  };
-  ~RoutePluginConfig() {
-    // TODO: delete plugin config in Go
-  }
-  uint64_t getMergedConfigId(uint64_t parent_id, std::string so_id);
+  RoutePluginConfig(const std::string& plugin_name,
+                    const envoy::extensions::filters::http::golang::v3::RouterPlugin& config);
+  // the plugin config parsed by the dso version, it's only looked up, never parsed, in the
+  // workers, nullptr means failed or not parsed by the version.
+  PluginConfigHandleSharedPtr getPluginConfig(const std::string& so_id,
+                                              const Dso::DsoInstanceSharedPtr& dso);
 
 private:
+  // the plugin configs parsed by the current and the previous versions of a dso, the previous one
+  // serves the workers that have not seen the new version of the filter config yet.
+  struct Versions {
+    PluginConfigHandleSharedPtr current_;
+    PluginConfigHandleSharedPtr previous_;
+  };
+
+  // parse the plugin config in Go, invoked in the main thread once the plugin bound to a dso.
+  void newGoPluginConfig(const std::string& so_id, const Dso::DsoInstanceSharedPtr& dso);
+
+  const std::string plugin_name_;
   const Protobuf::Any plugin_config_;
-  uint64_t config_id_{0};
-  uint64_t merged_config_id_{0};
+  // plugin_configs_ is written in the main thread, and read by the workers while merging.
+  std::shared_mutex mutex_;
+  // so_id -> plugin configs parsed by the versions of the dso
+  std::map<std::string, Versions> plugin_configs_;
+  Common::CallbackHandlePtr bind_handle_;
 };
 
 /**
@@ -73,7 +447,15 @@ class FilterConfigPerRoute : public Router::RouteSpecificFilterConfig,
 public:
   FilterConfigPerRoute(const envoy::extensions::filters::http::golang::v3::ConfigsPerRoute&,
                        Server::Configuration::ServerFactoryContext&);
-  uint64_t getPluginConfigId(uint64_t parent_id, std::string plugin_name, std::string so_id) const;
+  // the merged config of the filter config and the per filter configs from the virtual host
+  // to this one, it's merged by the first stream and cached here, since this one is the most
+  // specific config of the route and the chain is fixed.
+  // the returned one is owned by this route config, and kept while the filter config is pinned
+  // by the caller, nullptr means failed.
+  const PluginConfigHandle* getMergedConfig(const FilterConfig& config,
+                                            const PluginConfigHandleSharedPtr& filter_config,
+                                            const Dso::DsoInstanceSharedPtr& dso,
+                                            const Http::StreamFilterCallbacks* callbacks) const;
 
   ~FilterConfigPerRoute() {
     for (auto it = plugins_config_.cbegin(); it != plugins_config_.cend(); ++it) {
@@ -81,8 +463,43 @@ public:
     }
   }
 
+  // the merged configs cached, for the tests.
+  size_t mergedConfigs() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return merged_configs_.size();
+  }
+
 private:
+  struct MergedConfig {
+    // the filter config merged onto, the entry is pruned once nobody else pins it, i.e. the
+    // filter config is updated or removed, and its streams are gone.
+    PluginConfigHandleSharedPtr filter_config_;
+    MergePolicy merge_policy_;
+    PluginConfigHandleSharedPtr config_;
+  };
+
+  // the filter config of the last merged one, it's one cache line read by the streams without
+  // the lock, and it's a seqlock since the fields are written together.
+  struct alignas(64) LastMerged {
+    std::atomic<uint64_t> seq_{0};
+    std::atomic<const PluginConfigHandle*> filter_config_{nullptr};
+    std::atomic<int> merge_policy_{0};
+    std::atomic<const PluginConfigHandle*> config_{nullptr};
+  };
+
+  const PluginConfigHandle* findLastMerged(const PluginConfigHandle* filter_config,
+                                           MergePolicy merge_policy) const;
+  void setLastMerged(const MergedConfig& merged) const;
+  PluginConfigHandleSharedPtr mergeConfig(const FilterConfig& config,
+                                          const PluginConfigHandleSharedPtr& filter_config,
+                                          const Dso::DsoInstanceSharedPtr& dso,
+                                          const Http::StreamFilterCallbacks* callbacks) const;
+
   std::map<std::string, RoutePluginConfig*> plugins_config_;
+  mutable LastMerged last_merged_;
+  // guards merged_configs_, and serializes the writers of last_merged_.
+  mutable std::mutex mutex_;
+  mutable std::vector<MergedConfig> merged_configs_;
 };
 
 enum class DestroyReason {
@@ -104,12 +521,25 @@ class Filter : public Http::StreamFilter,
                Logger::Loggable<Logger::Id::http>,
                public AccessLog::Instance {
 public:
+  // NP: the stream pins the filter config, since Go may finalize the request after the filter
+  // chain factory is gone, i.e. by LDS updates or draining, and the worker config is the copy
+  // owned by the worker.
   explicit Filter(Grpc::Context& context, FilterConfigSharedPtr config, uint64_t sid,
-                  Dso::DsoInstance* dynamicLib)
-      : config_(config), dynamicLib_(dynamicLib), decoding_state_(*this), encoding_state_(*this),
+                  WorkerPluginConfigSharedPtr worker_config)
+      : config_(std::move(config)), worker_config_(std::move(worker_config)),
+        dynamicLib_(worker_config_ != nullptr ? worker_config_->dso().get() : nullptr),
+        decoding_state_(*this, config_->stats()), encoding_state_(*this, config_->stats()),
         context_(context), stream_id_(sid) {
     (void)context_;
     (void)stream_id_;
+    if (dynamicLib_ != nullptr) {
+      dynamicLib_->streamCreated();
+    }
+  }
+  ~Filter() override {
+    if (dynamicLib_ != nullptr) {
+      dynamicLib_->streamDestroyed();
+    }
   }
 
   // Http::StreamFilterBase
@@ -157,8 +587,8 @@ public:
   int continueStatus(GolangStatus status);
 
   int sendLocalReply(Http::Code response_code, absl::string_view body_text,
-                     std::function<void(Http::ResponseHeaderMap& headers)> modify_headers,
-                     Grpc::Status::GrpcStatus grpc_status, absl::string_view details);
+                     LocalReplyHeaders headers, Grpc::Status::GrpcStatus grpc_status,
+                     absl::string_view details);
 
   int getHeader(absl::string_view key, GoString* goValue);
   int copyHeaders(GoString* goStrs, char* goBuf);
@@ -171,11 +601,16 @@ public:
   int getStringValue(int id, GoString* valueStr);
   int getDynamicMetadata(std::string filter_name, GoSlice* bufSlice);
   int setDynamicMetadata(std::string filter_name, std::string key, absl::string_view bufStr);
+  int cacheDecision(uint64_t ttl_ms);
+  int flushSpans(GoSlice* batch);
 
 private:
   ProcessorState& getProcessorState();
 
   bool doHeaders(ProcessorState& state, Http::RequestOrResponseHeaderMap& headers, bool end_stream);
+  static bool isIdempotent(const Http::RequestHeaderMap& headers);
+  Http::FilterHeadersStatus doHeadersSpeculative(ProcessorState& state,
+                                                 Http::RequestHeaderMap& headers, bool end_stream);
   GolangStatus doHeadersGo(ProcessorState& state, Http::RequestOrResponseHeaderMap& headers,
                            bool end_stream);
   bool doData(ProcessorState& state, Buffer::Instance&, bool);
@@ -183,24 +618,62 @@ private:
   bool doTrailer(ProcessorState& state, Http::HeaderMap& trailers);
   bool doTrailerGo(ProcessorState& state, Http::HeaderMap& trailers);
 
-  uint64_t getMergedConfigId(ProcessorState& state);
+  const PluginConfigHandle* getMergedConfig(ProcessorState& state);
+
+  DecisionCache::DecisionConstSharedPtr lookupDecision(DecisionCache& cache,
+                                                       Http::RequestHeaderMap& headers);
+  Http::FilterHeadersStatus serveDecision(const DecisionCache::Decision& decision,
+                                          Http::RequestHeaderMap& headers);
+  void recordHeaderMutation(DecisionCache::HeaderMutation::Action action, absl::string_view key,
+                            absl::string_view value);
+  void finishDecision(GolangStatus status);
+  // shed the new stream when the go plugin is over the CPU budget, false means not shed.
+  bool shedByCpuBudget(Http::FilterHeadersStatus& status);
+
+  // the time spent in Go, invoked after calling into Go, and when the async Go continues, with
+  // the time that Go handed off the continue, and the delay of the goroutine started.
+  void onGoReturn(ProcessorState& state, MonotonicTime start, std::chrono::nanoseconds cpu_start,
+                  GolangStatus status);
+  void onGoContinue(MonotonicTime handoff, int64_t goroutine_delay, GolangStatus status);
+  void dumpSlowAsync(std::chrono::microseconds async_time);
+  void recordGoTime(Phase phase, std::chrono::microseconds go_time);
+
+  // the child span of the async Go phase, it's finished when Go continues, with the tags and
+  // spans flushed from Go.
+  void startGoSpan(ProcessorState& state);
+  void finishGoSpan(absl::string_view status);
+
+public:
+  // apply the span batch of Go to the span, false means the batch is invalid, and the rest of it
+  // is dropped.
+  static bool applySpanBatch(Tracing::Span& span, absl::string_view batch);
+
+private:
 
   void continueEncodeLocalReply(ProcessorState& state);
   void continueStatusInternal(GolangStatus status);
+  void continueSpeculative(GolangStatus status);
   void continueData(ProcessorState& state);
 
   void onHeadersModified();
 
   void sendLocalReplyInternal(Http::Code response_code, absl::string_view body_text,
-                              std::function<void(Http::ResponseHeaderMap& headers)> modify_headers,
+                              const LocalReplyHeaders& headers,
                               Grpc::Status::GrpcStatus grpc_status, absl::string_view details);
 
   void getDynamicMetadataAsync(std::string filter_name, GoSlice* bufSlice);
+  void serializeToGoSlice(const Protobuf::Message& message, GoSlice* bufSlice);
   void setDynamicMetadataInternal(ProcessorState& state, std::string filter_name, std::string key,
                                   const absl::string_view& bufStr);
 
   const FilterConfigSharedPtr config_;
+  // pins the dso version and the plugin config, it's decided at the first time calling into Go.
+  WorkerPluginConfigSharedPtr worker_config_;
+  // the dso of worker_config_.
   Dso::DsoInstance* dynamicLib_;
+  // the filter config or the merged one, pinned by worker_config_ or the route config, Go looks
+  // it up at the first time calling into Go.
+  const PluginConfigHandle* plugin_config_{nullptr};
 
   Http::RequestOrResponseHeaderMap* headers_{nullptr};
   Http::HeaderMap* trailers_{nullptr};
@@ -217,9 +690,18 @@ private:
   Grpc::Context& context_;
   uint64_t cost_time_decode_{0};
   uint64_t cost_time_encode_{0};
-  uint64_t cost_time_mem_{0};
   uint64_t stream_id_{0};
 
+  // the number of calling into Go, and the thread CPU time of them and the async goroutines.
+  uint32_t crossings_{0};
+  std::chrono::nanoseconds cpu_time_{0};
+  // the phase that Go is running asynchronously, since the time Go returned Running, and the
+  // sync time of calling into Go in the phase.
+  absl::optional<MonotonicTime> running_since_;
+  Phase running_phase_{Phase::DecodeHeader};
+  std::chrono::microseconds running_sync_time_{0};
+  Tracing::SpanPtr go_span_;
+
   httpRequestInternal* req_{0};
 
   // lock for has_destroyed_,
@@ -227,6 +709,8 @@ private:
   // it should also be okay without this lock in most cases, just for extreme case.
   std::mutex mutex_{};
   bool has_destroyed_{false};
+  // the span batch flushed from Go, it's written in the Go thread, protected by mutex_.
+  std::string span_batch_;
 
   // other filter trigger sendLocalReply during go processing in async.
   // will wait go return before continue.
@@ -235,33 +719,71 @@ private:
 
   // the filter enter encoding phase
   bool enter_encoding_{false};
+
+  // the speculative mode, the request is forwarded while Go checks the copy of the request
+  // headers, and the response headers are held until Go continues.
+  // the headers are copied only when the request is speculated.
+  bool speculating_{false};
+  Http::RequestHeaderMapPtr speculative_headers_;
+  bool speculative_pending_{false};
+  Http::ResponseHeaderMap* held_headers_{nullptr};
+
+  // the verdict of the decode header phase that is being recorded for the decision cache, and
+  // the ttl requested by Go, 0 means not cacheable.
+  DecisionCache::DecisionPtr decision_;
+  std::string decision_key_;
+  uint64_t decision_ttl_ms_{0};
+  // nothing is called into Go for the stream, it's served by the decision cache, or shed by the
+  // CPU budget.
+  bool bypass_go_{false};
+};
+
+/**
+ * A bump-pointer arena for the values returned to Go.
+ * Memory allocated from it stays valid until the arena is destroyed, that is, the request is
+ * finalized by Go, so getters that run concurrently won't overwrite each other's values.
+ */
+class StringArena {
+public:
+  StringArena() = default;
+  StringArena(const StringArena&) = delete;
+  StringArena& operator=(const StringArena&) = delete;
+
+  // allocate len bytes, it is safe to invoke in any thread.
+  char* allocate(size_t len);
+  // copy value into the arena, the returned view is stable until the arena is destroyed.
+  absl::string_view copy(absl::string_view value);
+
+private:
+  static constexpr size_t BlockSize = 1024;
+
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<char[]>> blocks_;
+  char* cur_{nullptr};
+  size_t left_{0};
 };
 
 // Go code only touch the fields in httpRequest
 struct httpRequestInternal : httpRequest {
   std::weak_ptr<Filter> filter_;
-  // anchor a string temporarily, make sure it won't be freed before copied to Go.
-  std::string strValue;
-  httpRequestInternal(std::weak_ptr<Filter> f) {
+  // anchor values that returned to Go, make sure they won't be freed before the request is
+  // finalized.
+  StringArena arena_;
+  // the requests_outstanding gauge, the request may be finalized after the filter config is
+  // destroyed, so it holds a reference to the gauge.
+  Stats::GaugeSharedPtr outstanding_;
+  httpRequestInternal(std::weak_ptr<Filter> f, uint64_t stream_id, Stats::Gauge& outstanding)
+      : outstanding_(&outstanding) {
     filter_ = f;
+    streamId = stream_id;
     waitSema = 0;
+    goroutineDelay = 0;
+    outstanding_->inc();
   }
+  ~httpRequestInternal() { outstanding_->dec(); }
   std::weak_ptr<Filter> weakFilter() { return filter_; }
 };
 
-// used to count function execution time
-template <typename T = std::chrono::microseconds> struct measure {
-  template <typename F, typename... Args> static typename T::rep execution(F func, Args&&... args) {
-    auto start = std::chrono::steady_clock::now();
-
-    func(std::forward<Args>(args)...);
-
-    auto duration = std::chrono::duration_cast<T>(std::chrono::steady_clock::now() - start);
-
-    return duration.count();
-  }
-};
-
 } // namespace Golang
 } // namespace HttpFilters
 } // namespace Extensions
@@ -0,0 +1,124 @@
+#include "src/envoy/http/golang/metrics.h"
+
+#include <algorithm>
+
+#include "envoy/singleton/manager.h"
+
+#include "absl/strings/str_cat.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace HttpFilters {
+namespace Golang {
+
+SINGLETON_MANAGER_REGISTRATION(golang_metrics);
+
+namespace {
+
+constexpr std::chrono::milliseconds FlushInterval{1000};
+
+} // namespace
+
+std::mutex GoMetrics::mutex_ = {};
+std::vector<std::unique_ptr<MetricSlot>> GoMetrics::slots_ = {};
+absl::flat_hash_map<std::string, MetricSlot*> GoMetrics::names_ = {};
+std::atomic<int> GoMetrics::flushers_ = {0};
+
+GoMetrics::GoMetrics(Stats::Scope& scope, Event::Dispatcher& main_thread_dispatcher)
+    : scope_(scope) {
+  flushers_++;
+  flush_timer_ = main_thread_dispatcher.createTimer([this] {
+    flush();
+    flush_timer_->enableTimer(FlushInterval);
+  });
+  flush_timer_->enableTimer(FlushInterval);
+}
+
+GoMetrics::~GoMetrics() {
+  // the values since the last flush.
+  flush();
+  flushers_--;
+}
+
+GoMetricsSharedPtr GoMetrics::singleton(Server::Configuration::ServerFactoryContext& context) {
+  return context.singletonManager().getTyped<GoMetrics>(
+      SINGLETON_MANAGER_REGISTERED_NAME(golang_metrics), [&context] {
+        return std::make_shared<GoMetrics>(context.scope(), context.mainThreadDispatcher());
+      });
+}
+
+MetricSlot* GoMetrics::define(MetricType type, absl::string_view plugin_name,
+                              absl::string_view name) {
+  auto full_name = absl::StrCat("golang.", plugin_name, ".", name);
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = names_.find(full_name);
+  if (it != names_.end()) {
+    return it->second->type_ == type ? it->second : nullptr;
+  }
+  slots_.push_back(std::make_unique<MetricSlot>(type, full_name));
+  auto slot = slots_.back().get();
+  names_.emplace(std::move(full_name), slot);
+  return slot;
+}
+
+void GoMetrics::record(MetricSlot& slot, const uint64_t* values, size_t n) {
+  // NP: Go keeps passing the values after the filter configs are gone, nobody flushes them then.
+  if (flushers_.load(std::memory_order_relaxed) == 0) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(slot.mutex_);
+  n = std::min(n, MaxPendingValues - std::min(MaxPendingValues, slot.pending_.size()));
+  slot.pending_.insert(slot.pending_.end(), values, values + n);
+}
+
+void GoMetrics::flush() {
+  {
+    // the stats of the slots defined since the last flush.
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t i = metrics_.size(); i < slots_.size(); i++) {
+      metrics_.push_back(Metric{slots_[i].get()});
+    }
+  }
+
+  for (auto& metric : metrics_) {
+    auto& slot = *metric.slot_;
+    switch (slot.type_) {
+    case MetricType::Counter: {
+      if (metric.counter_ == nullptr) {
+        metric.counter_ = &scope_.counterFromString(slot.name_);
+      }
+      auto value = slot.value_.load(std::memory_order_relaxed);
+      metric.counter_->add(value - slot.flushed_);
+      slot.flushed_ = value;
+      break;
+    }
+    case MetricType::Gauge:
+      if (metric.gauge_ == nullptr) {
+        metric.gauge_ =
+            &scope_.gaugeFromString(slot.name_, Stats::Gauge::ImportMode::Accumulate);
+      }
+      metric.gauge_->set(slot.value_.load(std::memory_order_relaxed));
+      break;
+    case MetricType::Histogram: {
+      if (metric.histogram_ == nullptr) {
+        metric.histogram_ =
+            &scope_.histogramFromString(slot.name_, Stats::Histogram::Unit::Unspecified);
+      }
+      std::vector<uint64_t> values;
+      {
+        std::lock_guard<std::mutex> lock(slot.mutex_);
+        values.swap(slot.pending_);
+      }
+      for (auto value : values) {
+        metric.histogram_->recordValue(value);
+      }
+      break;
+    }
+    }
+  }
+}
+
+} // namespace Golang
+} // namespace HttpFilters
+} // namespace Extensions
+} // namespace Envoy
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "envoy/event/dispatcher.h"
+#include "envoy/event/timer.h"
+#include "envoy/server/factory_context.h"
+#include "envoy/singleton/instance.h"
+#include "envoy/stats/scope.h"
+#include "envoy/stats/stats.h"
+
+#include "source/common/common/logger.h"
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/string_view.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace HttpFilters {
+namespace Golang {
+
+// the same values as the MetricType in Go.
+enum class MetricType {
+  Counter = 0,
+  Gauge = 1,
+  Histogram = 2,
+};
+
+/**
+ * A metric defined by the Go plugin. Go updates the value of the counters and gauges by atomic
+ * operations, without calling into Envoy, and passes the histogram values in batches.
+ * NP: the slots are never freed, since Go may still hold them after the filter configs are gone,
+ * the same name gets the same slot when the plugin defines it again.
+ */
+struct MetricSlot {
+  MetricSlot(MetricType type, std::string name) : type_(type), name_(std::move(name)) {}
+
+  const MetricType type_;
+  const std::string name_;
+  // the total of the counter, or the value of the gauge, written by Go.
+  std::atomic<uint64_t> value_{0};
+  // the counter value that has been flushed to the stats, only used in the main thread.
+  uint64_t flushed_{0};
+  // the histogram values passed from Go, since the last flush, at most MaxPendingValues.
+  std::mutex mutex_;
+  std::vector<uint64_t> pending_;
+};
+
+/**
+ * GoMetrics flushes the metric slots to the stats of the server scope periodically, in the main
+ * thread. It's a singleton, alive with the golang filter configs.
+ */
+class GoMetrics : public Singleton::Instance, Logger::Loggable<Logger::Id::http> {
+public:
+  GoMetrics(Stats::Scope& scope, Event::Dispatcher& main_thread_dispatcher);
+  ~GoMetrics() override;
+
+  static std::shared_ptr<GoMetrics> singleton(Server::Configuration::ServerFactoryContext& context);
+
+  // define the metric "golang.<plugin>.<name>", it may be called in the Go threads.
+  // nullptr means the name has been defined with another type.
+  static MetricSlot* define(MetricType type, absl::string_view plugin_name,
+                            absl::string_view name);
+  // the histogram values are recorded in the next flush, they're dropped when there is no
+  // GoMetrics to flush them, or too many values are pending.
+  static void record(MetricSlot& slot, const uint64_t* values, size_t n);
+
+  static constexpr size_t MaxPendingValues = 64 * 1024;
+
+  void flush();
+
+private:
+  struct Metric {
+    MetricSlot* slot_;
+    Stats::Counter* counter_{nullptr};
+    Stats::Gauge* gauge_{nullptr};
+    Stats::Histogram* histogram_{nullptr};
+  };
+
+  static std::mutex mutex_;
+  static std::vector<std::unique_ptr<MetricSlot>> slots_;
+  static absl::flat_hash_map<std::string, MetricSlot*> names_;
+  // the number of the alive GoMetrics, the slots outlive them.
+  static std::atomic<int> flushers_;
+
+  Stats::Scope& scope_;
+  Event::TimerPtr flush_timer_;
+  // the stats of the slots, in the same order of slots_.
+  std::vector<Metric> metrics_;
+};
+
+using GoMetricsSharedPtr = std::shared_ptr<GoMetrics>;
+
+} // namespace Golang
+} // namespace HttpFilters
+} // namespace Extensions
+} // namespace Envoy
@@ -3,6 +3,8 @@
 #include "source/common/buffer/buffer_impl.h"
 #include "source/common/protobuf/utility.h"
 
+#include "src/envoy/http/golang/golang_filter.h"
+
 namespace Envoy {
 namespace Extensions {
 namespace HttpFilters {
@@ -26,6 +28,14 @@ void BufferList::moveOut(Buffer::Instance& data) {
   bytes_ = 0;
 };
 
+uint64_t BufferList::length() const {
+  uint64_t len = 0;
+  for (const auto& buffer : queue_) {
+    len += buffer->length();
+  }
+  return len;
+}
+
 void BufferList::clearLatest() {
   auto buffer = std::move(queue_.back());
   bytes_ -= buffer->length();
@@ -70,19 +80,19 @@ bool ProcessorState::handleHeaderGolangStatus(const GolangStatus status) {
 
   case GolangStatus::Continue:
     if (do_end_stream_) {
-      state_ = FilterState::Done;
+      setState(FilterState::Done);
     } else {
-      state_ = FilterState::WaitingData;
+      setState(FilterState::WaitingData);
     }
     done = true;
     break;
 
   case GolangStatus::StopAndBuffer:
-    state_ = FilterState::WaitingAllData;
+    setState(FilterState::WaitingAllData);
     break;
 
   case GolangStatus::StopAndBufferWatermark:
-    state_ = FilterState::WaitingData;
+    setState(FilterState::WaitingData);
     break;
 
   default:
@@ -118,9 +128,9 @@ bool ProcessorState::handleDataGolangStatus(const GolangStatus status) {
 
   case GolangStatus::Continue:
     if (do_end_stream_) {
-      state_ = FilterState::Done;
+      setState(FilterState::Done);
     } else {
-      state_ = FilterState::WaitingData;
+      setState(FilterState::WaitingData);
     }
     done = true;
     break;
@@ -130,7 +140,7 @@ bool ProcessorState::handleDataGolangStatus(const GolangStatus status) {
       ENVOY_LOG(error, "want more data while stream is end");
       // TODO: terminate the stream?
     }
-    state_ = FilterState::WaitingAllData;
+    setState(FilterState::WaitingAllData);
     break;
 
   case GolangStatus::StopAndBufferWatermark:
@@ -138,7 +148,7 @@ bool ProcessorState::handleDataGolangStatus(const GolangStatus status) {
       ENVOY_LOG(error, "want more data while stream is end");
       // TODO: terminate the stream?
     }
-    state_ = FilterState::WaitingData;
+    setState(FilterState::WaitingData);
     break;
 
   case GolangStatus::StopNoBuffer:
@@ -147,7 +157,7 @@ bool ProcessorState::handleDataGolangStatus(const GolangStatus status) {
       // TODO: terminate the stream?
     }
     doDataList.clearLatest();
-    state_ = FilterState::WaitingData;
+    setState(FilterState::WaitingData);
     break;
 
   default:
@@ -159,7 +169,7 @@ bool ProcessorState::handleDataGolangStatus(const GolangStatus status) {
   // see trailers and no buffered data
   if (seen_trailers_ && isBufferDataEmpty()) {
     ENVOY_LOG(error, "see trailers and buffer is empty");
-    state_ = FilterState::WaitingTrailer;
+    setState(FilterState::WaitingTrailer);
   }
 
   ENVOY_LOG(debug, "golang filter after handle data status, state: {}, phase: {}, status: {}",
@@ -188,7 +198,7 @@ bool ProcessorState::handleTrailerGolangStatus(const GolangStatus status) {
     break;
 
   case GolangStatus::Continue:
-    state_ = FilterState::Done;
+    setState(FilterState::Done);
     done = true;
     break;
 
@@ -248,6 +258,58 @@ void ProcessorState::drainBufferData() {
       data_buffer_->drain(len);
     }
   }
+  reportBufferedBytes();
+}
+
+/* in-flight gauges */
+
+ProcessorState::~ProcessorState() {
+  auto gauge = stateGauge(state_);
+  if (gauge != nullptr) {
+    gauge->dec();
+  }
+  stats_.buffered_bytes_.sub(reported_bytes_);
+}
+
+Stats::Gauge* ProcessorState::stateGauge(FilterState state) {
+  switch (state) {
+  case FilterState::ProcessingHeader:
+    return &stats_.streams_processing_header_;
+  case FilterState::ProcessingData:
+    return &stats_.streams_processing_data_;
+  case FilterState::ProcessingTrailer:
+    return &stats_.streams_processing_trailer_;
+  case FilterState::WaitingAllData:
+    return &stats_.streams_waiting_all_data_;
+  default:
+    return nullptr;
+  }
+}
+
+void ProcessorState::setState(FilterState state) {
+  if (state == state_) {
+    return;
+  }
+  auto gauge = stateGauge(state_);
+  if (gauge != nullptr) {
+    gauge->dec();
+  }
+  gauge = stateGauge(state);
+  if (gauge != nullptr) {
+    gauge->inc();
+  }
+  state_ = state;
+  reportBufferedBytes();
+}
+
+void ProcessorState::reportBufferedBytes() {
+  uint64_t bytes = doDataList.length() + (data_buffer_ != nullptr ? data_buffer_->length() : 0);
+  if (bytes > reported_bytes_) {
+    stats_.buffered_bytes_.add(bytes - reported_bytes_);
+  } else if (bytes < reported_bytes_) {
+    stats_.buffered_bytes_.sub(reported_bytes_ - bytes);
+  }
+  reported_bytes_ = bytes;
 }
 
 std::string ProcessorState::stateStr() {
@@ -346,6 +408,7 @@ void DecodingProcessorState::addBufferData(Buffer::Instance& data) {
     data_buffer_->setWatermarks(decoder_callbacks_->decoderBufferLimit());
   }
   data_buffer_->move(data);
+  reportBufferedBytes();
 }
 
 void EncodingProcessorState::addBufferData(Buffer::Instance& data) {
@@ -378,6 +441,7 @@ void EncodingProcessorState::addBufferData(Buffer::Instance& data) {
     data_buffer_->setWatermarks(encoder_callbacks_->encoderBufferLimit());
   }
   data_buffer_->move(data);
+  reportBufferedBytes();
 }
 
 } // namespace Golang
@@ -6,6 +6,7 @@
 #include "envoy/buffer/buffer.h"
 #include "envoy/http/filter.h"
 #include "envoy/http/header_map.h"
+#include "envoy/stats/stats.h"
 
 #include "source/common/http/codes.h"
 #include "source/common/http/utility.h"
@@ -20,6 +21,7 @@ namespace HttpFilters {
 namespace Golang {
 
 class Filter;
+struct GolangFilterStats;
 
 class BufferList {
 public:
@@ -28,6 +30,8 @@ public:
   BufferList& operator=(const BufferList&) = delete;
 
   bool empty() const { return bytes_ == 0; }
+  // the current length of the buffers, they may be modified by Go after pushed.
+  uint64_t length() const;
   // return a new buffer instance, it will existing until moveOut or drain.
   Buffer::Instance& push(Buffer::Instance& data);
   // move all buffer into data, the list is empty then.
@@ -94,9 +98,9 @@ enum class GolangStatus {
 
 class ProcessorState : public Logger::Loggable<Logger::Id::http> {
 public:
-  explicit ProcessorState(Filter& filter) : filter_(filter) {}
+  ProcessorState(Filter& filter, GolangFilterStats& stats) : filter_(filter), stats_(stats) {}
   ProcessorState(const ProcessorState&) = delete;
-  virtual ~ProcessorState() = default;
+  virtual ~ProcessorState();
   ProcessorState& operator=(const ProcessorState&) = delete;
 
   FilterState state() const { return state_; }
@@ -122,6 +126,8 @@ public:
   Buffer::Instance& getBufferData() { return *data_buffer_.get(); };
   bool isBufferDataEmpty() { return data_buffer_ == nullptr || data_buffer_->length() == 0; };
   void drainBufferData();
+  // update the buffered bytes gauge by the delta since the last report of the stream.
+  void reportBufferedBytes();
 
   void setSeenTrailers() { seen_trailers_ = true; }
   bool isProcessingEndStream() { return do_end_stream_; }
@@ -134,27 +140,28 @@ public:
     }
     Buffer::OwnedImpl data_to_write;
     doDataList.moveOut(data_to_write);
+    reportBufferedBytes();
 
     injectDataToFilterChain(data_to_write, do_end_stream_);
   }
 
   void processHeader(bool end_stream) {
     ASSERT(state_ == FilterState::WaitingHeader);
-    state_ = FilterState::ProcessingHeader;
+    setState(FilterState::ProcessingHeader);
     do_end_stream_ = end_stream;
   }
 
   void processData(bool end_stream) {
     ASSERT(state_ == FilterState::WaitingData ||
            (state_ == FilterState::WaitingAllData && (end_stream || seen_trailers_)));
-    state_ = FilterState::ProcessingData;
+    setState(FilterState::ProcessingData);
     do_end_stream_ = end_stream;
   }
 
   void processTrailer() {
     ASSERT(state_ == FilterState::WaitingTrailer || state_ == FilterState::WaitingData ||
            state_ == FilterState::WaitingAllData);
-    state_ = FilterState::ProcessingTrailer;
+    setState(FilterState::ProcessingTrailer);
     do_end_stream_ = true;
   }
 
@@ -178,7 +185,14 @@ public:
 
 protected:
   Phase state2Phase();
+  // all of the state transitions go here, to update the in-flight gauges incrementally.
+  void setState(FilterState state);
+  Stats::Gauge* stateGauge(FilterState state);
+
   Filter& filter_;
+  GolangFilterStats& stats_;
+  // the buffered bytes of this state that counted in the gauge.
+  uint64_t reported_bytes_{0};
   Http::StreamFilterCallbacks* filter_callbacks_{nullptr};
   bool watermark_requested_{false};
   Buffer::InstancePtr data_buffer_{nullptr};
@@ -190,7 +204,8 @@ protected:
 
 class DecodingProcessorState : public ProcessorState {
 public:
-  explicit DecodingProcessorState(Filter& filter) : ProcessorState(filter) {}
+  DecodingProcessorState(Filter& filter, GolangFilterStats& stats)
+      : ProcessorState(filter, stats) {}
   DecodingProcessorState(const DecodingProcessorState&) = delete;
   DecodingProcessorState& operator=(const DecodingProcessorState&) = delete;
 
@@ -217,7 +232,7 @@ public:
     // it's safe to reset state_, since it is read/write in safe thread.
     ENVOY_LOG(debug, "golang filter phase grow to EncodeHeader and state grow to WaitHeader before "
                      "sendLocalReply");
-    state_ = FilterState::WaitingHeader;
+    setState(FilterState::WaitingHeader);
     decoder_callbacks_->sendLocalReply(response_code, body_text, modify_headers, grpc_status,
                                        details);
   };
@@ -228,7 +243,8 @@ private:
 
 class EncodingProcessorState : public ProcessorState {
 public:
-  explicit EncodingProcessorState(Filter& filter) : ProcessorState(filter) {}
+  EncodingProcessorState(Filter& filter, GolangFilterStats& stats)
+      : ProcessorState(filter, stats) {}
   EncodingProcessorState(const EncodingProcessorState&) = delete;
   EncodingProcessorState& operator=(const EncodingProcessorState&) = delete;
 
@@ -1,9 +1,16 @@
+#include <atomic>
+#include <filesystem>
+#include <memory>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include "src/envoy/common/dso/dso.h"
 
 #include "envoy/registry/registry.h"
 
+#include "absl/strings/str_cat.h"
+
 #include "test/test_common/utility.h"
 #include "test/test_common/environment.h"
 
@@ -25,7 +32,27 @@ std::string genSoPath(std::string name) {
 TEST(DsoInstanceTest, SimpleAPI) {
   auto path = genSoPath("simple.so");
   DsoInstance* dso = new DsoInstance(path);
-  EXPECT_EQ(dso->moeNewHttpPluginConfig(0, 0), 100);
+  EXPECT_EQ(dso->moeNewHttpPluginConfig(0, 0, 0, 0), 100);
+  EXPECT_TRUE(dso->moeOnWarmup());
+
+  RuntimeConfig runtime_config;
+  runtime_config.max_procs = 2;
+  runtime_config.has_gc_percent = true;
+  runtime_config.gc_percent = 200;
+  EXPECT_TRUE(dso->moeSetRuntimeConfig(runtime_config));
+  delete dso;
+}
+
+TEST(DsoInstanceTest, Profile) {
+  auto path = genSoPath("simple.so");
+  DsoInstance* dso = new DsoInstance(path);
+  EXPECT_TRUE(dso->supportProfile());
+  EXPECT_TRUE(dso->moeStartCPUProfile(1));
+  EXPECT_EQ("cpu", dso->moeStopCPUProfile());
+  EXPECT_EQ("heap", dso->moeWriteHeapProfile());
+  EXPECT_EQ("goroutine", dso->moeWriteGoroutineProfile(2));
+  // nil from Go means no profile.
+  EXPECT_EQ(absl::nullopt, dso->moeWriteGoroutineProfile(0));
   delete dso;
 }
 
@@ -50,6 +77,141 @@ TEST(DsoInstanceManagerTest, Pub) {
   EXPECT_EQ(res, false);
 }
 
+// reload the dso by new library paths, while the workers are using it.
+TEST(DsoInstanceManagerTest, ReloadUnderLoad) {
+  const std::string id = "reload";
+  const int versions = 4;
+
+  std::vector<std::string> paths;
+  for (int i = 0; i < versions; i++) {
+    // NP: a new version needs a new path, otherwise dlopen returns the same library.
+    auto path = TestEnvironment::temporaryPath("simple_" + std::to_string(i) + ".so");
+    std::filesystem::copy_file(genSoPath("simple.so"), path,
+                               std::filesystem::copy_options::overwrite_existing);
+    paths.push_back(path);
+  }
+
+  const size_t runtimes = DsoInstanceManager::runtimes();
+  EXPECT_TRUE(DsoInstanceManager::pub(id, paths[0]));
+
+  std::atomic<bool> stop{false};
+  std::atomic<uint64_t> calls{0};
+  std::vector<std::thread> workers;
+  for (int i = 0; i < 4; i++) {
+    workers.emplace_back([&]() {
+      while (!stop.load()) {
+        // the in-flight stream pins the version it got.
+        auto dso = DsoInstanceManager::getDsoInstanceByID(id);
+        ASSERT_NE(dso, nullptr);
+        for (int j = 0; j < 10; j++) {
+          EXPECT_EQ(dso->moeNewHttpPluginConfig(0, 0, 0, 0), 100);
+        }
+        calls++;
+      }
+    });
+  }
+
+  std::vector<std::weak_ptr<DsoInstance>> retired;
+  for (int i = 1; i < versions; i++) {
+    auto old = DsoInstanceManager::getDsoInstanceByID(id);
+    retired.push_back(old);
+
+    // the same path can not be published again.
+    EXPECT_FALSE(DsoInstanceManager::pub(id, old->name()));
+    EXPECT_TRUE(DsoInstanceManager::pub(id, paths[i]));
+    EXPECT_EQ(DsoInstanceManager::getDsoInstanceByID(id)->name(), paths[i]);
+
+    // let the workers run on both of the versions.
+    auto target = calls.load() + 100;
+    while (calls.load() < target) {
+      std::this_thread::yield();
+    }
+  }
+
+  stop = true;
+  for (auto& worker : workers) {
+    worker.join();
+  }
+
+  // the old versions are retired once nobody pins them.
+  for (auto& old : retired) {
+    EXPECT_TRUE(old.expired());
+  }
+  EXPECT_EQ(DsoInstanceManager::getDsoInstanceByID(id)->name(), paths[versions - 1]);
+
+  // but their Go runtimes are leaked, every version keeps its runtime loaded.
+  EXPECT_EQ(DsoInstanceManager::runtimes(), runtimes + versions);
+  auto json = DsoInstanceManager::show();
+  EXPECT_THAT(json, testing::HasSubstr(absl::StrCat("\"loaded_runtimes\": ", runtimes + versions)));
+  for (int i = 0; i < versions - 1; i++) {
+    EXPECT_THAT(json, testing::HasSubstr(absl::StrCat("\"", paths[i], "\"")));
+  }
+
+  // the reloads beyond the limit are refused, the current version keeps serving.
+  DsoInstanceManager::setMaxRuntimes(DsoInstanceManager::runtimes());
+  auto path = TestEnvironment::temporaryPath("simple_" + std::to_string(versions) + ".so");
+  std::filesystem::copy_file(genSoPath("simple.so"), path,
+                             std::filesystem::copy_options::overwrite_existing);
+  EXPECT_FALSE(DsoInstanceManager::pub(id, path));
+  EXPECT_EQ(DsoInstanceManager::getDsoInstanceByID(id)->name(), paths[versions - 1]);
+  // a path loaded before shares its runtime, so it's not limited.
+  EXPECT_TRUE(DsoInstanceManager::pub(id, paths[0]));
+  EXPECT_EQ(DsoInstanceManager::runtimes(), runtimes + versions);
+  DsoInstanceManager::setMaxRuntimes(DsoInstanceManager::DefaultMaxRuntimes);
+
+  EXPECT_TRUE(DsoInstanceManager::unpub(id));
+  EXPECT_EQ(DsoInstanceManager::getDsoInstanceByID(id), nullptr);
+}
+
+// the streams are counted per thread, and a stream may be destroyed in another thread.
+TEST(DsoInstanceTest, StreamsAcrossThreads) {
+  auto path = genSoPath("simple.so");
+  DsoInstance* dso = new DsoInstance(path);
+
+  std::vector<std::thread> workers;
+  for (int i = 0; i < 4; i++) {
+    workers.emplace_back([dso]() {
+      for (int j = 0; j < 1000; j++) {
+        dso->streamCreated();
+      }
+    });
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  EXPECT_EQ(dso->streams(), 4000);
+
+  std::thread destroyer([dso]() {
+    for (int j = 0; j < 3000; j++) {
+      dso->streamDestroyed();
+    }
+  });
+  destroyer.join();
+  EXPECT_EQ(dso->streams(), 1000);
+  delete dso;
+}
+
+TEST(DsoInstanceManagerTest, Show) {
+  const std::string id = "show";
+  auto path = TestEnvironment::temporaryPath("simple_show.so");
+  std::filesystem::copy_file(genSoPath("simple.so"), path,
+                             std::filesystem::copy_options::overwrite_existing);
+  EXPECT_TRUE(DsoInstanceManager::pub(id, path));
+
+  auto dso = DsoInstanceManager::getDsoInstanceByID(id);
+  dso->streamCreated();
+  EXPECT_THAT(dso->optionalSymbols(), testing::Contains("moeGetRuntimeStats"));
+
+  auto json = DsoInstanceManager::show();
+  EXPECT_THAT(json, testing::HasSubstr(absl::StrCat("\"path\": \"", path, "\"")));
+  EXPECT_THAT(json, testing::HasSubstr("\"streams\": 1"));
+  // the Go runtime stats of the library.
+  EXPECT_THAT(json, testing::HasSubstr("\"goroutines\": 1"));
+
+  dso->streamDestroyed();
+  EXPECT_TRUE(DsoInstanceManager::unpub(id));
+}
+
 } // namespace
 } // namespace Dso
 } // namespace Envoy
@@ -1,14 +1,18 @@
 package main
 
 /*
+#include <stdlib.h>
+
 typedef struct {
   int foo;
 } httpRequest;
 */
 import "C"
 
+import "unsafe"
+
 //export moeNewHttpPluginConfig
-func moeNewHttpPluginConfig(configPtr uint64, configLen uint64) uint64 {
+func moeNewHttpPluginConfig(namePtr uint64, nameLen uint64, configPtr uint64, configLen uint64) uint64 {
 	return 100
 }
 
@@ -32,12 +36,54 @@ func moeOnHttpData(r *C.httpRequest, endStream, buffer, length uint64) uint64 {
 }
 
 //export moeOnHttpSemaCallback
-func moeOnHttpSemaCallback(r *C.httpRequest) {
+func moeOnHttpSemaCallback(r *C.httpRequest, waiter unsafe.Pointer) {
 }
 
 //export moeOnHttpDestroy
 func moeOnHttpDestroy(r *C.httpRequest, reason uint64) {
 }
 
+//export moeOnWarmup
+func moeOnWarmup() uint64 {
+	return 0
+}
+
+//export moeSetRuntimeConfig
+func moeSetRuntimeConfig(maxProcs int64, setGCPercent uint64, gcPercent int64, memoryLimit int64) {
+}
+
+//export moeGetRuntimeStats
+func moeGetRuntimeStats() *C.char {
+	return C.CString(`{"goroutines":1}`)
+}
+
+func profileBytes(s string, length *uint64) unsafe.Pointer {
+	*length = uint64(len(s))
+	return C.CBytes([]byte(s))
+}
+
+//export moeStartCPUProfile
+func moeStartCPUProfile(seconds int64) uint64 {
+	return 0
+}
+
+//export moeStopCPUProfile
+func moeStopCPUProfile(length *uint64) unsafe.Pointer {
+	return profileBytes("cpu", length)
+}
+
+//export moeWriteHeapProfile
+func moeWriteHeapProfile(length *uint64) unsafe.Pointer {
+	return profileBytes("heap", length)
+}
+
+//export moeWriteGoroutineProfile
+func moeWriteGoroutineProfile(debug int64, length *uint64) unsafe.Pointer {
+	if debug == 0 {
+		return nil
+	}
+	return profileBytes("goroutine", length)
+}
+
 func main() {
 }
@@ -0,0 +1,129 @@
+// Note: this should be run with --compilation_mode=opt, and would benefit from a
+// quiescent system with disabled cstate power management.
+
+#include "source/common/grpc/context_impl.h"
+#include "source/common/stats/isolated_store_impl.h"
+#include "source/common/stats/symbol_table_impl.h"
+#include "source/common/thread_local/thread_local_impl.h"
+#include "src/envoy/http/golang/golang_filter.h"
+
+#include "test/test_common/environment.h"
+#include "test/test_common/utility.h"
+
+#include "absl/synchronization/blocking_counter.h"
+#include "benchmark/benchmark.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace HttpFilters {
+namespace Golang {
+namespace {
+
+const std::string PASSTHROUGH{"passthrough"};
+constexpr int MaxWorkers = 16;
+constexpr int StreamsPerWorker = 10000;
+
+// The workers run their own dispatchers and are registered in a real thread local instance,
+// like the workers of the server, so every worker reads its own thread local slot.
+class StreamCreationBench {
+public:
+  StreamCreationBench() : api_(Api::createApiForTest()), grpc_context_(symbol_table_) {
+    Dso::DsoInstanceManager::pub(PASSTHROUGH,
+                                 TestEnvironment::substitute(
+                                     "{{ test_rundir }}_go_extension/test/http/golang/test_data/" +
+                                     PASSTHROUGH + "/filter.so"));
+
+    main_dispatcher_ = api_->allocateDispatcher("main_thread");
+    tls_.registerThread(*main_dispatcher_, true);
+    for (int i = 0; i < MaxWorkers; i++) {
+      workers_.push_back(api_->allocateDispatcher(absl::StrCat("worker_", i)));
+      tls_.registerThread(*workers_.back(), false);
+    }
+
+    envoy::extensions::filters::http::golang::v3::Config proto_config;
+    TestUtility::loadFromYaml(R"EOF(
+    so_id: passthrough
+    plugin_name: xx
+    plugin_config:
+      "@type": type.googleapis.com/udpa.type.v1.TypedStruct
+      type_url: typexx
+    )EOF",
+                              proto_config);
+    config_ = std::make_shared<FilterConfig>(proto_config, "", stats_store_);
+    tls_config_ = std::make_shared<FilterConfig>(proto_config, "", stats_store_, tls_);
+
+    // the slot is set in the workers once they run.
+    for (auto& worker : workers_) {
+      threads_.push_back(api_->threadFactory().createThread(
+          [&worker]() { worker->run(Event::Dispatcher::RunType::RunUntilExit); }));
+    }
+  }
+
+  static StreamCreationBench& get() {
+    static StreamCreationBench* bench = new StreamCreationBench();
+    return *bench;
+  }
+
+  // create the streams in the workers concurrently, the same as the filter factory, every stream
+  // pins the filter config and the plugin config snapshot.
+  void run(const FilterConfigSharedPtr& config, int workers) {
+    absl::BlockingCounter done(workers);
+    for (int i = 0; i < workers; i++) {
+      workers_[i]->post([this, &config, &done]() {
+        // NP: the local stream id, the global one is not what it measures.
+        for (int id = 0; id < StreamsPerWorker; id++) {
+          auto filter =
+              std::make_shared<Filter>(grpc_context_, config, id, config->workerConfig());
+          benchmark::DoNotOptimize(filter);
+        }
+        done.DecrementCount();
+      });
+    }
+    done.Wait();
+  }
+
+  Api::ApiPtr api_;
+  Stats::SymbolTableImpl symbol_table_;
+  Grpc::ContextImpl grpc_context_;
+  Stats::IsolatedStoreImpl stats_store_{symbol_table_};
+  ThreadLocal::InstanceImpl tls_;
+  Event::DispatcherPtr main_dispatcher_;
+  std::vector<Event::DispatcherPtr> workers_;
+  std::vector<Thread::ThreadPtr> threads_;
+  FilterConfigSharedPtr config_;
+  FilterConfigSharedPtr tls_config_;
+};
+
+// The workers pin the one plugin config snapshot shared by all of them, the reference counting
+// of it contends across the workers, besides the one of the filter config.
+void bmStreamCreationBySharedConfig(benchmark::State& state) {
+  auto& bench = StreamCreationBench::get();
+  for (auto _ : state) { // NOLINT: Silences warning about dead store
+    bench.run(bench.config_, state.range(0));
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0) * StreamsPerWorker);
+}
+BENCHMARK(bmStreamCreationBySharedConfig)
+    ->RangeMultiplier(2)
+    ->Range(1, MaxWorkers)
+    ->UseRealTime();
+
+// Every worker pins its own plugin config copy from the thread local slot, which is what the
+// filter factory does, only the filter config is shared.
+void bmStreamCreationByThreadLocal(benchmark::State& state) {
+  auto& bench = StreamCreationBench::get();
+  for (auto _ : state) { // NOLINT: Silences warning about dead store
+    bench.run(bench.tls_config_, state.range(0));
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0) * StreamsPerWorker);
+}
+BENCHMARK(bmStreamCreationByThreadLocal)
+    ->RangeMultiplier(2)
+    ->Range(1, MaxWorkers)
+    ->UseRealTime();
+
+} // namespace
+} // namespace Golang
+} // namespace HttpFilters
+} // namespace Extensions
+} // namespace Envoy
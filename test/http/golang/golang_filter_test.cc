@@ -1,12 +1,17 @@
+#include <dlfcn.h>
+
 #include <cstdint>
+#include <filesystem>
 #include <memory>
 
 #include "envoy/config/core/v3/base.pb.h"
 
 #include "source/common/buffer/buffer_impl.h"
 #include "source/common/http/message_impl.h"
+#include "source/common/protobuf/utility.h"
 #include "source/common/stream_info/stream_info_impl.h"
 #include "src/envoy/http/golang/golang_filter.h"
+#include "src/envoy/http/golang/metrics.h"
 
 #include "absl/strings/str_format.h"
 
@@ -17,6 +22,7 @@
 #include "test/mocks/server/factory_context.h"
 #include "test/mocks/ssl/mocks.h"
 #include "test/mocks/thread_local/mocks.h"
+#include "test/mocks/tracing/mocks.h"
 #include "test/mocks/upstream/cluster_manager.h"
 #include "test/test_common/logging.h"
 #include "test/test_common/printers.h"
@@ -32,6 +38,7 @@ using testing::Eq;
 using testing::HasSubstr;
 using testing::InSequence;
 using testing::Invoke;
+using testing::NiceMock;
 using testing::Return;
 using testing::ReturnRef;
 using testing::StrEq;
@@ -104,7 +111,7 @@ public:
     envoy::extensions::filters::http::golang::v3::ConfigsPerRoute per_route_proto_config;
     setupDso();
     setupConfig(proto_config, per_route_proto_config);
-    setupFilter(soId);
+    setupFilter();
   }
 
   std::string genSoPath(std::string name) {
@@ -119,18 +126,18 @@ public:
       envoy::extensions::filters::http::golang::v3::Config& proto_config,
       envoy::extensions::filters::http::golang::v3::ConfigsPerRoute& per_route_proto_config) {
     // Setup filter config for Lua filter.
-    config_ = std::make_shared<FilterConfig>(proto_config);
+    config_ = std::make_shared<FilterConfig>(proto_config, "", stats_store_);
     // Setup per route config for Lua filter.
     per_route_config_ =
         std::make_shared<FilterConfigPerRoute>(per_route_proto_config, server_factory_context_);
   }
 
-  void setupFilter(const std::string& soId) {
+  void setupFilter() {
     Event::SimulatedTimeSystem test_time;
     test_time.setSystemTime(std::chrono::microseconds(1583879145572237));
 
     filter_ = std::make_unique<TestFilter>(server_factory_context_.grpcContext(), config_, 1,
-                                           Dso::DsoInstanceManager::getDsoInstanceByID(soId));
+                                           config_->workerConfig());
     filter_->setDecoderFilterCallbacks(decoder_callbacks_);
     filter_->setEncoderFilterCallbacks(encoder_callbacks_);
   }
@@ -178,6 +185,490 @@ TEST_F(GolangHttpFilterTest, ScriptHeadersOnlyRequestHeadersOnly) {
   EXPECT_EQ(0, stats_store_.counter("test.golang.errors").value());
 }
 
+// the time of calling into Go is recorded per phase, the sync phase has no async time.
+TEST_F(GolangHttpFilterTest, PhaseHistograms) {
+  setup(PASSTHROUGH);
+
+  Http::TestRequestHeaderMapImpl request_headers{{":path", "/"}};
+  EXPECT_EQ(Http::FilterHeadersStatus::Continue, filter_->decodeHeaders(request_headers, true));
+  EXPECT_EQ(1, stats_store_.counter("golang.xx.crossings").value());
+  EXPECT_EQ(1U, stats_store_.histogramValues("golang.xx.decode_header_sync_time", false).size());
+  EXPECT_EQ(1U, stats_store_.histogramValues("golang.xx.decode_header_go_time", false).size());
+  EXPECT_EQ(stats_store_.histogramValues("golang.xx.decode_header_sync_time", false),
+            stats_store_.histogramValues("golang.xx.decode_header_go_time", false));
+  EXPECT_FALSE(stats_store_.histogramRecordedValues("golang.xx.decode_header_async_time"));
+  EXPECT_FALSE(stats_store_.histogramRecordedValues("golang.xx.encode_header_go_time"));
+}
+
+// the plugin configs should be destroyed in Go once the filter and route configs are updated.
+TEST_F(GolangHttpFilterTest, ConfigUpdateSoak) {
+  setup(PASSTHROUGH);
+
+  // the runtime stats of the library, the same ones served on the admin interface.
+  auto dso = Dso::DsoInstanceManager::getDsoInstanceByID(PASSTHROUGH);
+  ASSERT_NE(dso, nullptr);
+  auto runtime_stat = [&dso](const std::string& name) -> uint64_t {
+    ProtobufWkt::Struct stats;
+    MessageUtil::loadFromJson(dso->moeGetRuntimeStats(), stats);
+    return stats.fields().at(name).number_value();
+  };
+  auto config_count = [&] { return runtime_stat("plugin_configs"); };
+  auto heap_inuse = [&] { return runtime_stat("heap_inuse_bytes"); };
+
+  const auto yaml_fmt = R"EOF(
+    so_id: %s
+    plugin_name: xx
+    merge_policy: MERGE_VIRTUALHOST_ROUTER_FILTER
+    plugin_config:
+      "@type": type.googleapis.com/udpa.type.v1.TypedStruct
+      type_url: typexx
+      value:
+          version: %d
+    )EOF";
+  const auto route_yaml_fmt = R"EOF(
+    plugins_config:
+      xx:
+        config:
+          "@type": type.googleapis.com/udpa.type.v1.TypedStruct
+          type_url: typexx
+          value:
+            version: %d
+    )EOF";
+
+  ON_CALL(decoder_callbacks_, mostSpecificPerFilterConfig())
+      .WillByDefault(Invoke([this]() { return per_route_config_.get(); }));
+  ON_CALL(decoder_callbacks_, traversePerFilterConfig(_))
+      .WillByDefault(
+          Invoke([this](std::function<void(const Router::RouteSpecificFilterConfig&)> cb) {
+            cb(*per_route_config_);
+          }));
+
+  auto update = [&](int version) {
+    filter_->onDestroy();
+    filter_.reset();
+
+    envoy::extensions::filters::http::golang::v3::Config proto_config;
+    TestUtility::loadFromYaml(absl::StrFormat(yaml_fmt, PASSTHROUGH, version), proto_config);
+    envoy::extensions::filters::http::golang::v3::ConfigsPerRoute per_route_proto_config;
+    TestUtility::loadFromYaml(absl::StrFormat(route_yaml_fmt, version), per_route_proto_config);
+    setupConfig(proto_config, per_route_proto_config);
+    setupFilter();
+
+    Http::TestRequestHeaderMapImpl request_headers{{":path", "/"}};
+    EXPECT_EQ(Http::FilterHeadersStatus::Continue, filter_->decodeHeaders(request_headers, true));
+  };
+
+  for (int i = 0; i < 1000; i++) {
+    update(i);
+  }
+  // the identical filter and route configs share one config, and the merged one.
+  auto count = config_count();
+  EXPECT_EQ(2U, count);
+  EXPECT_EQ(2U, PluginConfigTable::size());
+  auto heap = heap_inuse();
+
+  for (int i = 1000; i < 10000; i++) {
+    update(i);
+  }
+  EXPECT_EQ(count, config_count());
+  EXPECT_EQ(2U, PluginConfigTable::size());
+  // allow some noise from the Go runtime, and the garbage of a GC cycle, since the heap is not
+  // collected before it's read, the leaked configs would take far more.
+  EXPECT_LT(heap_inuse(), heap + 8 * 1024 * 1024);
+}
+
+// identical plugin configs share one config in Go.
+TEST_F(GolangHttpFilterTest, ConfigDedup) {
+  setup(PASSTHROUGH);
+
+  const auto yaml_fmt = R"EOF(
+    so_id: %s
+    plugin_name: %s
+    plugin_config:
+      "@type": type.googleapis.com/udpa.type.v1.TypedStruct
+      type_url: typexx
+      value:
+          key: %s
+    )EOF";
+  auto new_config = [&](const std::string& plugin_name, const std::string& value) {
+    envoy::extensions::filters::http::golang::v3::Config proto_config;
+    TestUtility::loadFromYaml(absl::StrFormat(yaml_fmt, PASSTHROUGH, plugin_name, value),
+                              proto_config);
+    return std::make_shared<FilterConfig>(proto_config, "", stats_store_);
+  };
+
+  auto config1 = new_config("dedup", "a");
+  auto config2 = new_config("dedup", "a");
+  auto config3 = new_config("dedup", "b");
+  auto config4 = new_config("dedup2", "a");
+  EXPECT_EQ(config1->getPluginConfig()->configId(), config2->getPluginConfig()->configId());
+  EXPECT_NE(config1->getPluginConfig()->configId(), config3->getPluginConfig()->configId());
+  EXPECT_NE(config1->getPluginConfig()->configId(), config4->getPluginConfig()->configId());
+
+  // it's still alive after one of the references released.
+  auto config_id = config1->getPluginConfig()->configId();
+  config1.reset();
+  EXPECT_EQ(config_id, config2->getPluginConfig()->configId());
+  EXPECT_EQ(config_id, new_config("dedup", "a")->getPluginConfig()->configId());
+
+  // a new one is parsed after all of the references released.
+  config2.reset();
+  EXPECT_NE(config_id, new_config("dedup", "a")->getPluginConfig()->configId());
+}
+
+// the merged configs of the filter configs gone are dropped, while the route config is kept.
+TEST_F(GolangHttpFilterTest, MergedConfigPruned) {
+  setup(PASSTHROUGH);
+
+  const auto yaml_fmt = R"EOF(
+    so_id: %s
+    plugin_name: xx
+    plugin_config:
+      "@type": type.googleapis.com/udpa.type.v1.TypedStruct
+      type_url: typexx
+      value:
+          version: %d
+    )EOF";
+  envoy::extensions::filters::http::golang::v3::ConfigsPerRoute per_route_proto_config;
+  TestUtility::loadFromYaml(R"EOF(
+    plugins_config:
+      xx:
+        config:
+          "@type": type.googleapis.com/udpa.type.v1.TypedStruct
+          type_url: typexx
+          value:
+            route: true
+    )EOF",
+                            per_route_proto_config);
+  per_route_config_ =
+      std::make_shared<FilterConfigPerRoute>(per_route_proto_config, server_factory_context_);
+
+  ON_CALL(decoder_callbacks_, mostSpecificPerFilterConfig())
+      .WillByDefault(Invoke([this]() { return per_route_config_.get(); }));
+  ON_CALL(decoder_callbacks_, traversePerFilterConfig(_))
+      .WillByDefault(
+          Invoke([this](std::function<void(const Router::RouteSpecificFilterConfig&)> cb) {
+            cb(*per_route_config_);
+          }));
+
+  for (int i = 0; i < 100; i++) {
+    filter_->onDestroy();
+    filter_.reset();
+
+    envoy::extensions::filters::http::golang::v3::Config proto_config;
+    TestUtility::loadFromYaml(absl::StrFormat(yaml_fmt, PASSTHROUGH, i), proto_config);
+    config_ = std::make_shared<FilterConfig>(proto_config, "", stats_store_);
+    setupFilter();
+
+    Http::TestRequestHeaderMapImpl request_headers{{":path", "/"}};
+    EXPECT_EQ(Http::FilterHeadersStatus::Continue, filter_->decodeHeaders(request_headers, true));
+    // the one of the previous filter config is dropped once the new one is merged.
+    EXPECT_EQ(1U, per_route_config_->mergedConfigs());
+  }
+}
+
+// the plugin config is read from the thread local snapshot, and updated by the new version.
+TEST_F(GolangHttpFilterTest, ThreadLocalPluginConfig) {
+  setup(PASSTHROUGH);
+
+  envoy::extensions::filters::http::golang::v3::Config proto_config;
+  TestUtility::loadFromYaml(absl::StrFormat(R"EOF(
+    so_id: %s
+    plugin_name: xx
+    plugin_config:
+      "@type": type.googleapis.com/udpa.type.v1.TypedStruct
+      type_url: typexx
+    )EOF",
+                                            PASSTHROUGH),
+                            proto_config);
+  auto config = std::make_shared<FilterConfig>(proto_config, "", stats_store_, tls_);
+
+  auto dso = Dso::DsoInstanceManager::getDsoInstanceByID(PASSTHROUGH);
+  auto plugin_config = config->getPluginConfig();
+  ASSERT_NE(plugin_config, nullptr);
+  EXPECT_EQ(dso, plugin_config->dso());
+  EXPECT_EQ(dso, config->getDso());
+
+  // publish a new version of the dso.
+  auto path = TestEnvironment::temporaryPath("passthrough_v2.so");
+  std::filesystem::copy_file(genSoPath(PASSTHROUGH), path,
+                             std::filesystem::copy_options::overwrite_existing);
+  EXPECT_TRUE(Dso::DsoInstanceManager::pub(PASSTHROUGH, path));
+  auto new_dso = Dso::DsoInstanceManager::getDsoInstanceByID(PASSTHROUGH);
+  EXPECT_NE(dso, new_dso);
+  EXPECT_EQ(new_dso, config->getDso());
+  EXPECT_NE(plugin_config, config->getPluginConfig());
+  // the old one is still pinned by the in-flight users.
+  EXPECT_EQ(dso, plugin_config->dso());
+}
+
+// the route plugin config is parsed in the main thread when the plugin is bound to a dso, the
+// workers only look it up, for the current and the previous versions of the dso.
+TEST_F(GolangHttpFilterTest, RoutePluginConfigVersions) {
+  setup(PASSTHROUGH);
+
+  envoy::extensions::filters::http::golang::v3::RouterPlugin proto_config;
+  TestUtility::loadFromYaml(R"EOF(
+    config:
+      "@type": type.googleapis.com/udpa.type.v1.TypedStruct
+      type_url: typexx
+      value:
+        route: versions
+    )EOF",
+                            proto_config);
+  RoutePluginConfig route_config("route_versions", proto_config);
+
+  auto publish = [this](int version) {
+    auto path = TestEnvironment::temporaryPath(absl::StrCat("passthrough_route_", version, ".so"));
+    std::filesystem::copy_file(genSoPath(PASSTHROUGH), path,
+                               std::filesystem::copy_options::overwrite_existing);
+    EXPECT_TRUE(Dso::DsoInstanceManager::pub(PASSTHROUGH, path));
+    auto dso = Dso::DsoInstanceManager::getDsoInstanceByID(PASSTHROUGH);
+    PluginBindings::bind("route_versions", PASSTHROUGH, dso);
+    return dso;
+  };
+
+  // not bound yet, it's not parsed by the lookup.
+  auto dso = Dso::DsoInstanceManager::getDsoInstanceByID(PASSTHROUGH);
+  EXPECT_EQ(nullptr, route_config.getPluginConfig(PASSTHROUGH, dso));
+
+  auto dso1 = publish(1);
+  auto config1 = route_config.getPluginConfig(PASSTHROUGH, dso1);
+  ASSERT_NE(nullptr, config1);
+  EXPECT_EQ(dso1, config1->dso());
+
+  auto dso2 = publish(2);
+  EXPECT_EQ(dso2, route_config.getPluginConfig(PASSTHROUGH, dso2)->dso());
+  EXPECT_EQ(config1, route_config.getPluginConfig(PASSTHROUGH, dso1));
+
+  auto dso3 = publish(3);
+  EXPECT_NE(nullptr, route_config.getPluginConfig(PASSTHROUGH, dso3));
+  EXPECT_NE(nullptr, route_config.getPluginConfig(PASSTHROUGH, dso2));
+  EXPECT_EQ(nullptr, route_config.getPluginConfig(PASSTHROUGH, dso1));
+}
+
+// the route CPU time counters are created once per route, with the sanitized route names.
+TEST_F(GolangHttpFilterTest, RouteCpuTimeCounter) {
+  setup(PASSTHROUGH);
+
+  auto& counter = config_->routeCpuTimeCounter("a.b:c");
+  EXPECT_EQ("golang.xx.route.a_b_c.cpu_time_us", counter.name());
+  EXPECT_EQ(&counter, &config_->routeCpuTimeCounter("a.b:c"));
+  EXPECT_EQ("golang.xx.route.unnamed.cpu_time_us", config_->routeCpuTimeCounter("").name());
+
+  // the routes beyond the limit share the "other" one.
+  for (int i = 0; i < 1024; i++) {
+    config_->routeCpuTimeCounter(absl::StrCat("route", i));
+  }
+  EXPECT_EQ("golang.xx.route.other.cpu_time_us",
+            config_->routeCpuTimeCounter("one more").name());
+  EXPECT_EQ("golang.xx.route.a_b_c.cpu_time_us", config_->routeCpuTimeCounter("a.b:c").name());
+}
+
+TEST(DecisionCacheTest, LruAndExpire) {
+  Stats::TestUtil::TestStore stats_store;
+  GolangFilterStats stats{ALL_GOLANG_FILTER_STATS(POOL_COUNTER_PREFIX(stats_store, "golang."),
+                                                  POOL_GAUGE_PREFIX(stats_store, "golang."),
+                                                  POOL_HISTOGRAM_PREFIX(stats_store, "golang."))};
+  DecisionCache cache(2, stats);
+  MonotonicTime now;
+  auto expire = now + std::chrono::seconds(1);
+
+  EXPECT_EQ(nullptr, cache.lookup("a", now));
+  cache.insert("a", std::make_shared<DecisionCache::Decision>(), expire);
+  cache.insert("b", std::make_shared<DecisionCache::Decision>(), expire);
+  EXPECT_NE(nullptr, cache.lookup("a", now));
+
+  // b is the least recently used one.
+  cache.insert("c", std::make_shared<DecisionCache::Decision>(), expire);
+  EXPECT_EQ(2, cache.size());
+  EXPECT_EQ(nullptr, cache.lookup("b", now));
+  EXPECT_NE(nullptr, cache.lookup("c", now));
+
+  // expired.
+  EXPECT_EQ(nullptr, cache.lookup("a", expire));
+  EXPECT_EQ(1, cache.size());
+
+  EXPECT_EQ(2, stats_store.counterFromString("golang.decision_cache_hit").value());
+  EXPECT_EQ(3, stats_store.counterFromString("golang.decision_cache_miss").value());
+  EXPECT_EQ(3, stats_store.counterFromString("golang.decision_cache_insert").value());
+  EXPECT_EQ(1, stats_store.counterFromString("golang.decision_cache_eviction").value());
+  EXPECT_EQ(1, stats_store.counterFromString("golang.decision_cache_expired").value());
+}
+
+TEST(CpuBudgetTest, Window) {
+  CpuBudget budget(std::chrono::seconds(10), 20);
+  MonotonicTime now = MonotonicTime() + std::chrono::hours(1);
+  EXPECT_FALSE(budget.exceeded(now));
+
+  // 2s of 10s is allowed.
+  budget.charge(now, std::chrono::seconds(1));
+  EXPECT_FALSE(budget.exceeded(now));
+  budget.charge(now + std::chrono::seconds(1), std::chrono::milliseconds(1500));
+  EXPECT_TRUE(budget.exceeded(now + std::chrono::seconds(2)));
+
+  // still over the budget in the next window, since the last one exceeded.
+  now += std::chrono::seconds(10);
+  EXPECT_TRUE(budget.exceeded(now));
+  budget.charge(now, std::chrono::milliseconds(100));
+
+  // the last window is under the budget.
+  now += std::chrono::seconds(10);
+  EXPECT_FALSE(budget.exceeded(now));
+
+  // the windows without any CPU time are under the budget.
+  budget.charge(now, std::chrono::seconds(3));
+  EXPECT_TRUE(budget.exceeded(now));
+  EXPECT_FALSE(budget.exceeded(now + std::chrono::seconds(25)));
+}
+
+TEST(GoMetricsTest, Flush) {
+  Stats::TestUtil::TestStore store;
+  NiceMock<Event::MockDispatcher> dispatcher;
+  GoMetrics metrics(store, dispatcher);
+
+  auto counter = GoMetrics::define(MetricType::Counter, "test", "counter");
+  auto gauge = GoMetrics::define(MetricType::Gauge, "test", "gauge");
+  auto histogram = GoMetrics::define(MetricType::Histogram, "test", "histogram");
+  // the same name gets the same slot, but not with another type.
+  EXPECT_EQ(counter, GoMetrics::define(MetricType::Counter, "test", "counter"));
+  EXPECT_EQ(nullptr, GoMetrics::define(MetricType::Gauge, "test", "counter"));
+
+  // updated by Go.
+  counter->value_ += 3;
+  gauge->value_ = 7;
+  uint64_t values[] = {10, 20};
+  GoMetrics::record(*histogram, values, 2);
+  metrics.flush();
+  EXPECT_EQ(3, store.counterFromString("golang.test.counter").value());
+  EXPECT_EQ(7, store.gaugeFromString("golang.test.gauge", Stats::Gauge::ImportMode::Accumulate)
+                   .value());
+  EXPECT_EQ(std::vector<uint64_t>({10, 20}), store.histogramValues("golang.test.histogram", true));
+
+  // only the delta since the last flush is added.
+  counter->value_ += 2;
+  metrics.flush();
+  EXPECT_EQ(5, store.counterFromString("golang.test.counter").value());
+  EXPECT_TRUE(store.histogramValues("golang.test.histogram", false).empty());
+}
+
+TEST(GoMetricsTest, PendingLimit) {
+  auto histogram = GoMetrics::define(MetricType::Histogram, "test", "pending");
+  std::vector<uint64_t> values(GoMetrics::MaxPendingValues + 10, 1);
+  // nobody flushes the values without GoMetrics.
+  GoMetrics::record(*histogram, values.data(), values.size());
+  EXPECT_TRUE(histogram->pending_.empty());
+
+  Stats::TestUtil::TestStore store;
+  NiceMock<Event::MockDispatcher> dispatcher;
+  GoMetrics metrics(store, dispatcher);
+  // too many values before the next flush.
+  GoMetrics::record(*histogram, values.data(), values.size());
+  GoMetrics::record(*histogram, values.data(), 1);
+  EXPECT_EQ(GoMetrics::MaxPendingValues, histogram->pending_.size());
+  metrics.flush();
+  EXPECT_TRUE(histogram->pending_.empty());
+}
+
+TEST(GoLogTest, Batch) {
+  LogLevelSetter save_levels(spdlog::level::info);
+  // Go filters the records by the level of the http logger.
+  EXPECT_EQ(static_cast<int>(spdlog::level::info), moeLogLevel());
+
+  std::vector<uint8_t> levels = {spdlog::level::info, spdlog::level::warn, spdlog::level::debug};
+  std::vector<GoString> messages = {{"first", 5}, {"second", 6}, {"third", 5}};
+  GoSlice level_slice{levels.data(), 3, 3};
+  GoSlice message_slice{messages.data(), 3, 3};
+  // every record of the batch is logged with its own level.
+  EXPECT_LOG_CONTAINS_ALL_OF(
+      Envoy::ExpectedLogMessages({{"info", "golang: first"}, {"warn", "golang: second"}}),
+      moeLogBatch(&level_slice, &message_slice));
+  // the level may be raised after Go queued the record.
+  EXPECT_LOG_NOT_CONTAINS("debug", "golang: third", moeLogBatch(&level_slice, &message_slice));
+}
+
+TEST(StringArenaTest, StableViews) {
+  StringArena arena;
+  std::vector<absl::string_view> views;
+  std::vector<std::string> values;
+  for (int i = 0; i < 200; i++) {
+    values.push_back(std::string(i % 17, 'a' + i % 26));
+    views.push_back(arena.copy(values.back()));
+  }
+  // large value takes a dedicated block.
+  values.push_back(std::string(4096, 'x'));
+  views.push_back(arena.copy(values.back()));
+
+  // all of the views are still valid after later allocations.
+  for (size_t i = 0; i < values.size(); i++) {
+    EXPECT_EQ(values[i], views[i]);
+  }
+}
+
+// encodes the span batch in the same way as Go.
+class SpanBatchBuilder {
+public:
+  SpanBatchBuilder& tag(absl::string_view key, absl::string_view value) {
+    batch_.push_back('t');
+    return str(key).str(value);
+  }
+  SpanBatchBuilder& span(absl::string_view name, uint64_t start_ns, uint64_t end_ns,
+                         uint32_t tags) {
+    batch_.push_back('s');
+    return str(name).num(start_ns, 8).num(end_ns, 8).num(tags, 4);
+  }
+  SpanBatchBuilder& str(absl::string_view value) {
+    num(value.size(), 4);
+    batch_.append(value.data(), value.size());
+    return *this;
+  }
+  SpanBatchBuilder& num(uint64_t value, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+      batch_.push_back(static_cast<char>(value >> (i * 8)));
+    }
+    return *this;
+  }
+  const std::string& batch() const { return batch_; }
+
+private:
+  std::string batch_;
+};
+
+TEST(SpanBatchTest, Apply) {
+  // the values may contain any bytes, since the fields are length prefixed.
+  const std::string value("a,b\0c", 5);
+  auto batch = SpanBatchBuilder()
+                   .tag("key", value)
+                   .span("child", 1000000, 3000000, 2)
+                   .str("k1")
+                   .str("v1")
+                   .str("k2")
+                   .str("")
+                   .tag("last", "t")
+                   .batch();
+
+  NiceMock<Tracing::MockSpan> span;
+  auto* child = new NiceMock<Tracing::MockSpan>();
+  InSequence s;
+  EXPECT_CALL(span, setTag(Eq("key"), Eq(value)));
+  EXPECT_CALL(span, spawnChild_(_, "child", SystemTime(std::chrono::milliseconds(1))))
+      .WillOnce(Return(child));
+  EXPECT_CALL(*child, setTag(Eq("k1"), Eq("v1")));
+  EXPECT_CALL(*child, setTag(Eq("k2"), Eq("")));
+  EXPECT_CALL(*child, setTag(Eq("golang.duration_us"), Eq("2000")));
+  EXPECT_CALL(*child, finishSpan());
+  EXPECT_CALL(span, setTag(Eq("last"), Eq("t")));
+  EXPECT_TRUE(Filter::applySpanBatch(span, batch));
+}
+
+TEST(SpanBatchTest, Truncated) {
+  auto batch = SpanBatchBuilder().tag("key", "value").batch();
+  NiceMock<Tracing::MockSpan> span;
+  EXPECT_CALL(span, setTag(_, _)).Times(0);
+  EXPECT_FALSE(Filter::applySpanBatch(span, batch.substr(0, batch.size() - 1)));
+  EXPECT_FALSE(Filter::applySpanBatch(span, "x"));
+}
+
 } // namespace
 } // namespace Golang
 } // namespace HttpFilters
@@ -1,10 +1,14 @@
 #include "envoy/config/bootstrap/v3/bootstrap.pb.h"
 #include "envoy/extensions/filters/network/http_connection_manager/v3/http_connection_manager.pb.h"
 
+#include "source/common/protobuf/utility.h"
+
 #include "test/config/v2_link_hacks.h"
 #include "test/integration/http_integration.h"
+#include "test/test_common/logging.h"
 #include "test/test_common/utility.h"
 
+#include "gmock/gmock.h"
 #include "gtest/gtest.h"
 
 using Envoy::Http::HeaderValueOf;
@@ -133,12 +137,59 @@ public:
           new_route2->mutable_typed_per_filter_config()->insert(
               Protobuf::MapPair<std::string, Protobuf::Any>(key, value2));
           new_route2->mutable_route()->set_cluster("cluster_0");
+
+          // partial configs, to tell the merge policies apart
+          // virtualhost: set: bar2
+          // route: remove: x-test-header-0
+          const std::string yaml3 =
+              R"EOF(
+              "@type": type.googleapis.com/envoy.extensions.filters.http.golang.v3.ConfigsPerRoute
+              plugins_config:
+                xx:
+                  config:
+                    "@type": type.googleapis.com/udpa.type.v1.TypedStruct
+                    type_url: typexx
+                    value:
+                      set: bar2
+              )EOF";
+          Protobuf::Any value3;
+          TestUtility::loadFromYaml(yaml3, value3);
+
+          const std::string yaml4 =
+              R"EOF(
+              "@type": type.googleapis.com/envoy.extensions.filters.http.golang.v3.ConfigsPerRoute
+              plugins_config:
+                xx:
+                  config:
+                    "@type": type.googleapis.com/udpa.type.v1.TypedStruct
+                    type_url: typexx
+                    value:
+                      remove: x-test-header-0
+              )EOF";
+          Protobuf::Any value4;
+          TestUtility::loadFromYaml(yaml4, value4);
+
+          auto* partial_vh = hcm.mutable_route_config()->add_virtual_hosts();
+          partial_vh->add_domains("partial.com");
+          partial_vh->set_name("partial.com");
+          partial_vh->mutable_typed_per_filter_config()->insert(
+              Protobuf::MapPair<std::string, Protobuf::Any>(key, value3));
+          auto* partial_rt = partial_vh->add_routes();
+          partial_rt->mutable_match()->set_prefix("/route-config-test");
+          partial_rt->mutable_typed_per_filter_config()->insert(
+              Protobuf::MapPair<std::string, Protobuf::Any>(key, value4));
+          partial_rt->mutable_route()->set_cluster("cluster_0");
+          partial_rt = partial_vh->add_routes();
+          partial_rt->mutable_match()->set_prefix("/test");
+          partial_rt->mutable_route()->set_cluster("cluster_0");
         });
 
     initialize();
   }
 
-  void initializeSimpleFilter(const std::string& so_id) {
+  void initializeSimpleFilter(const std::string& so_id,
+                              const std::string& merge_policy = "MERGE_VIRTUALHOST_ROUTER_FILTER",
+                              const std::string& plugin_name = "xx", bool speculative = false) {
     addDso(so_id);
 
     const auto yaml_fmt = R"EOF(
@@ -146,8 +197,9 @@ name: golang
 typed_config:
   "@type": type.googleapis.com/envoy.extensions.filters.http.golang.v3.Config
   so_id: %s
-  plugin_name: xx
-  merge_policy: MERGE_VIRTUALHOST_ROUTER_FILTER
+  plugin_name: %s
+  merge_policy: %s
+  speculative: %s
   plugin_config:
     "@type": type.googleapis.com/udpa.type.v1.TypedStruct
     type_url: typexx
@@ -156,7 +208,8 @@ typed_config:
       set: foo
 )EOF";
 
-    auto yaml_string = absl::StrFormat(yaml_fmt, so_id);
+    auto yaml_string = absl::StrFormat(yaml_fmt, so_id, plugin_name, merge_policy,
+                                       speculative ? "true" : "false");
     initializeFilter(yaml_string, "test.com");
   }
 
@@ -508,8 +561,9 @@ typed_config:
   }
 
   void testRouteConfig(std::string domain, std::string path, bool header_0_existing,
-                       std::string set_header) {
-    initializeSimpleFilter(ROUTECONFIG);
+                       std::string set_header,
+                       std::string merge_policy = "MERGE_VIRTUALHOST_ROUTER_FILTER") {
+    initializeSimpleFilter(ROUTECONFIG, merge_policy);
 
     codec_client_ = makeHttpConnection(makeClientConnection(lookupPort("http")));
     Http::TestRequestHeaderMapImpl request_headers{
@@ -536,6 +590,407 @@ typed_config:
     cleanup();
   }
 
+  // the named plugin hosted in the same library, the route configs of the plugin xx are ignored.
+  void testNamedPlugin(std::string domain, std::string path) {
+    initializeSimpleFilter(ROUTECONFIG, "MERGE_VIRTUALHOST_ROUTER_FILTER", "named");
+
+    codec_client_ = makeHttpConnection(makeClientConnection(lookupPort("http")));
+    Http::TestRequestHeaderMapImpl request_headers{
+        {":method", "GET"}, {":path", path}, {":scheme", "http"}, {":authority", domain}};
+
+    auto encoder_decoder = codec_client_->startRequest(request_headers, true);
+    auto response = std::move(encoder_decoder.second);
+
+    waitForNextUpstreamRequest();
+
+    Http::TestResponseHeaderMapImpl response_headers{
+        {":status", "200"}, {"x-test-header-0", "foo"}, {"x-test-header-1", "bar"}};
+    upstream_request_->encodeHeaders(response_headers, true);
+
+    ASSERT_TRUE(response->waitForEndStream());
+
+    EXPECT_TRUE(response->headers().get(Http::LowerCaseString("x-test-header-0")).empty());
+    auto values = response->headers().get(Http::LowerCaseString("foo"));
+    EXPECT_EQ("named-value", values.empty() ? "" : values[0]->value().getStringView());
+    cleanup();
+  }
+
+  // the default plugin and the named plugin in one chain.
+  void testChain(bool fan_out) {
+    addDso(ROUTECONFIG);
+
+    const auto yaml_fmt = R"EOF(
+name: golang
+typed_config:
+  "@type": type.googleapis.com/envoy.extensions.filters.http.golang.v3.Config
+  so_id: %s
+  plugin_name: chain
+  plugin_config:
+    "@type": type.googleapis.com/envoy.extensions.filters.http.golang.v3.Chain
+    fan_out: %s
+    plugins:
+    - plugin_name: xx
+      plugin_config:
+        "@type": type.googleapis.com/udpa.type.v1.TypedStruct
+        type_url: typexx
+        value:
+          remove: x-test-header-0
+          set: foo
+    - plugin_name: named
+      plugin_config:
+        "@type": type.googleapis.com/udpa.type.v1.TypedStruct
+        type_url: typexx
+        value:
+          set: foo
+)EOF";
+    initializeFilter(absl::StrFormat(yaml_fmt, ROUTECONFIG, fan_out ? "true" : "false"),
+                     "test.com");
+
+    codec_client_ = makeHttpConnection(makeClientConnection(lookupPort("http")));
+    Http::TestRequestHeaderMapImpl request_headers{
+        {":method", "GET"}, {":path", "/test"}, {":scheme", "http"}, {":authority", "test.com"}};
+
+    auto encoder_decoder = codec_client_->startRequest(request_headers, true);
+    auto response = std::move(encoder_decoder.second);
+
+    waitForNextUpstreamRequest();
+
+    // the request header mutations are applied in the declared order.
+    auto values = upstream_request_->headers().get(Http::LowerCaseString("foo"));
+    EXPECT_EQ("named-value", values.empty() ? "" : values[0]->value().getStringView());
+
+    Http::TestResponseHeaderMapImpl response_headers{
+        {":status", "200"}, {"x-test-header-0", "foo"}, {"x-test-header-1", "bar"}};
+    upstream_request_->encodeHeaders(response_headers, true);
+
+    ASSERT_TRUE(response->waitForEndStream());
+
+    // the encode phases run in the reverse order.
+    EXPECT_TRUE(response->headers().get(Http::LowerCaseString("x-test-header-0")).empty());
+    values = response->headers().get(Http::LowerCaseString("foo"));
+    EXPECT_EQ("test-value", values.empty() ? "" : values[0]->value().getStringView());
+    cleanup();
+  }
+
+  // the first rejection in the fan out replies at once, without waiting for the slow plugin.
+  void testFanOutReject() {
+    addDso(ROUTECONFIG);
+    initializeFilter(absl::StrFormat(R"EOF(
+name: golang
+typed_config:
+  "@type": type.googleapis.com/envoy.extensions.filters.http.golang.v3.Config
+  so_id: %s
+  plugin_name: chain
+  plugin_config:
+    "@type": type.googleapis.com/envoy.extensions.filters.http.golang.v3.Chain
+    fan_out: true
+    plugins:
+    - plugin_name: xx
+      plugin_config:
+        "@type": type.googleapis.com/udpa.type.v1.TypedStruct
+        type_url: typexx
+        value:
+          sleep_ms: 3000
+    - plugin_name: named
+      plugin_config:
+        "@type": type.googleapis.com/udpa.type.v1.TypedStruct
+        type_url: typexx
+        value:
+          reject: true
+)EOF",
+                                     ROUTECONFIG),
+                     "test.com");
+
+    codec_client_ = makeHttpConnection(makeClientConnection(lookupPort("http")));
+    Http::TestRequestHeaderMapImpl request_headers{
+        {":method", "GET"}, {":path", "/test"}, {":scheme", "http"}, {":authority", "test.com"}};
+
+    auto start = timeSystem().monotonicTime();
+    auto response = codec_client_->makeHeaderOnlyRequest(request_headers);
+    ASSERT_TRUE(response->waitForEndStream());
+    EXPECT_EQ("403", response->headers().getStatusValue());
+    EXPECT_EQ("rejected by named-value\r\n", response->body());
+    EXPECT_LT(timeSystem().monotonicTime() - start, std::chrono::seconds(3));
+    cleanup();
+  }
+
+  // the request is forwarded upstream while Go is checking, and the response is held until
+  // Go continues or rejects the request.
+  void testSpeculative(bool reject) {
+    initializeSimpleFilter(BASIC, "MERGE_VIRTUALHOST_ROUTER_FILTER", "xx", true);
+
+    codec_client_ = makeHttpConnection(makeClientConnection(lookupPort("http")));
+    // only the idempotent requests are speculated.
+    Http::TestRequestHeaderMapImpl request_headers{
+        {":method", "GET"},
+        {":path", reject ? "/test?async=1&sleep=1&check=reject" : "/test?async=1&sleep=1&check=1"},
+        {":scheme", "http"},
+        {":authority", "test.com"}};
+
+    auto response = codec_client_->makeHeaderOnlyRequest(request_headers);
+
+    // Go sleeps 100ms in the check, the request is forwarded before it finishes.
+    waitForNextUpstreamRequest();
+    ASSERT_TRUE(upstream_request_->waitForEndStream(*dispatcher_));
+
+    Http::TestResponseHeaderMapImpl response_headers{{":status", "200"}};
+    upstream_request_->encodeHeaders(response_headers, false);
+
+    if (reject) {
+      // the held response is replaced by the local reply, and the upstream request is reset.
+      ASSERT_TRUE(response->waitForEndStream());
+      EXPECT_EQ("403", response->headers().getStatusValue());
+      ASSERT_TRUE(upstream_request_->waitForReset());
+    } else {
+      Buffer::OwnedImpl response_data("goodbye");
+      upstream_request_->encodeData(response_data, true);
+      ASSERT_TRUE(response->waitForEndStream());
+      EXPECT_EQ("200", response->headers().getStatusValue());
+    }
+    cleanup();
+  }
+
+  void testDecisionCache(bool reject) {
+    addDso(BASIC);
+    initializeFilter(absl::StrFormat(R"EOF(
+name: golang
+typed_config:
+  "@type": type.googleapis.com/envoy.extensions.filters.http.golang.v3.Config
+  so_id: %s
+  plugin_name: xx
+  plugin_config:
+    "@type": type.googleapis.com/udpa.type.v1.TypedStruct
+    type_url: typexx
+  decision_cache:
+    key_headers:
+    - x-token
+)EOF",
+                                     BASIC),
+                     "test.com");
+
+    const std::string prefix = "http.config_test.golang.xx.";
+    uint64_t crossings = 0;
+    codec_client_ = makeHttpConnection(makeClientConnection(lookupPort("http")));
+    auto send = [&](const Http::TestRequestHeaderMapImpl& request_headers) {
+      if (reject) {
+        auto response = codec_client_->makeHeaderOnlyRequest(request_headers);
+        ASSERT_TRUE(response->waitForEndStream());
+        EXPECT_EQ("403", response->headers().getStatusValue());
+        EXPECT_EQ("forbidden from go in decode-header\r\n", response->body());
+        // the headers of the local reply from Go.
+        EXPECT_EQ("decode-header", response->headers()
+                                       .get(Http::LowerCaseString("x-local-reply"))[0]
+                                       ->value()
+                                       .getStringView());
+        return;
+      }
+
+      auto response =
+          sendRequestAndWaitForResponse(request_headers, 0, default_response_headers_, 0);
+      EXPECT_EQ("200", response->headers().getStatusValue());
+      // the header mutations of Go are applied.
+      EXPECT_EQ("pass", upstream_request_->headers()
+                            .get(Http::LowerCaseString("x-decision"))[0]
+                            ->value()
+                            .getStringView());
+      EXPECT_TRUE(upstream_request_->headers().get(Http::LowerCaseString("x-token")).empty());
+    };
+
+    Http::TestRequestHeaderMapImpl request_headers{
+        {":method", "GET"},
+        {":path", reject ? "/test?async=1&cache=reject" : "/test?async=1&cache=pass"},
+        {":scheme", "http"},
+        {":authority", "test.com"},
+        {"x-token", "abc"}};
+    send(request_headers);
+    crossings = test_server_->counter(prefix + "crossings")->value();
+    EXPECT_GT(crossings, 0);
+    // the second one is served by the cached decision of the first one.
+    send(request_headers);
+
+    // nothing is called into Go for the cached one.
+    EXPECT_EQ(crossings, test_server_->counter(prefix + "crossings")->value());
+    EXPECT_EQ(1, test_server_->counter(prefix + "decision_cache_hit")->value());
+    EXPECT_EQ(1, test_server_->counter(prefix + "decision_cache_miss")->value());
+    EXPECT_EQ(1, test_server_->counter(prefix + "decision_cache_insert")->value());
+
+    // an empty key header and a missing one are different keys.
+    request_headers.setCopy(Http::LowerCaseString("x-token"), "");
+    send(request_headers);
+    request_headers.remove(Http::LowerCaseString("x-token"));
+    send(request_headers);
+    EXPECT_EQ(1, test_server_->counter(prefix + "decision_cache_hit")->value());
+    EXPECT_EQ(3, test_server_->counter(prefix + "decision_cache_miss")->value());
+    EXPECT_EQ(3, test_server_->counter(prefix + "decision_cache_insert")->value());
+    // the in-flight gauges go back when the streams are done.
+    test_server_->waitForGaugeEq(prefix + "streams_processing_header", 0);
+    test_server_->waitForGaugeEq(prefix + "buffered_bytes", 0);
+    test_server_->waitForGaugeEq(prefix + "sema_waiters", 0);
+    // the CPU time of the first one is counted to the route.
+    test_server_->waitForCounterExists(prefix + "route.test-route-name.cpu_time_us");
+    // the metric of the plugin is flushed from the shared memory.
+    test_server_->waitForCounterGe("golang.basic.requests", 1);
+    cleanup();
+  }
+
+  void testCpuBudget() {
+    addDso(BASIC);
+    // 1% of the 10s window, 100ms.
+    initializeFilter(absl::StrFormat(R"EOF(
+name: golang
+typed_config:
+  "@type": type.googleapis.com/envoy.extensions.filters.http.golang.v3.Config
+  so_id: %s
+  plugin_name: xx
+  plugin_config:
+    "@type": type.googleapis.com/udpa.type.v1.TypedStruct
+    type_url: typexx
+  cpu_budget:
+    window: 10s
+    max_percent: 1
+    local_reply:
+      status: 503
+)EOF",
+                                     BASIC),
+                     "test.com");
+
+    const std::string prefix = "http.config_test.golang.xx.";
+    codec_client_ = makeHttpConnection(makeClientConnection(lookupPort("http")));
+    Http::TestRequestHeaderMapImpl request_headers{{":method", "GET"},
+                                                   {":path", "/test?burn=300"},
+                                                   {":scheme", "http"},
+                                                   {":authority", "test.com"}};
+
+    // the sync call burns the CPU over the budget, the in-flight stream is not affected.
+    auto response = sendRequestAndWaitForResponse(request_headers, 0, default_response_headers_, 0);
+    EXPECT_EQ("200", response->headers().getStatusValue());
+    test_server_->waitForCounterGe(prefix + "cpu_time_us", 300000);
+
+    // the new stream is shed, without calling into Go.
+    auto crossings = test_server_->counter(prefix + "crossings")->value();
+    response = codec_client_->makeHeaderOnlyRequest(request_headers);
+    ASSERT_TRUE(response->waitForEndStream());
+    EXPECT_EQ("503", response->headers().getStatusValue());
+    EXPECT_EQ(1, test_server_->counter(prefix + "cpu_budget_rejected")->value());
+    EXPECT_EQ(crossings, test_server_->counter(prefix + "crossings")->value());
+    cleanup();
+  }
+
+  // the goroutine sleeps 100ms in the decode header phase, it's the async time of the phase.
+  void testPhaseHistograms() {
+    initializeSimpleFilter(BASIC);
+
+    const std::string prefix = "http.config_test.golang.xx.";
+    codec_client_ = makeHttpConnection(makeClientConnection(lookupPort("http")));
+    Http::TestRequestHeaderMapImpl request_headers{{":method", "GET"},
+                                                   {":path", "/test?async=1&sleep=1"},
+                                                   {":scheme", "http"},
+                                                   {":authority", "test.com"}};
+    auto response = sendRequestAndWaitForResponse(request_headers, 0, default_response_headers_, 0);
+    EXPECT_EQ("200", response->headers().getStatusValue());
+
+    for (const auto& name : {"decode_header_sync_time", "decode_header_async_time",
+                             "decode_header_go_time", "encode_header_go_time"}) {
+      test_server_->waitUntilHistogramHasSamples(prefix + name);
+    }
+    auto& dispatcher = test_server_->server().dispatcher();
+    auto sum = [&](const std::string& name) {
+      return TestUtility::readSampleSum(dispatcher, *test_server_->histogram(prefix + name));
+    };
+    EXPECT_GE(sum("decode_header_async_time"), 100000);
+    EXPECT_GE(sum("decode_header_go_time"), sum("decode_header_async_time"));
+    EXPECT_GE(test_server_->counter(prefix + "crossings")->value(), 2);
+    cleanup();
+  }
+
+  // the records from Go are passed to the http logger of Envoy in batches, the ones below its level
+  // are filtered in Go, and the ones that do not fit in the queue are dropped and counted.
+  void testGoLog() {
+    LogLevelSetter save_levels(spdlog::level::info);
+    LogRecordingSink sink(Logger::Registry::getSink());
+    initializeSimpleFilter(BASIC);
+
+    codec_client_ = makeHttpConnection(makeClientConnection(lookupPort("http")));
+    Http::TestRequestHeaderMapImpl request_headers{{":method", "GET"},
+                                                   {":path", "/test?log=1"},
+                                                   {":scheme", "http"},
+                                                   {":authority", "test.com"}};
+    auto debug_enabled = [&]() {
+      return upstream_request_->headers()
+          .get(Http::LowerCaseString("x-log-debug"))[0]
+          ->value()
+          .getStringView();
+    };
+    // Go refreshes the level of Envoy every second.
+    int requests = 1;
+    sendRequestAndWaitForResponse(request_headers, 0, default_response_headers_, 0);
+    for (; debug_enabled() != "false"; requests++) {
+      ASSERT_LT(requests, 30);
+      timeSystem().realSleepDoNotUseWithoutScrutiny(std::chrono::milliseconds(100));
+      sendRequestAndWaitForResponse(request_headers, 0, default_response_headers_, 0);
+    }
+
+    // more records than the queue holds, in one go.
+    const int records = 10000;
+    request_headers.setPath(absl::StrCat("/test?log=", records));
+    auto response = sendRequestAndWaitForResponse(request_headers, 0, default_response_headers_, 0);
+    EXPECT_EQ("200", response->headers().getStatusValue());
+    test_server_->waitForCounterGe("golang._runtime.log.dropped", 1);
+
+    // every record is either logged or counted as dropped, and only the info ones are logged.
+    auto logged = [&](absl::string_view message) -> uint64_t {
+      const auto messages = sink.messages();
+      return std::count_if(messages.begin(), messages.end(), [&](const std::string& m) {
+        return absl::StrContains(m, message);
+      });
+    };
+    for (int i = 0;; i++) {
+      auto dropped = test_server_->counter("golang._runtime.log.dropped")->value();
+      if (logged("golang: info record from go") + dropped == uint64_t(requests + records)) {
+        break;
+      }
+      ASSERT_LT(i, 50);
+      timeSystem().realSleepDoNotUseWithoutScrutiny(std::chrono::milliseconds(100));
+    }
+    EXPECT_EQ(0U, logged("golang: debug record from go"));
+    cleanup();
+  }
+
+  // the goroutines call AsyncStarted first and then sleep 100ms, in the header phases, so the
+  // sleep is the work time, and the scheduling of the goroutines is much shorter.
+  void testAsyncTime() {
+    initializeSimpleFilter(BASIC);
+
+    const std::string prefix = "http.config_test.golang.xx.";
+    codec_client_ = makeHttpConnection(makeClientConnection(lookupPort("http")));
+    Http::TestRequestHeaderMapImpl request_headers{{":method", "GET"},
+                                                   {":path", "/test?async=1&sleep=1"},
+                                                   {":scheme", "http"},
+                                                   {":authority", "test.com"}};
+    auto response = sendRequestAndWaitForResponse(request_headers, 0, default_response_headers_, 0);
+    EXPECT_EQ("200", response->headers().getStatusValue());
+
+    for (const auto& name : {"async_schedule_lag", "async_work_time", "async_dispatch_lag"}) {
+      test_server_->waitUntilHistogramHasSamples(prefix + name);
+    }
+    auto& dispatcher = test_server_->server().dispatcher();
+    auto sum = [&](const std::string& name) {
+      return TestUtility::readSampleSum(dispatcher, *test_server_->histogram(prefix + name));
+    };
+    auto count = [&](const std::string& name) {
+      return TestUtility::readSampleCount(dispatcher, *test_server_->histogram(prefix + name));
+    };
+    EXPECT_EQ(count("async_work_time"), count("async_schedule_lag"));
+    EXPECT_EQ(count("async_work_time"), count("async_dispatch_lag"));
+    EXPECT_GE(sum("async_work_time"), 100000 * count("async_work_time"));
+    EXPECT_LT(sum("async_schedule_lag"), sum("async_work_time"));
+    EXPECT_LT(sum("async_dispatch_lag"), sum("async_work_time"));
+    // the CPU time of the goroutines is unknown, every async phase is counted.
+    EXPECT_EQ(count("async_work_time"),
+              test_server_->counter(prefix + "async_cpu_time_unknown")->value());
+    cleanup();
+  }
+
   void testPanicRecover(std::string path) {
     initializeSimpleFilter(BASIC);
 
@@ -638,6 +1093,107 @@ typed_config:
     cleanup();
   }
 
+  // the dsos printed by the /golang admin handler.
+  ProtobufWkt::ListValue adminGolangDsos() {
+    auto response = IntegrationUtil::makeSingleRequest(lookupPort("admin"), "GET", "/golang", "",
+                                                       Http::CodecType::HTTP1, version_);
+    EXPECT_TRUE(response->complete());
+    EXPECT_EQ("200", response->headers().getStatusValue());
+    ProtobufWkt::Struct root;
+    MessageUtil::loadFromJson(response->body(), root);
+    return root.fields().at("dsos").list_value();
+  }
+
+  // the profiles of the Go runtime in the dso, served by the admin interface.
+  void testAdminPprof() {
+    initializeSimpleFilter(BASIC);
+
+    auto admin = [this](const std::string& path) {
+      auto response = IntegrationUtil::makeSingleRequest(lookupPort("admin"), "GET", path, "",
+                                                         Http::CodecType::HTTP1, version_);
+      EXPECT_TRUE(response->complete());
+      return response;
+    };
+    // the protobuf profiles are gzipped.
+    auto expect_profile = [](const BufferingStreamDecoderPtr& response) {
+      EXPECT_EQ("200", response->headers().getStatusValue());
+      EXPECT_EQ("application/octet-stream", response->headers().getContentTypeValue());
+      ASSERT_GE(response->body().size(), 2U);
+      EXPECT_EQ("\x1f\x8b", response->body().substr(0, 2));
+    };
+
+    EXPECT_EQ("400", admin("/golang/pprof/heap")->headers().getStatusValue());
+    EXPECT_EQ("404", admin("/golang/pprof/heap?so_id=unknown")->headers().getStatusValue());
+
+    expect_profile(admin(absl::StrCat("/golang/pprof/heap?so_id=", BASIC)));
+    expect_profile(admin(absl::StrCat("/golang/pprof/goroutine?so_id=", BASIC)));
+    auto response = admin(absl::StrCat("/golang/pprof/goroutine?debug=2&so_id=", BASIC));
+    EXPECT_EQ("200", response->headers().getStatusValue());
+    EXPECT_THAT(response->body(), testing::HasSubstr("goroutine "));
+
+    EXPECT_EQ("400", admin(absl::StrCat("/golang/pprof/profile?seconds=0&so_id=", BASIC))
+                         ->headers()
+                         .getStatusValue());
+    EXPECT_EQ("202", admin(absl::StrCat("/golang/pprof/profile?seconds=60&so_id=", BASIC))
+                         ->headers()
+                         .getStatusValue());
+    EXPECT_EQ("409", admin(absl::StrCat("/golang/pprof/profile?seconds=60&so_id=", BASIC))
+                         ->headers()
+                         .getStatusValue());
+    expect_profile(admin(absl::StrCat("/golang/pprof/profile/stop?so_id=", BASIC)));
+    // the last profile is kept after it's stopped.
+    expect_profile(admin(absl::StrCat("/golang/pprof/profile/stop?so_id=", BASIC)));
+
+    // the profile is stopped after the seconds without /golang/pprof/profile/stop, then a new one
+    // could be started.
+    const auto start = absl::StrCat("/golang/pprof/profile?seconds=1&so_id=", BASIC);
+    EXPECT_EQ("202", admin(start)->headers().getStatusValue());
+    for (int i = 0;; i++) {
+      ASSERT_LT(i, 50);
+      timeSystem().realSleepDoNotUseWithoutScrutiny(std::chrono::milliseconds(100));
+      auto status = admin(start)->headers().getStatusValue();
+      if (status == "202") {
+        break;
+      }
+      EXPECT_EQ("409", status);
+    }
+    expect_profile(admin(absl::StrCat("/golang/pprof/profile/stop?so_id=", BASIC)));
+  }
+
+  void testAdminGolang() {
+    initializeSimpleFilter(BASIC);
+
+    codec_client_ = makeHttpConnection(makeClientConnection(lookupPort("http")));
+    Http::TestRequestHeaderMapImpl request_headers{
+        {":method", "GET"}, {":path", "/test"}, {":scheme", "http"}, {":authority", "test.com"}};
+    auto response = codec_client_->makeHeaderOnlyRequest(request_headers);
+    waitForNextUpstreamRequest();
+    upstream_request_->encodeHeaders(default_response_headers_, true);
+    ASSERT_TRUE(response->waitForEndStream());
+    cleanup();
+
+    // the stream is unpinned once it's destroyed, it's deferred after the response.
+    ProtobufWkt::Struct dso;
+    for (auto i = 0; i < 100; i++) {
+      auto dsos = adminGolangDsos();
+      ASSERT_EQ(1, dsos.values_size());
+      dso = dsos.values(0).struct_value();
+      if (dso.fields().at("streams").number_value() == 0) {
+        break;
+      }
+      timeSystem().advanceTimeWait(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(BASIC, dso.fields().at("id").string_value());
+    EXPECT_EQ(genSoPath(BASIC), dso.fields().at("path").string_value());
+    EXPECT_EQ(0, dso.fields().at("streams").number_value());
+
+    // the Go runtime stats of the basic plugin.
+    ASSERT_TRUE(dso.fields().contains("go_runtime"));
+    const auto& go_runtime = dso.fields().at("go_runtime").struct_value().fields();
+    EXPECT_GT(go_runtime.at("heap_inuse_bytes").number_value(), 0);
+    EXPECT_GE(go_runtime.at("plugin_configs").number_value(), 1);
+  }
+
   void cleanup() {
     codec_client_->close();
     if (fake_golang_connection_ != nullptr) {
@@ -816,6 +1372,62 @@ TEST_P(GolangIntegrationTest, RouteConfig_Route) {
   testRouteConfig("test.com", "/route-config-test", false, "baz");
 }
 
+// merge all of the configs
+// filter: remove: x-test-header-0
+// virtualhost: set: bar2
+TEST_P(GolangIntegrationTest, RouteConfig_MergeAll) {
+  testRouteConfig("partial.com", "/test", false, "bar2");
+}
+
+// merge virtualhost and route only
+TEST_P(GolangIntegrationTest, RouteConfig_MergeVirtualHostRouter) {
+  testRouteConfig("partial.com", "/test", true, "bar2", "MERGE_VIRTUALHOST_ROUTER");
+}
+
+TEST_P(GolangIntegrationTest, RouteConfig_MergeVirtualHostRouter_Route) {
+  testRouteConfig("partial.com", "/route-config-test", false, "bar2", "MERGE_VIRTUALHOST_ROUTER");
+}
+
+// fallback to the filter config
+TEST_P(GolangIntegrationTest, RouteConfig_MergeVirtualHostRouter_Filter) {
+  testRouteConfig("filter-level.com", "/test", false, "foo", "MERGE_VIRTUALHOST_ROUTER");
+}
+
+// the route config only
+// route: remove: x-test-header-0
+TEST_P(GolangIntegrationTest, RouteConfig_Override) {
+  testRouteConfig("partial.com", "/route-config-test", false, "", "OVERRIDE");
+}
+
+// the virtualhost config only
+TEST_P(GolangIntegrationTest, RouteConfig_Override_VirtualHost) {
+  testRouteConfig("partial.com", "/test", true, "bar2", "OVERRIDE");
+}
+
+TEST_P(GolangIntegrationTest, NamedPlugin) { testNamedPlugin("test.com", "/route-config-test"); }
+
+TEST_P(GolangIntegrationTest, Chain) { testChain(false); }
+
+TEST_P(GolangIntegrationTest, Chain_FanOut) { testChain(true); }
+
+TEST_P(GolangIntegrationTest, Chain_FanOutReject) { testFanOutReject(); }
+
+TEST_P(GolangIntegrationTest, Speculative_Pass) { testSpeculative(false); }
+
+TEST_P(GolangIntegrationTest, Speculative_Reject) { testSpeculative(true); }
+
+TEST_P(GolangIntegrationTest, DecisionCache_Pass) { testDecisionCache(false); }
+
+TEST_P(GolangIntegrationTest, DecisionCache_Reject) { testDecisionCache(true); }
+
+TEST_P(GolangIntegrationTest, CpuBudget) { testCpuBudget(); }
+
+TEST_P(GolangIntegrationTest, PhaseHistograms) { testPhaseHistograms(); }
+
+TEST_P(GolangIntegrationTest, AsyncTime) { testAsyncTime(); }
+
+TEST_P(GolangIntegrationTest, GoLog) { testGoLog(); }
+
 TEST_P(GolangIntegrationTest, PanicRecover_DecodeHeader) {
   testPanicRecover("/test?panic=decode-header");
 }
@@ -836,6 +1448,10 @@ TEST_P(GolangIntegrationTest, PanicRecover_EncodeData_Async) {
   testPanicRecover("/test?async=1&sleep=1&panic=encode-data");
 }
 
+TEST_P(GolangIntegrationTest, AdminGolang) { testAdminGolang(); }
+
+TEST_P(GolangIntegrationTest, AdminPprof) { testAdminPprof(); }
+
 TEST_P(GolangIntegrationTest, DynamicMetadata) { testDynamicMetadata("/test?dymeta=1"); }
 
 TEST_P(GolangIntegrationTest, DynamicMetadata_Async) {
@@ -1,6 +1,6 @@
 module example.com/basic
 
-go 1.18
+go 1.19
 
 require mosn.io/envoy-go-extension v0.0.0-20221020015753-d29836e4c75f
 
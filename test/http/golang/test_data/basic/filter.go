@@ -11,6 +11,8 @@ import (
 	"mosn.io/envoy-go-extension/pkg/http"
 )
 
+var requests = http.DefineCounterMetric("basic", "requests")
+
 func init() {
 	http.RegisterHttpFilterConfigFactory(configFactory)
 }
@@ -23,13 +25,17 @@ type filter struct {
 
 	// test mode, from query parameters
 	async       bool
-	sleep       bool   // all sleep
-	data_sleep  bool   // only sleep in data phase
-	localreplay string // send local reply
-	databuffer  string // return api.Stop
-	panic       string // trigger panic in which phase
-	add_header  bool   // add header
-	dymeta      bool   // dynamic metadata
+	sleep       bool          // all sleep
+	data_sleep  bool          // only sleep in data phase
+	localreplay string        // send local reply
+	databuffer  string        // return api.Stop
+	panic       string        // trigger panic in which phase
+	add_header  bool          // add header
+	dymeta      bool          // dynamic metadata
+	check       string        // read only check in the speculative mode, pass or reject
+	cache       string        // cache the decision of the decode header phase, pass or reject
+	burn        time.Duration // burn the CPU in the decode header phase
+	logs        int           // the number of the info records logged in the decode header phase
 }
 
 func parseQuery(path string) url.Values {
@@ -65,6 +71,14 @@ func (f *filter) initRequest(header api.HeaderMap) {
 	f.databuffer = f.query_params.Get("databuffer")
 	f.localreplay = f.query_params.Get("localreply")
 	f.panic = f.query_params.Get("panic")
+	f.check = f.query_params.Get("check")
+	f.cache = f.query_params.Get("cache")
+	if ms, err := strconv.Atoi(f.query_params.Get("burn")); err == nil {
+		f.burn = time.Duration(ms) * time.Millisecond
+	}
+	if n, err := strconv.Atoi(f.query_params.Get("log")); err == nil {
+		f.logs = n
+	}
 }
 
 func (f *filter) fail(msg string, a ...any) api.StatusType {
@@ -74,7 +88,7 @@ func (f *filter) fail(msg string, a ...any) api.StatusType {
 }
 
 func (f *filter) sendLocalReply(phase string) api.StatusType {
-	headers := make(map[string]string)
+	headers := map[string]string{"x-local-reply": phase}
 	body := fmt.Sprintf("forbidden from go in %s\r\n", phase)
 	f.callbacks.SendLocalReply(403, body, headers, -1, "test-from-go")
 	return api.LocalReply
@@ -85,9 +99,38 @@ func (f *filter) decodeHeaders(header api.RequestHeaderMap, endStream bool) api.
 	if f.sleep {
 		time.Sleep(time.Millisecond * 100) // sleep 100 ms
 	}
+	for start := time.Now(); time.Since(start) < f.burn; {
+	}
+	if f.logs > 0 {
+		header.Set("x-log-debug", strconv.FormatBool(f.callbacks.LogEnabled(api.Debug)))
+		// it's filtered in Go, when the level of Envoy is above debug.
+		f.callbacks.Log(api.Debug, "debug record from go")
+		for i := 0; i < f.logs; i++ {
+			f.callbacks.Logf(api.Info, "info record from go %d", i)
+		}
+	}
 	if strings.Contains(f.localreplay, "decode-header") {
 		return f.sendLocalReply("decode-header")
 	}
+	if f.check == "reject" {
+		return f.sendLocalReply("decode-header")
+	}
+	if f.cache != "" {
+		f.callbacks.CacheDecision(time.Minute)
+		if f.cache == "reject" {
+			return f.sendLocalReply("decode-header")
+		}
+		header.Set("x-decision", "pass")
+		header.Del("x-token")
+		return api.Continue
+	}
+	if f.check != "" {
+		// the request headers are forwarded already, can not modify them.
+		if _, found := header.Get(":path"); !found {
+			return f.fail("header Get :path: not found")
+		}
+		return api.Continue
+	}
 	if f.dymeta {
 		dymeta := f.callbacks.StreamInfo().DynamicMetadata()
 		m := dymeta.Get("envoy.lb")
@@ -285,11 +328,17 @@ func (f *filter) encodeTrailers(trailers api.ResponseTrailerMap) api.StatusType
 
 func (f *filter) DecodeHeaders(header api.RequestHeaderMap, endStream bool) api.StatusType {
 	f.initRequest(header)
+	requests.Increment(1)
 	if f.async {
 		go func() {
 			defer f.callbacks.RecoverPanic()
+			f.callbacks.AsyncStarted()
+			f.callbacks.SetSpanTag("test", "async")
 
+			start := time.Now()
 			status := f.decodeHeaders(header, endStream)
+			f.callbacks.AddSpan("decode-headers", start, time.Now(),
+				map[string]string{"end-stream": strconv.FormatBool(endStream)})
 			if status != api.LocalReply {
 				f.callbacks.Continue(status)
 			}
@@ -305,6 +354,7 @@ func (f *filter) DecodeData(buffer api.BufferInstance, endStream bool) api.Statu
 	if f.async {
 		go func() {
 			defer f.callbacks.RecoverPanic()
+			f.callbacks.AsyncStarted()
 
 			status := f.decodeData(buffer, endStream)
 			if status != api.LocalReply {
@@ -322,6 +372,7 @@ func (f *filter) DecodeTrailers(trailers api.RequestTrailerMap) api.StatusType {
 	if f.async {
 		go func() {
 			defer f.callbacks.RecoverPanic()
+			f.callbacks.AsyncStarted()
 
 			status := f.decodeTrailers(trailers)
 			if status != api.LocalReply {
@@ -339,6 +390,7 @@ func (f *filter) EncodeHeaders(header api.ResponseHeaderMap, endStream bool) api
 	if f.async {
 		go func() {
 			defer f.callbacks.RecoverPanic()
+			f.callbacks.AsyncStarted()
 
 			status := f.encodeHeaders(header, endStream)
 			if status != api.LocalReply {
@@ -356,6 +408,7 @@ func (f *filter) EncodeData(buffer api.BufferInstance, endStream bool) api.Statu
 	if f.async {
 		go func() {
 			defer f.callbacks.RecoverPanic()
+			f.callbacks.AsyncStarted()
 
 			status := f.encodeData(buffer, endStream)
 			if status != api.LocalReply {
@@ -373,6 +426,7 @@ func (f *filter) EncodeTrailers(trailers api.ResponseTrailerMap) api.StatusType
 	if f.async {
 		go func() {
 			defer f.callbacks.RecoverPanic()
+			f.callbacks.AsyncStarted()
 
 			status := f.encodeTrailers(trailers)
 			if status != api.LocalReply {
@@ -1,6 +1,6 @@
 module example.com/passthrough
 
-go 1.18
+go 1.19
 
 require mosn.io/envoy-go-extension v0.0.0-20221020091338-0a61e17d6514
 
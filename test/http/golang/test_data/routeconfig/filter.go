@@ -1,6 +1,8 @@
 package main
 
 import (
+	"time"
+
 	udpa "github.com/cncf/xds/go/udpa/type/v1"
 	"google.golang.org/protobuf/types/known/anypb"
 
@@ -11,11 +13,17 @@ import (
 func init() {
 	http.RegisterHttpFilterConfigFactory(configFactory)
 	http.RegisterHttpFilterConfigParser(&parser{})
+
+	// another plugin in the same library, sets the header with another value.
+	http.RegisterHttpFilterConfigFactoryByName("named", namedConfigFactory)
+	http.RegisterHttpFilterConfigParserByName("named", &parser{})
 }
 
 type config struct {
 	removeHeader string
 	setHeader    string
+	sleep        time.Duration // continue the decode header phase in a goroutine after sleeping
+	reject       bool          // reject in the decode header phase
 }
 
 type parser struct {
@@ -32,6 +40,12 @@ func (p *parser) Parse(any *anypb.Any) interface{} {
 	if set, ok := v.AsMap()["set"].(string); ok {
 		conf.setHeader = set
 	}
+	if ms, ok := v.AsMap()["sleep_ms"].(float64); ok {
+		conf.sleep = time.Duration(ms) * time.Millisecond
+	}
+	if reject, ok := v.AsMap()["reject"].(bool); ok {
+		conf.reject = reject
+	}
 	return conf
 }
 
@@ -47,15 +61,35 @@ func (p *parser) Merge(parent interface{}, child interface{}) interface{} {
 	if childConfig.setHeader != "" {
 		newConfig.setHeader = childConfig.setHeader
 	}
+	if childConfig.sleep != 0 {
+		newConfig.sleep = childConfig.sleep
+	}
+	newConfig.reject = newConfig.reject || childConfig.reject
 	return &newConfig
 }
 
 type filter struct {
 	config    *config
 	callbacks api.FilterCallbackHandler
+	value     string
 }
 
 func (f *filter) DecodeHeaders(header api.RequestHeaderMap, endStream bool) api.StatusType {
+	if f.config.reject {
+		f.callbacks.SendLocalReply(403, "rejected by "+f.value+"\r\n", nil, -1, "")
+		return api.LocalReply
+	}
+	if f.config.setHeader != "" {
+		header.Set(f.config.setHeader, f.value)
+	}
+	if f.config.sleep > 0 {
+		go func() {
+			defer f.callbacks.RecoverPanic()
+			time.Sleep(f.config.sleep)
+			f.callbacks.Continue(api.Continue)
+		}()
+		return api.Running
+	}
 	return api.Continue
 }
 
@@ -72,7 +106,7 @@ func (f *filter) EncodeHeaders(header api.ResponseHeaderMap, endStream bool) api
 		header.Del(f.config.removeHeader)
 	}
 	if f.config.setHeader != "" {
-		header.Set(f.config.setHeader, "test-value")
+		header.Set(f.config.setHeader, f.value)
 	}
 	return api.Continue
 }
@@ -95,6 +129,18 @@ func configFactory(c interface{}) api.HttpFilterFactory {
 		return &filter{
 			config:    conf,
 			callbacks: callbacks,
+			value:     "test-value",
+		}
+	}
+}
+
+func namedConfigFactory(c interface{}) api.HttpFilterFactory {
+	conf := c.(*config)
+	return func(callbacks api.FilterCallbackHandler) api.HttpFilter {
+		return &filter{
+			config:    conf,
+			callbacks: callbacks,
+			value:     "named-value",
 		}
 	}
 }
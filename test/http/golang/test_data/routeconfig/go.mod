@@ -1,6 +1,6 @@
 module example.com/routeconfig
 
-go 1.18
+go 1.19
 
 require (
 	github.com/cncf/xds/go v0.0.0-20220520190051-1e77728a1eaa